@@ -15,6 +15,7 @@
 #include "odb/streaming.h"
 #include "strbuf.h"
 #include "run-command.h"
+#include "thread-utils.h"
 #include "write-or-die.h"
 
 #define RECORDSIZE	(512)
@@ -373,7 +374,7 @@ static struct archiver *find_tar_filter(const char *name, size_t len)
 }
 
 static int tar_filter_config(const char *var, const char *value,
-			     void *data UNUSED)
+			     const struct key_value_info *kvi)
 {
 	struct archiver *ar;
 	const char *name;
@@ -390,6 +391,7 @@ static int tar_filter_config(const char *var, const char *value,
 		ar->write_archive = write_tar_filter_archive;
 		ar->flags = ARCHIVER_WANT_COMPRESSION_LEVELS |
 			    ARCHIVER_HIGH_COMPRESSION_LEVELS;
+		ar->threads = 1;
 		ALLOC_GROW(tar_filters, nr_tar_filters + 1, alloc_tar_filters);
 		tar_filters[nr_tar_filters++] = ar;
 	}
@@ -408,12 +410,16 @@ static int tar_filter_config(const char *var, const char *value,
 			ar->flags &= ~ARCHIVER_REMOTE;
 		return 0;
 	}
+	if (!strcmp(type, "threads")) {
+		ar->threads = git_config_int(var, value, kvi);
+		return 0;
+	}
 
 	return 0;
 }
 
 static int git_tar_config(const char *var, const char *value,
-			  const struct config_context *ctx, void *cb)
+			  const struct config_context *ctx, void *cb UNUSED)
 {
 	if (!strcmp(var, "tar.umask")) {
 		if (value && !strcmp(value, "user")) {
@@ -425,7 +431,7 @@ static int git_tar_config(const char *var, const char *value,
 		return 0;
 	}
 
-	return tar_filter_config(var, value, cb);
+	return tar_filter_config(var, value, ctx->kvi);
 }
 
 static int write_tar_archive(const struct archiver *ar UNUSED,
@@ -466,6 +472,269 @@ static void tgz_write_block(const void *data)
 	tgz_deflate(Z_NO_FLUSH);
 }
 
+/*
+ * Parallel gzip, in the style of pigz: the tar stream is cut into chunks
+ * that are deflated independently by worker threads, each primed with
+ * the last 32 KiB of the preceding chunk so the compression ratio barely
+ * suffers.  Every chunk but the last ends in a sync flush so that the
+ * pieces can simply be concatenated.  The output depends on the chunk
+ * size but not on the number of threads.
+ */
+#define PGZ_CHUNK_SIZE (128 * 1024)
+#define PGZ_DICT_SIZE (32 * 1024)
+
+struct pgz_job {
+	unsigned char dict[PGZ_DICT_SIZE];
+	size_t dict_len;
+	unsigned char *data;
+	size_t len;
+	int last;
+	int done;
+	uint32_t crc;
+	struct strbuf out;
+};
+
+static struct {
+	int level;
+	struct pgz_job *jobs;
+	int nr_jobs;
+	int head;		/* oldest job not yet written out */
+	int nr_queued;		/* jobs handed to the workers, from head on */
+	int next_work;		/* next queued job no worker has claimed */
+	int nr_unclaimed;
+	int quit;
+	uint32_t crc;
+	uintmax_t size;
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	pthread_t *threads;
+	int nr_threads;
+} pgz;
+
+static struct pgz_job *pgz_filling(void)
+{
+	return &pgz.jobs[(pgz.head + pgz.nr_queued) % pgz.nr_jobs];
+}
+
+static void pgz_deflate_job(struct pgz_job *job)
+{
+	git_zstream stream;
+	int flush = job->last ? Z_FINISH : Z_SYNC_FLUSH;
+	int status;
+
+	git_deflate_init_raw(&stream, pgz.level);
+	if (job->dict_len &&
+	    deflateSetDictionary(&stream.z, job->dict, job->dict_len) != Z_OK)
+		BUG("deflateSetDictionary() failed");
+
+	strbuf_reset(&job->out);
+	/* room for the sync flush marker on top of the usual bound */
+	strbuf_grow(&job->out, git_deflate_bound(&stream, job->len) + 16);
+	stream.next_in = job->data;
+	stream.avail_in = job->len;
+	for (;;) {
+		stream.next_out = (unsigned char *)job->out.buf + job->out.len;
+		stream.avail_out = job->out.alloc - job->out.len - 1;
+		status = git_deflate(&stream, flush);
+		strbuf_setlen(&job->out,
+			      (char *)stream.next_out - job->out.buf);
+		if (status == Z_STREAM_END)
+			break;
+		if (status != Z_OK && status != Z_BUF_ERROR)
+			die(_("deflate error (%d)"), status);
+		if (!job->last && !stream.avail_in && stream.avail_out)
+			break;
+		strbuf_grow(&job->out, PGZ_DICT_SIZE);
+	}
+	/* deflateEnd() complains about a stream that was never finished */
+	if (job->last)
+		git_deflate_end(&stream);
+	else
+		git_deflate_abort(&stream);
+
+	job->crc = crc32(crc32(0, NULL, 0), job->data, job->len);
+}
+
+static void *pgz_worker(void *data UNUSED)
+{
+	pthread_mutex_lock(&pgz.mutex);
+	for (;;) {
+		struct pgz_job *job;
+
+		while (!pgz.nr_unclaimed && !pgz.quit)
+			pthread_cond_wait(&pgz.work_cond, &pgz.mutex);
+		if (!pgz.nr_unclaimed)
+			break;
+		job = &pgz.jobs[pgz.next_work];
+		pgz.next_work = (pgz.next_work + 1) % pgz.nr_jobs;
+		pgz.nr_unclaimed--;
+		pthread_mutex_unlock(&pgz.mutex);
+
+		pgz_deflate_job(job);
+
+		pthread_mutex_lock(&pgz.mutex);
+		job->done = 1;
+		pthread_cond_broadcast(&pgz.done_cond);
+	}
+	pthread_mutex_unlock(&pgz.mutex);
+	return NULL;
+}
+
+/* Wait for the oldest queued job and write out its compressed data. */
+static void pgz_write_oldest(void)
+{
+	struct pgz_job *job = &pgz.jobs[pgz.head];
+
+	pthread_mutex_lock(&pgz.mutex);
+	while (!job->done)
+		pthread_cond_wait(&pgz.done_cond, &pgz.mutex);
+	pthread_mutex_unlock(&pgz.mutex);
+
+	write_or_die(1, job->out.buf, job->out.len);
+	pgz.crc = crc32_combine(pgz.crc, job->crc, job->len);
+	pgz.size += job->len;
+
+	pgz.head = (pgz.head + 1) % pgz.nr_jobs;
+	pgz.nr_queued--;
+}
+
+static void pgz_submit(int last)
+{
+	struct pgz_job *job = pgz_filling();
+	struct pgz_job *next;
+	size_t dict_len;
+
+	job->last = last;
+	job->done = 0;
+	pthread_mutex_lock(&pgz.mutex);
+	pgz.nr_queued++;
+	pgz.nr_unclaimed++;
+	pthread_cond_signal(&pgz.work_cond);
+	pthread_mutex_unlock(&pgz.mutex);
+
+	if (last)
+		return;
+	if (pgz.nr_queued == pgz.nr_jobs)
+		pgz_write_oldest();
+
+	/* Workers only read job->data, so it is safe to copy from it. */
+	next = pgz_filling();
+	dict_len = job->len < PGZ_DICT_SIZE ? job->len : PGZ_DICT_SIZE;
+	memcpy(next->dict, job->data + job->len - dict_len, dict_len);
+	next->dict_len = dict_len;
+	next->len = 0;
+}
+
+static void pgz_write_block(const void *data)
+{
+	const unsigned char *buf = data;
+	size_t size = BLOCKSIZE;
+
+	while (size) {
+		struct pgz_job *job = pgz_filling();
+		size_t chunk = PGZ_CHUNK_SIZE - job->len;
+
+		if (chunk > size)
+			chunk = size;
+		memcpy(job->data + job->len, buf, chunk);
+		job->len += chunk;
+		buf += chunk;
+		size -= chunk;
+		if (job->len == PGZ_CHUNK_SIZE)
+			pgz_submit(0);
+	}
+}
+
+static void pgz_start(int level, int nr_threads)
+{
+	unsigned char header[10] = { 0x1f, 0x8b, 8 };
+	int level_used = level == Z_DEFAULT_COMPRESSION ? 6 : level;
+
+	/* Same header as zlib writes for us in the single-threaded case. */
+	header[8] = level_used == 9 ? 2 : level_used < 2 ? 4 : 0;
+	header[9] = 3; /* Unix, for reproducibility */
+	write_or_die(1, header, sizeof(header));
+
+	memset(&pgz, 0, sizeof(pgz));
+	pgz.level = level;
+	pgz.nr_threads = nr_threads;
+	pgz.nr_jobs = 2 * nr_threads;
+	CALLOC_ARRAY(pgz.jobs, pgz.nr_jobs);
+	for (int i = 0; i < pgz.nr_jobs; i++) {
+		pgz.jobs[i].data = xmalloc(PGZ_CHUNK_SIZE);
+		strbuf_init(&pgz.jobs[i].out, 0);
+	}
+	pgz.crc = crc32(0, NULL, 0);
+	pthread_mutex_init(&pgz.mutex, NULL);
+	pthread_cond_init(&pgz.work_cond, NULL);
+	pthread_cond_init(&pgz.done_cond, NULL);
+
+	ALLOC_ARRAY(pgz.threads, nr_threads);
+	for (int i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&pgz.threads[i], NULL,
+					 pgz_worker, NULL);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+}
+
+static void copy_le32(unsigned char *dest, uint32_t n)
+{
+	dest[0] = 0xff & n;
+	dest[1] = 0xff & (n >> 010);
+	dest[2] = 0xff & (n >> 020);
+	dest[3] = 0xff & (n >> 030);
+}
+
+static void pgz_finish(void)
+{
+	unsigned char trailer[8];
+
+	pgz_submit(1);
+	while (pgz.nr_queued)
+		pgz_write_oldest();
+
+	copy_le32(trailer, pgz.crc);
+	copy_le32(trailer + 4, pgz.size); /* modulo 2^32, as gzip wants */
+	write_or_die(1, trailer, sizeof(trailer));
+
+	pthread_mutex_lock(&pgz.mutex);
+	pgz.quit = 1;
+	pthread_cond_broadcast(&pgz.work_cond);
+	pthread_mutex_unlock(&pgz.mutex);
+	for (int i = 0; i < pgz.nr_threads; i++)
+		pthread_join(pgz.threads[i], NULL);
+
+	pthread_mutex_destroy(&pgz.mutex);
+	pthread_cond_destroy(&pgz.work_cond);
+	pthread_cond_destroy(&pgz.done_cond);
+	for (int i = 0; i < pgz.nr_jobs; i++) {
+		free(pgz.jobs[i].data);
+		strbuf_release(&pgz.jobs[i].out);
+	}
+	FREE_AND_NULL(pgz.jobs);
+	FREE_AND_NULL(pgz.threads);
+}
+
+static int tar_filter_threads(const struct archiver *ar)
+{
+	int nr_threads = ar->threads;
+
+	if (nr_threads < 0) {
+		char *var = xstrfmt("tar.%s.threads", ar->name);
+		warning(_("invalid number of threads specified (%d) for %s"),
+			nr_threads, var);
+		free(var);
+		nr_threads = 1;
+	}
+	if (!HAVE_THREADS)
+		nr_threads = 1;
+	else if (!nr_threads)
+		nr_threads = online_cpus();
+	return nr_threads;
+}
+
 static const char internal_gzip_command[] = "git archive gzip";
 
 static int write_tar_filter_archive(const struct archiver *ar,
@@ -474,11 +743,23 @@ static int write_tar_filter_archive(const struct archiver *ar,
 	struct gz_header_s gzhead = { .os = 3 }; /* Unix, for reproducibility */
 	struct strbuf cmd = STRBUF_INIT;
 	struct child_process filter = CHILD_PROCESS_INIT;
+	int nr_threads;
 	int r;
 
 	if (!ar->filter_command)
 		BUG("tar-filter archiver called with no filter defined");
 
+	if (!strcmp(ar->filter_command, internal_gzip_command) &&
+	    (nr_threads = tar_filter_threads(ar)) > 1) {
+		write_block = pgz_write_block;
+		pgz_start(args->compression_level, nr_threads);
+
+		r = write_tar_archive(ar, args);
+
+		pgz_finish();
+		return r;
+	}
+
 	if (!strcmp(ar->filter_command, internal_gzip_command)) {
 		write_block = tgz_write_block;
 		git_deflate_init_gzip(&gzstream, args->compression_level);
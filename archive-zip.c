@@ -14,6 +14,7 @@
 #include "odb.h"
 #include "odb/streaming.h"
 #include "strbuf.h"
+#include "thread-utils.h"
 #include "userdiff.h"
 #include "write-or-die.h"
 #include "xdiff-interface.h"
@@ -291,11 +292,16 @@ static int entry_is_binary(struct index_state *istate, const char *path,
 
 #define STREAM_BUFFER_SIZE (1024 * 16)
 
-static int write_zip_entry(struct archiver_args *args,
-			   const struct object_id *oid,
-			   const char *path, size_t pathlen,
-			   unsigned int mode,
-			   void *buffer, unsigned long size)
+/*
+ * "predeflated" is the raw deflate of "buffer" if the caller already
+ * computed it; ownership passes to us.
+ */
+static int emit_zip_entry(struct archiver_args *args,
+			  const struct object_id *oid,
+			  const char *path, size_t pathlen,
+			  unsigned int mode,
+			  void *buffer, unsigned long size,
+			  void *predeflated, unsigned long predeflated_size)
 {
 	struct zip_local_header header;
 	uintmax_t offset = zip_offset;
@@ -328,6 +334,7 @@ static int write_zip_entry(struct archiver_args *args,
 	}
 
 	if (pathlen > 0xffff) {
+		free(predeflated);
 		return error(_("path too long (%d chars, SHA1: %s): %s"),
 				(int)pathlen, oid_to_hex(oid), path);
 	}
@@ -371,9 +378,14 @@ static int write_zip_entry(struct archiver_args *args,
 		max_creator_version = creator_version;
 
 	if (buffer && method == ZIP_METHOD_DEFLATE) {
-		out = deflated = zlib_deflate_raw(buffer, size,
-						  args->compression_level,
-						  &compressed_size);
+		if (predeflated) {
+			out = deflated = predeflated;
+			compressed_size = predeflated_size;
+		} else {
+			out = deflated = zlib_deflate_raw(buffer, size,
+							  args->compression_level,
+							  &compressed_size);
+		}
 		if (!out || compressed_size >= size) {
 			out = buffer;
 			method = ZIP_METHOD_STORE;
@@ -562,6 +574,145 @@ static int write_zip_entry(struct archiver_args *args,
 	return 0;
 }
 
+/*
+ * With zip.threads, regular files whose contents we already have in
+ * memory are collected into batches and deflated in parallel; every
+ * entry is still compressed on its own, so the archive comes out exactly
+ * the same as when deflating serially.
+ */
+#define ZIP_BATCH_BYTES_PER_THREAD (4 * 1024 * 1024)
+#define ZIP_BATCH_ENTRIES_PER_THREAD 64
+
+struct zip_batch_entry {
+	struct object_id oid;
+	char *path;
+	size_t pathlen;
+	unsigned int mode;
+	void *buffer;
+	unsigned long size;
+	void *deflated;
+	unsigned long compressed_size;
+};
+
+static struct {
+	int nr_threads;
+	int compression_level;
+	struct zip_batch_entry *entries;
+	size_t nr, alloc, next;
+	size_t bytes;
+	pthread_mutex_t mutex;
+} zip_batch;
+
+static void *zip_batch_worker(void *data UNUSED)
+{
+	for (;;) {
+		struct zip_batch_entry *e = NULL;
+
+		pthread_mutex_lock(&zip_batch.mutex);
+		if (zip_batch.next < zip_batch.nr)
+			e = &zip_batch.entries[zip_batch.next++];
+		pthread_mutex_unlock(&zip_batch.mutex);
+		if (!e)
+			break;
+
+		/* on failure emit_zip_entry() tries again and falls back */
+		e->deflated = zlib_deflate_raw(e->buffer, e->size,
+					       zip_batch.compression_level,
+					       &e->compressed_size);
+	}
+	return NULL;
+}
+
+static void clear_zip_batch(void)
+{
+	for (size_t i = 0; i < zip_batch.nr; i++) {
+		free(zip_batch.entries[i].path);
+		free(zip_batch.entries[i].buffer);
+		free(zip_batch.entries[i].deflated);
+	}
+	zip_batch.nr = 0;
+	zip_batch.bytes = 0;
+}
+
+static int flush_zip_batch(struct archiver_args *args)
+{
+	pthread_t *threads;
+	int nr_threads = zip_batch.nr_threads;
+	int err = 0;
+
+	if (!zip_batch.nr)
+		return 0;
+
+	if ((size_t)nr_threads > zip_batch.nr)
+		nr_threads = zip_batch.nr;
+	zip_batch.next = 0;
+	zip_batch.compression_level = args->compression_level;
+	pthread_mutex_init(&zip_batch.mutex, NULL);
+	ALLOC_ARRAY(threads, nr_threads);
+	for (int i = 0; i < nr_threads; i++) {
+		int ret = pthread_create(&threads[i], NULL,
+					 zip_batch_worker, NULL);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+	for (int i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	pthread_mutex_destroy(&zip_batch.mutex);
+
+	for (size_t i = 0; i < zip_batch.nr; i++) {
+		struct zip_batch_entry *e = &zip_batch.entries[i];
+
+		err = emit_zip_entry(args, &e->oid, e->path, e->pathlen,
+				     e->mode, e->buffer, e->size,
+				     e->deflated, e->compressed_size);
+		e->deflated = NULL;
+		if (err)
+			break;
+	}
+	clear_zip_batch();
+	return err;
+}
+
+static int write_zip_entry(struct archiver_args *args,
+			   const struct object_id *oid,
+			   const char *path, size_t pathlen,
+			   unsigned int mode,
+			   void *buffer, unsigned long size)
+{
+	struct zip_batch_entry *e;
+	int err;
+
+	if (zip_batch.nr_threads < 2 || !buffer || !S_ISREG(mode) ||
+	    !args->compression_level || !size) {
+		/* keep the entries in order */
+		err = flush_zip_batch(args);
+		if (err)
+			return err;
+		return emit_zip_entry(args, oid, path, pathlen, mode,
+				      buffer, size, NULL, 0);
+	}
+
+	ALLOC_GROW(zip_batch.entries, zip_batch.nr + 1, zip_batch.alloc);
+	e = &zip_batch.entries[zip_batch.nr++];
+	oidcpy(&e->oid, oid);
+	e->path = xmemdupz(path, pathlen);
+	e->pathlen = pathlen;
+	e->mode = mode;
+	/* our caller frees the buffer as soon as we return */
+	e->buffer = xmemdupz(buffer, size);
+	e->size = size;
+	e->deflated = NULL;
+	zip_batch.bytes += size;
+
+	if (zip_batch.bytes >=
+	    (size_t)zip_batch.nr_threads * ZIP_BATCH_BYTES_PER_THREAD ||
+	    zip_batch.nr >=
+	    (size_t)zip_batch.nr_threads * ZIP_BATCH_ENTRIES_PER_THREAD)
+		return flush_zip_batch(args);
+	return 0;
+}
+
 static void write_zip64_trailer(void)
 {
 	struct zip64_dir_trailer trailer64;
@@ -628,28 +779,55 @@ static void dos_time(timestamp_t *timestamp, int *dos_date, int *dos_time)
 }
 
 static int archive_zip_config(const char *var, const char *value,
-			      const struct config_context *ctx UNUSED,
+			      const struct config_context *ctx,
 			      void *data UNUSED)
 {
+	if (!strcmp(var, "zip.threads")) {
+		zip_batch.nr_threads = git_config_int(var, value, ctx->kvi);
+		return 0;
+	}
 	return userdiff_config(var, value);
 }
 
+static int zip_threads(void)
+{
+	int nr_threads = zip_batch.nr_threads;
+
+	if (nr_threads < 0) {
+		warning(_("invalid number of threads specified (%d) for %s"),
+			nr_threads, "zip.threads");
+		nr_threads = 1;
+	}
+	if (!HAVE_THREADS)
+		nr_threads = 1;
+	else if (!nr_threads)
+		nr_threads = online_cpus();
+	return nr_threads;
+}
+
 static int write_zip_archive(const struct archiver *ar UNUSED,
 			     struct archiver_args *args)
 {
 	int err;
 
+	zip_batch.nr_threads = 1;
 	repo_config(the_repository, archive_zip_config, NULL);
+	zip_batch.nr_threads = zip_threads();
 
 	dos_time(&args->time, &zip_date, &zip_time);
 
 	strbuf_init(&zip_dir, 0);
 
 	err = write_archive_entries(args, write_zip_entry);
+	if (!err)
+		err = flush_zip_batch(args);
 	if (!err)
 		write_zip_trailer(args->commit_oid);
 
 	strbuf_release(&zip_dir);
+	clear_zip_batch();
+	FREE_AND_NULL(zip_batch.entries);
+	zip_batch.alloc = 0;
 
 	return err;
 }
@@ -23,6 +23,7 @@
 #include "parse-options.h"
 #include "unpack-trees.h"
 #include "quote.h"
+#include "thread-utils.h"
 
 static char const * const archive_usage[] = {
 	N_("git archive [<options>] <tree-ish> [<path>...]"),
@@ -82,6 +83,15 @@ static void format_subst(const struct commit *commit,
 	free(to_free);
 }
 
+static void init_archive_checkout_metadata(const struct archiver_args *args,
+					   const struct object_id *oid,
+					   struct checkout_metadata *meta)
+{
+	init_checkout_metadata(meta, args->refname,
+			       args->commit_oid ? args->commit_oid :
+			       (args->tree ? &args->tree->object.oid : NULL), oid);
+}
+
 static void *object_file_to_archive(const struct archiver_args *args,
 				    const char *path,
 				    const struct object_id *oid,
@@ -93,9 +103,7 @@ static void *object_file_to_archive(const struct archiver_args *args,
 	const struct commit *commit = args->convert ? args->commit : NULL;
 	struct checkout_metadata meta;
 
-	init_checkout_metadata(&meta, args->refname,
-			       args->commit_oid ? args->commit_oid :
-			       (args->tree ? &args->tree->object.oid : NULL), oid);
+	init_archive_checkout_metadata(args, oid, &meta);
 
 	path += args->baselen;
 	buffer = odb_read_object(the_repository->objects, oid, type, sizep);
@@ -122,12 +130,307 @@ struct directory {
 	char path[FLEX_ARRAY];
 };
 
+/*
+ * With archive.readThreads, entries are not written as the tree walk
+ * finds them but queued, and worker threads read (and, where that does
+ * not involve an external filter, convert) the blobs of the queued
+ * entries while the main thread writes out earlier ones in order.
+ */
+#define ARCHIVE_PREFETCH_ENTRIES_PER_THREAD 64
+#define ARCHIVE_PREFETCH_BYTES (64 * 1024 * 1024)
+
+enum archive_entry_kind {
+	ARCHIVE_ENTRY_NO_DATA,	/* directories and submodules */
+	ARCHIVE_ENTRY_STREAM,	/* large blobs, streamed by the backend */
+	ARCHIVE_ENTRY_BLOB,
+};
+
+struct archive_prefetch_entry {
+	struct object_id oid;
+	char *path;
+	size_t pathlen;
+	unsigned mode;
+	enum archive_entry_kind kind;
+	int export_subst;
+	int convert_in_worker;
+	struct conv_attrs ca;
+	void *buffer;
+	unsigned long size;
+	int done;
+};
+
+struct archive_prefetch {
+	struct archiver_args *args;
+	struct archive_prefetch_entry *ring;
+	int alloc;
+	int head, nr;		/* queued entries, oldest first */
+	int next_work;		/* next queued entry no worker has claimed */
+	int nr_unclaimed;
+	size_t bytes;		/* read but not yet written out */
+	int quit;
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	pthread_t *threads;
+	int nr_threads;
+};
+
 struct archiver_context {
 	struct archiver_args *args;
 	write_archive_entry_fn_t write_entry;
 	struct directory *bottom;
+	struct archive_prefetch *prefetch;
 };
 
+static void prefetch_blob(struct archiver_args *args,
+			  struct archive_prefetch_entry *e)
+{
+	enum object_type type;
+
+	e->buffer = odb_read_object(args->repo->objects, &e->oid, &type,
+				    &e->size);
+	if (e->buffer && S_ISREG(e->mode) && e->convert_in_worker) {
+		struct strbuf buf = STRBUF_INIT;
+		struct checkout_metadata meta;
+		size_t size = 0;
+
+		init_archive_checkout_metadata(args, &e->oid, &meta);
+		strbuf_attach(&buf, e->buffer, e->size, e->size + 1);
+		convert_to_working_tree_ca(&e->ca, e->path + args->baselen,
+					   buf.buf, buf.len, &buf, &meta);
+		e->buffer = strbuf_detach(&buf, &size);
+		e->size = size;
+	}
+}
+
+static void *archive_prefetch_worker(void *data)
+{
+	struct archive_prefetch *pf = data;
+
+	pthread_mutex_lock(&pf->mutex);
+	for (;;) {
+		struct archive_prefetch_entry *e;
+
+		while (!pf->quit &&
+		       (!pf->nr_unclaimed || pf->bytes >= ARCHIVE_PREFETCH_BYTES))
+			pthread_cond_wait(&pf->work_cond, &pf->mutex);
+		if (pf->quit)
+			break;
+		e = &pf->ring[pf->next_work];
+		pf->next_work = (pf->next_work + 1) % pf->alloc;
+		pf->nr_unclaimed--;
+		if (e->done)
+			continue;
+		pthread_mutex_unlock(&pf->mutex);
+
+		prefetch_blob(pf->args, e);
+
+		pthread_mutex_lock(&pf->mutex);
+		e->done = 1;
+		pf->bytes += e->size;
+		pthread_cond_broadcast(&pf->done_cond);
+	}
+	pthread_mutex_unlock(&pf->mutex);
+	return NULL;
+}
+
+static int archive_read_threads(struct repository *r)
+{
+	int nr_threads = 1;
+
+	repo_config_get_int(r, "archive.readthreads", &nr_threads);
+	if (nr_threads < 0) {
+		warning(_("invalid number of threads specified (%d) for %s"),
+			nr_threads, "archive.readThreads");
+		nr_threads = 1;
+	}
+	if (!HAVE_THREADS)
+		nr_threads = 1;
+	else if (!nr_threads)
+		nr_threads = online_cpus();
+	return nr_threads;
+}
+
+static struct archive_prefetch *start_archive_prefetch(struct archiver_args *args)
+{
+	struct archive_prefetch *pf;
+	int nr_threads = archive_read_threads(args->repo);
+
+	if (nr_threads < 2)
+		return NULL;
+
+	CALLOC_ARRAY(pf, 1);
+	pf->args = args;
+	pf->nr_threads = nr_threads;
+	pf->alloc = nr_threads * ARCHIVE_PREFETCH_ENTRIES_PER_THREAD;
+	CALLOC_ARRAY(pf->ring, pf->alloc);
+	pthread_mutex_init(&pf->mutex, NULL);
+	pthread_cond_init(&pf->work_cond, NULL);
+	pthread_cond_init(&pf->done_cond, NULL);
+
+	enable_obj_read_lock();
+	ALLOC_ARRAY(pf->threads, nr_threads);
+	for (int i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&pf->threads[i], NULL,
+					 archive_prefetch_worker, pf);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	return pf;
+}
+
+/* Wait for the oldest queued entry and write it out. */
+static int write_prefetched_entry(struct archiver_context *c, int discard)
+{
+	struct archive_prefetch *pf = c->prefetch;
+	struct archive_prefetch_entry *e = &pf->ring[pf->head];
+	struct archiver_args *args = c->args;
+	unsigned long prefetched;
+	int err = 0;
+
+	pthread_mutex_lock(&pf->mutex);
+	while (!e->done)
+		pthread_cond_wait(&pf->done_cond, &pf->mutex);
+	/* entries without a blob to read may not have been claimed yet */
+	if (pf->nr_unclaimed == pf->nr) {
+		pf->next_work = (pf->next_work + 1) % pf->alloc;
+		pf->nr_unclaimed--;
+	}
+	pthread_mutex_unlock(&pf->mutex);
+	prefetched = e->kind == ARCHIVE_ENTRY_BLOB ? e->size : 0;
+
+	if (discard) {
+		; /* just release it */
+	} else if (e->kind == ARCHIVE_ENTRY_NO_DATA) {
+		err = c->write_entry(args, &e->oid, e->path, e->pathlen,
+				     e->mode, NULL, 0);
+	} else if (e->kind == ARCHIVE_ENTRY_STREAM) {
+		/* the object streaming code does not take the lock itself */
+		obj_read_lock();
+		err = c->write_entry(args, &e->oid, e->path, e->pathlen,
+				     e->mode, NULL, e->size);
+		obj_read_unlock();
+	} else if (!e->buffer) {
+		err = error(_("cannot read '%s'"), oid_to_hex(&e->oid));
+	} else {
+		if (S_ISREG(e->mode) &&
+		    (!e->convert_in_worker || e->export_subst)) {
+			struct strbuf buf = STRBUF_INIT;
+			size_t size = 0;
+
+			strbuf_attach(&buf, e->buffer, e->size, e->size + 1);
+			if (!e->convert_in_worker) {
+				struct checkout_metadata meta;
+
+				init_archive_checkout_metadata(args, &e->oid, &meta);
+				convert_to_working_tree_ca(&e->ca,
+							   e->path + args->baselen,
+							   buf.buf, buf.len,
+							   &buf, &meta);
+			}
+			if (e->export_subst)
+				format_subst(args->commit, buf.buf, buf.len,
+					     &buf, args->pretty_ctx);
+			e->buffer = strbuf_detach(&buf, &size);
+			e->size = size;
+		}
+		err = c->write_entry(args, &e->oid, e->path, e->pathlen,
+				     e->mode, e->buffer, e->size);
+	}
+
+	free(e->buffer);
+	free(e->path);
+	e->buffer = NULL;
+	e->path = NULL;
+
+	pthread_mutex_lock(&pf->mutex);
+	pf->bytes -= prefetched;
+	pthread_cond_broadcast(&pf->work_cond);
+	pthread_mutex_unlock(&pf->mutex);
+
+	pf->head = (pf->head + 1) % pf->alloc;
+	pf->nr--;
+	return err;
+}
+
+static int queue_archive_entry(struct archiver_context *c,
+			       const struct object_id *oid,
+			       const char *path, size_t pathlen,
+			       unsigned mode, enum archive_entry_kind kind,
+			       unsigned long size)
+{
+	struct archive_prefetch *pf = c->prefetch;
+	struct archive_prefetch_entry *e;
+
+	if (pf->nr == pf->alloc) {
+		int err = write_prefetched_entry(c, 0);
+		if (err)
+			return err;
+	}
+
+	e = &pf->ring[(pf->head + pf->nr) % pf->alloc];
+	oidcpy(&e->oid, oid);
+	e->path = xmemdupz(path, pathlen);
+	e->pathlen = pathlen;
+	e->mode = mode;
+	e->kind = kind;
+	/* there is nothing to substitute when archiving a bare tree */
+	e->export_subst = c->args->convert && c->args->commit;
+	e->buffer = NULL;
+	e->size = size;
+	e->convert_in_worker = 0;
+	if (kind == ARCHIVE_ENTRY_BLOB && S_ISREG(mode)) {
+		enum conv_attrs_classification class;
+
+		/* attributes may only be looked up from this thread */
+		convert_attrs(c->args->repo->index, &e->ca,
+			      path + c->args->baselen);
+		class = classify_conv_attrs(&e->ca);
+		e->convert_in_worker = class != CA_CLASS_INCORE_FILTER &&
+				       class != CA_CLASS_INCORE_PROCESS &&
+				       !e->export_subst;
+	}
+	e->done = kind != ARCHIVE_ENTRY_BLOB;
+
+	pthread_mutex_lock(&pf->mutex);
+	pf->nr++;
+	pf->nr_unclaimed++;
+	pthread_cond_signal(&pf->work_cond);
+	pthread_mutex_unlock(&pf->mutex);
+	return 0;
+}
+
+/*
+ * Write out (or, after an error, throw away) everything still queued and
+ * stop the workers.
+ */
+static int finish_archive_prefetch(struct archiver_context *c, int err)
+{
+	struct archive_prefetch *pf = c->prefetch;
+
+	while (pf->nr) {
+		int ret = write_prefetched_entry(c, !!err);
+		if (!err)
+			err = ret;
+	}
+
+	pthread_mutex_lock(&pf->mutex);
+	pf->quit = 1;
+	pthread_cond_broadcast(&pf->work_cond);
+	pthread_mutex_unlock(&pf->mutex);
+	for (int i = 0; i < pf->nr_threads; i++)
+		pthread_join(pf->threads[i], NULL);
+	disable_obj_read_lock();
+
+	pthread_mutex_destroy(&pf->mutex);
+	pthread_cond_destroy(&pf->work_cond);
+	pthread_cond_destroy(&pf->done_cond);
+	free(pf->threads);
+	free(pf->ring);
+	FREE_AND_NULL(c->prefetch);
+	return err;
+}
+
 static const struct attr_check *get_archive_attrs(struct index_state *istate,
 						  const char *path)
 {
@@ -207,7 +510,12 @@ static int write_archive_entry(const struct object_id *oid, const char *base,
 		fprintf(stderr, "%.*s\n", (int)path.len, path.buf);
 
 	if (S_ISDIR(mode) || S_ISGITLINK(mode)) {
-		err = write_entry(args, oid, path.buf, path.len, mode, NULL, 0);
+		if (c->prefetch)
+			err = queue_archive_entry(c, oid, path.buf, path.len,
+						  mode, ARCHIVE_ENTRY_NO_DATA, 0);
+		else
+			err = write_entry(args, oid, path.buf, path.len, mode,
+					  NULL, 0);
 		if (err)
 			return err;
 		return (S_ISDIR(mode) ? READ_TREE_RECURSIVE : 0);
@@ -216,8 +524,17 @@ static int write_archive_entry(const struct object_id *oid, const char *base,
 	/* Stream it? */
 	if (S_ISREG(mode) && !args->convert &&
 	    odb_read_object_info(args->repo->objects, oid, &size) == OBJ_BLOB &&
-	    size > repo_settings_get_big_file_threshold(the_repository))
+	    size > repo_settings_get_big_file_threshold(the_repository)) {
+		if (c->prefetch)
+			return queue_archive_entry(c, oid, path.buf, path.len,
+						   mode, ARCHIVE_ENTRY_STREAM,
+						   size);
 		return write_entry(args, oid, path.buf, path.len, mode, NULL, size);
+	}
+
+	if (c->prefetch)
+		return queue_archive_entry(c, oid, path.buf, path.len, mode,
+					   ARCHIVE_ENTRY_BLOB, 0);
 
 	buffer = object_file_to_archive(args, path.buf, oid, mode, &type, &size);
 	if (!buffer)
@@ -330,6 +647,7 @@ int write_archive_entries(struct archiver_args *args,
 	memset(&context, 0, sizeof(context));
 	context.args = args;
 	context.write_entry = write_entry;
+	context.prefetch = start_archive_prefetch(args);
 
 	err = read_tree(args->repo, args->tree,
 			&args->pathspec,
@@ -337,6 +655,8 @@ int write_archive_entries(struct archiver_args *args,
 			&context);
 	if (err == READ_TREE_RECURSIVE)
 		err = 0;
+	if (context.prefetch)
+		err = finish_archive_prefetch(&context, err);
 	while (context.bottom) {
 		struct directory *next = context.bottom->up;
 		free(context.bottom);
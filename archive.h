@@ -45,6 +45,7 @@ struct archiver {
 	int (*write_archive)(const struct archiver *, struct archiver_args *);
 	unsigned flags;
 	char *filter_command;
+	int threads;
 };
 void register_archiver(struct archiver *);
 
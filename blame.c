@@ -12,7 +12,10 @@
 #include "diffcore.h"
 #include "gettext.h"
 #include "hex.h"
+#include "lockfile.h"
+#include "mem-pool.h"
 #include "path.h"
+#include "quote.h"
 #include "read-cache.h"
 #include "revision.h"
 #include "setup.h"
@@ -356,8 +359,6 @@ static int find_line_starts(int **line_starts, const char *buf,
 	return num;
 }
 
-struct fingerprint_entry;
-
 /* A fingerprint is intended to loosely represent a string, such that two
  * fingerprints can be quickly compared to give an indication of the similarity
  * of the strings that they represent.
@@ -373,16 +374,17 @@ struct fingerprint_entry;
  * their multisets, including repeated elements. See fingerprint_similarity for
  * examples.
  *
- * For ease of implementation, the fingerprint is implemented as a map
- * of byte pairs to the count of that byte pair in the string, instead of
- * allowing repeated elements in a set.
+ * The multiset is stored as an array of distinct byte pairs sorted by value,
+ * each with the number of times it occurs, so that two fingerprints can be
+ * compared with a single merge pass. In addition, `bits` has one bit set for
+ * each of the (hashed) byte pairs that was ever present; two fingerprints
+ * whose `bits` do not intersect cannot have anything in common, which lets
+ * most comparisons between unrelated lines return without looking at the
+ * entries at all.
  */
 struct fingerprint {
-	struct hashmap map;
-	/* As we know the maximum number of entries in advance, it's
-	 * convenient to store the entries in a single array instead of having
-	 * the hashmap manage the memory.
-	 */
+	uint64_t bits;
+	int nr;
 	struct fingerprint_entry *entries;
 };
 
@@ -390,35 +392,44 @@ struct fingerprint {
  * occurs in the string that the fingerprint represents.
  */
 struct fingerprint_entry {
-	/* The hashmap entry - the hash represents the byte pair in its
-	 * entirety so we don't need to store the byte pair separately.
-	 */
-	struct hashmap_entry entry;
+	/* The first byte in the low 8 bits, the second in the high 8 bits. */
+	uint16_t pair;
 	/* The number of times the byte pair occurs in the string that the
-	 * fingerprint represents.
+	 * fingerprint represents. This can drop to zero when another
+	 * fingerprint is subtracted, see fingerprint_subtract.
 	 */
-	int count;
+	unsigned count;
 };
 
+static inline uint64_t fingerprint_bit(uint16_t pair)
+{
+	return (uint64_t)1 << ((pair * 2654435761u) >> 26);
+}
+
+static int compare_pairs(const void *a_, const void *b_)
+{
+	uint16_t a = *(const uint16_t *)a_, b = *(const uint16_t *)b_;
+	return a < b ? -1 : a > b;
+}
+
 /* See `struct fingerprint` for an explanation of what a fingerprint is.
- * \param result the fingerprint of the string is stored here. This must be
- * 		 freed later using free_fingerprint.
+ * \param result the fingerprint of the string is stored here. Its entries
+ *		 are allocated from `pool`.
  * \param line_begin the start of the string
  * \param line_end the end of the string
+ * \param scratch a buffer with room for 1 + line_end - line_begin pairs
  */
 static void get_fingerprint(struct fingerprint *result,
 			    const char *line_begin,
-			    const char *line_end)
+			    const char *line_end,
+			    struct mem_pool *pool,
+			    uint16_t *scratch)
 {
 	unsigned int hash, c0 = 0, c1;
 	const char *p;
-	int max_map_entry_count = 1 + line_end - line_begin;
-	struct fingerprint_entry *entry = xcalloc(max_map_entry_count,
-		sizeof(struct fingerprint_entry));
-	struct fingerprint_entry *found_entry;
+	int i, nr = 0;
+	struct fingerprint_entry *entry;
 
-	hashmap_init(&result->map, NULL, NULL, max_map_entry_count);
-	result->entries = entry;
 	for (p = line_begin; p <= line_end; ++p, c0 = c1) {
 		/* Always terminate the string with whitespace.
 		 * Normalise whitespace to 0, and normalise letters to
@@ -433,26 +444,26 @@ static void get_fingerprint(struct fingerprint *result,
 		/* Ignore whitespace pairs */
 		if (hash == 0)
 			continue;
-		hashmap_entry_init(&entry->entry, hash);
+		scratch[nr++] = hash;
+	}
+	QSORT(scratch, nr, compare_pairs);
 
-		found_entry = hashmap_get_entry(&result->map, entry,
-						/* member name */ entry, NULL);
-		if (found_entry) {
-			found_entry->count += 1;
-		} else {
-			entry->count = 1;
-			hashmap_add(&result->map, &entry->entry);
-			++entry;
+	result->bits = 0;
+	result->nr = 0;
+	result->entries = entry = mem_pool_alloc(pool, st_mult(nr, sizeof(*entry)));
+	for (i = 0; i < nr; i++) {
+		if (result->nr && entry[-1].pair == scratch[i]) {
+			entry[-1].count++;
+			continue;
 		}
+		entry->pair = scratch[i];
+		entry->count = 1;
+		result->bits |= fingerprint_bit(entry->pair);
+		result->nr++;
+		entry++;
 	}
 }
 
-static void free_fingerprint(struct fingerprint *f)
-{
-	hashmap_clear(&f->map);
-	free(f->entries);
-}
-
 /* Calculates the similarity between two fingerprints as the size of the
  * intersection of their multisets, including repeated elements. See
  * `struct fingerprint` for an explanation of the fingerprint representation.
@@ -463,15 +474,24 @@ static void free_fingerprint(struct fingerprint *f)
 static int fingerprint_similarity(struct fingerprint *a, struct fingerprint *b)
 {
 	int intersection = 0;
-	struct hashmap_iter iter;
-	const struct fingerprint_entry *entry_a, *entry_b;
+	const struct fingerprint_entry *entry_a = a->entries;
+	const struct fingerprint_entry *entry_b = b->entries;
+	const struct fingerprint_entry *end_a = entry_a + a->nr;
+	const struct fingerprint_entry *end_b = entry_b + b->nr;
+
+	if (!(a->bits & b->bits))
+		return 0;
 
-	hashmap_for_each_entry(&b->map, &iter, entry_b,
-				entry /* member name */) {
-		entry_a = hashmap_get_entry(&a->map, entry_b, entry, NULL);
-		if (entry_a) {
+	while (entry_a < end_a && entry_b < end_b) {
+		if (entry_a->pair < entry_b->pair) {
+			entry_a++;
+		} else if (entry_a->pair > entry_b->pair) {
+			entry_b++;
+		} else {
 			intersection += entry_a->count < entry_b->count ?
 					entry_a->count : entry_b->count;
+			entry_a++;
+			entry_b++;
 		}
 	}
 	return intersection;
@@ -481,20 +501,26 @@ static int fingerprint_similarity(struct fingerprint *a, struct fingerprint *b)
  */
 static void fingerprint_subtract(struct fingerprint *a, struct fingerprint *b)
 {
-	struct hashmap_iter iter;
-	struct fingerprint_entry *entry_a;
-	const struct fingerprint_entry *entry_b;
+	struct fingerprint_entry *entry_a = a->entries;
+	const struct fingerprint_entry *entry_b = b->entries;
+	const struct fingerprint_entry *end_a = entry_a + a->nr;
+	const struct fingerprint_entry *end_b = entry_b + b->nr;
 
-	hashmap_iter_init(&b->map, &iter);
+	if (!(a->bits & b->bits))
+		return;
 
-	hashmap_for_each_entry(&b->map, &iter, entry_b,
-				entry /* member name */) {
-		entry_a = hashmap_get_entry(&a->map, entry_b, entry, NULL);
-		if (entry_a) {
+	while (entry_a < end_a && entry_b < end_b) {
+		if (entry_a->pair < entry_b->pair) {
+			entry_a++;
+		} else if (entry_a->pair > entry_b->pair) {
+			entry_b++;
+		} else {
 			if (entry_a->count <= entry_b->count)
-				hashmap_remove(&a->map, &entry_b->entry, NULL);
+				entry_a->count = 0;
 			else
 				entry_a->count -= entry_b->count;
+			entry_a++;
+			entry_b++;
 		}
 	}
 }
@@ -504,27 +530,24 @@ static void fingerprint_subtract(struct fingerprint *a, struct fingerprint *b)
  * preallocated to allow storing line_count elements.
  */
 static void get_line_fingerprints(struct fingerprint *fingerprints,
+				  struct mem_pool *pool,
 				  const char *content, const int *line_starts,
 				  long first_line, long line_count)
 {
 	int i;
 	const char *linestart, *lineend;
+	uint16_t *scratch = NULL;
+	size_t scratch_alloc = 0;
 
 	line_starts += first_line;
 	for (i = 0; i < line_count; ++i) {
 		linestart = content + line_starts[i];
 		lineend = content + line_starts[i + 1];
-		get_fingerprint(fingerprints + i, linestart, lineend);
+		ALLOC_GROW(scratch, 1 + lineend - linestart, scratch_alloc);
+		get_fingerprint(fingerprints + i, linestart, lineend,
+				pool, scratch);
 	}
-}
-
-static void free_line_fingerprints(struct fingerprint *fingerprints,
-				   int nr_fingerprints)
-{
-	int i;
-
-	for (i = 0; i < nr_fingerprints; i++)
-		free_fingerprint(&fingerprints[i]);
+	free(scratch);
 }
 
 /* This contains the data necessary to linearly map a line number in one half
@@ -1010,15 +1033,18 @@ static void fill_origin_fingerprints(struct blame_origin *o)
 	o->num_lines = find_line_starts(&line_starts, o->file.ptr,
 					o->file.size);
 	CALLOC_ARRAY(o->fingerprints, o->num_lines);
-	get_line_fingerprints(o->fingerprints, o->file.ptr, line_starts,
-			      0, o->num_lines);
+	CALLOC_ARRAY(o->fingerprint_pool, 1);
+	mem_pool_init(o->fingerprint_pool, 0);
+	get_line_fingerprints(o->fingerprints, o->fingerprint_pool,
+			      o->file.ptr, line_starts, 0, o->num_lines);
 	free(line_starts);
 }
 
 static void drop_origin_fingerprints(struct blame_origin *o)
 {
 	if (o->fingerprints) {
-		free_line_fingerprints(o->fingerprints, o->num_lines);
+		mem_pool_discard(o->fingerprint_pool, 0);
+		FREE_AND_NULL(o->fingerprint_pool);
 		o->num_lines = 0;
 		FREE_AND_NULL(o->fingerprints);
 	}
@@ -2578,6 +2604,432 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 		free(sg_origin);
 }
 
+/*
+ * On-disk blame cache.
+ *
+ * With "blame.cache" enabled, the final blame of a whole file at a
+ * commit is stored under "$GIT_OBJECT_DIRECTORY/info/blame-cache/",
+ * keyed by the commit, the path and the options that can change the
+ * result.  When a later walk reaches a (commit, path) that has such a
+ * record, the stored ranges are taken over instead of digging into
+ * the history behind it.
+ *
+ * The file format is line oriented:
+ *
+ *   blame-cache 1 <blob> <number of lines>
+ *   origin <commit> <blob> <mode> <previous origin or -1> <path>
+ *   entry <lno> <num_lines> <origin> <s_lno>
+ *
+ * Origins are numbered from 0 in the order they appear, and entries
+ * are sorted by line number and cover the whole blob.
+ */
+
+static int blame_cache_hits;
+static int blame_cache_writes;
+
+struct blame_cache_origin {
+	struct object_id commit;
+	struct object_id blob;
+	unsigned mode;
+	int previous;
+	char *path;
+};
+
+struct blame_cache_entry {
+	int lno;
+	int num_lines;
+	int origin;
+	int s_lno;
+};
+
+struct blame_cache_record {
+	struct object_id blob;
+	int num_lines;
+	struct blame_cache_origin *origins;
+	size_t origins_nr, origins_alloc;
+	struct blame_cache_entry *entries;
+	size_t entries_nr, entries_alloc;
+};
+
+static void blame_cache_record_release(struct blame_cache_record *rec)
+{
+	for (size_t i = 0; i < rec->origins_nr; i++)
+		free(rec->origins[i].path);
+	free(rec->origins);
+	free(rec->entries);
+}
+
+/*
+ * The stored result is only what a plain walk would have produced;
+ * options that stop the walk early, skip commits or move blame
+ * across lines and files turn the cache off.
+ */
+static int blame_cache_applicable(struct blame_scoreboard *sb, int opt)
+{
+	struct rev_info *revs = sb->revs;
+
+	if (!sb->use_cache || sb->reverse || opt ||
+	    oidset_size(&sb->ignore_list) ||
+	    revs->first_parent_only || revs->max_age != -1)
+		return 0;
+	for (size_t i = 0; i < revs->cmdline.nr; i++)
+		if (revs->cmdline.rev[i].flags & UNINTERESTING)
+			return 0;
+	return 1;
+}
+
+static char *blame_cache_path(struct blame_scoreboard *sb,
+			      const struct object_id *commit_oid,
+			      const char *path)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct git_hash_ctx ctx;
+	struct object_id key;
+	const char *hex;
+
+	strbuf_addf(&buf, "%s%c%s%c%d %d %d", oid_to_hex(commit_oid), 0,
+		    path, 0, sb->xdl_opts, sb->no_whole_file_rename,
+		    sb->revs->diffopt.flags.allow_textconv);
+	sb->repo->hash_algo->init_fn(&ctx);
+	git_hash_update(&ctx, buf.buf, buf.len);
+	git_hash_final_oid(&key, &ctx);
+
+	hex = oid_to_hex(&key);
+	strbuf_reset(&buf);
+	strbuf_addf(&buf, "%s/info/blame-cache/%.2s/%s",
+		    repo_get_object_directory(sb->repo), hex, hex + 2);
+	return strbuf_detach(&buf, NULL);
+}
+
+static int parse_cache_int(const char **p, char term, int *out)
+{
+	char *end;
+	long v;
+
+	errno = 0;
+	v = strtol(*p, &end, 10);
+	if (errno || end == *p || *end != term || v < INT_MIN || v > INT_MAX)
+		return -1;
+	*out = v;
+	*p = end + 1;
+	return 0;
+}
+
+static int parse_blame_cache(struct blame_scoreboard *sb, const char *line,
+			     struct blame_cache_record *rec)
+{
+	const struct git_hash_algo *algo = sb->repo->hash_algo;
+	struct strbuf path = STRBUF_INIT;
+	const char *p;
+	int next_lno = 0;
+	int ret = -1;
+
+	if (!skip_prefix(line, "blame-cache 1 ", &p) ||
+	    parse_oid_hex_algop(p, &rec->blob, &p, algo) || *p++ != ' ' ||
+	    parse_cache_int(&p, '\n', &rec->num_lines))
+		return -1;
+
+	for (line = p; *line; line = p) {
+		const char *eol = strchrnul(line, '\n');
+
+		if (!*eol)
+			goto out;
+		if (skip_prefix(line, "origin ", &p)) {
+			struct blame_cache_origin *o;
+			int mode;
+
+			ALLOC_GROW(rec->origins, rec->origins_nr + 1,
+				   rec->origins_alloc);
+			o = &rec->origins[rec->origins_nr];
+			o->path = NULL;
+			if (parse_oid_hex_algop(p, &o->commit, &p, algo) ||
+			    *p++ != ' ' ||
+			    parse_oid_hex_algop(p, &o->blob, &p, algo) ||
+			    *p++ != ' ' ||
+			    parse_cache_int(&p, ' ', &mode) ||
+			    parse_cache_int(&p, ' ', &o->previous))
+				goto out;
+			o->mode = mode;
+			strbuf_reset(&path);
+			if (*p == '"') {
+				if (unquote_c_style(&path, p, &p) || p != eol)
+					goto out;
+			} else {
+				strbuf_add(&path, p, eol - p);
+			}
+			o->path = strbuf_detach(&path, NULL);
+			rec->origins_nr++;
+		} else if (skip_prefix(line, "entry ", &p)) {
+			struct blame_cache_entry *e;
+
+			ALLOC_GROW(rec->entries, rec->entries_nr + 1,
+				   rec->entries_alloc);
+			e = &rec->entries[rec->entries_nr];
+			if (parse_cache_int(&p, ' ', &e->lno) ||
+			    parse_cache_int(&p, ' ', &e->num_lines) ||
+			    parse_cache_int(&p, ' ', &e->origin) ||
+			    parse_cache_int(&p, '\n', &e->s_lno) ||
+			    e->lno != next_lno || e->num_lines <= 0 ||
+			    e->s_lno < 0)
+				goto out;
+			next_lno += e->num_lines;
+			rec->entries_nr++;
+		} else {
+			goto out;
+		}
+		p = eol + 1;
+	}
+
+	if (next_lno != rec->num_lines)
+		goto out;
+	for (size_t i = 0; i < rec->origins_nr; i++)
+		if (rec->origins[i].previous < -1 ||
+		    rec->origins[i].previous >= (int)rec->origins_nr)
+			goto out;
+	for (size_t i = 0; i < rec->entries_nr; i++)
+		if (rec->entries[i].origin < 0 ||
+		    rec->entries[i].origin >= (int)rec->origins_nr)
+			goto out;
+	ret = 0;
+out:
+	strbuf_release(&path);
+	return ret;
+}
+
+static size_t find_cache_entry(struct blame_cache_record *rec, int lno)
+{
+	size_t lo = 0, hi = rec->entries_nr;
+
+	while (hi - lo > 1) {
+		size_t mi = lo + (hi - lo) / 2;
+		if (rec->entries[mi].lno <= lno)
+			lo = mi;
+		else
+			hi = mi;
+	}
+	return lo;
+}
+
+/*
+ * If the blame of "suspect" as a whole is in the cache, hand all of
+ * its suspects to the origins recorded there and return 1.  Return 0
+ * and leave the suspects alone otherwise.
+ */
+static int splice_cached_blame(struct blame_scoreboard *sb,
+			       struct blame_origin *suspect)
+{
+	struct blame_cache_record rec = { 0 };
+	struct strbuf buf = STRBUF_INIT;
+	struct blame_origin **origins = NULL;
+	struct blame_entry *e, *next;
+	char *path = NULL;
+	size_t i;
+	int ret = 0;
+
+	if (is_null_oid(&suspect->commit->object.oid) ||
+	    is_null_oid(&suspect->blob_oid))
+		return 0;
+
+	path = blame_cache_path(sb, &suspect->commit->object.oid,
+				suspect->path);
+	if (strbuf_read_file(&buf, path, 0) < 0 ||
+	    parse_blame_cache(sb, buf.buf, &rec) < 0 ||
+	    !oideq(&rec.blob, &suspect->blob_oid))
+		goto out;
+
+	for (e = suspect->suspects; e; e = e->next)
+		if (e->s_lno < 0 || e->s_lno + e->num_lines > rec.num_lines)
+			goto out;
+	for (i = 0; i < rec.origins_nr; i++) {
+		struct commit *c = lookup_commit(sb->repo,
+						 &rec.origins[i].commit);
+		if (!c || repo_parse_commit(sb->repo, c))
+			goto out;
+	}
+
+	CALLOC_ARRAY(origins, rec.origins_nr);
+	for (i = 0; i < rec.origins_nr; i++) {
+		struct blame_cache_origin *co = &rec.origins[i];
+		struct blame_origin *o;
+
+		o = get_origin(lookup_commit(sb->repo, &co->commit), co->path);
+		if (is_null_oid(&o->blob_oid)) {
+			oidcpy(&o->blob_oid, &co->blob);
+			o->mode = co->mode;
+		}
+		origins[i] = o;
+	}
+	for (i = 0; i < rec.origins_nr; i++) {
+		int prev = rec.origins[i].previous;
+		if (prev >= 0 && !origins[i]->previous)
+			origins[i]->previous = blame_origin_incref(origins[prev]);
+	}
+
+	for (e = suspect->suspects; e; e = next) {
+		int lno = e->s_lno, end = e->s_lno + e->num_lines;
+		size_t j = find_cache_entry(&rec, lno);
+
+		next = e->next;
+		while (lno < end) {
+			struct blame_cache_entry *ce = &rec.entries[j++];
+			struct blame_entry *ne = xcalloc(1, sizeof(*ne));
+			struct commit *c;
+
+			ne->lno = e->lno + (lno - e->s_lno);
+			ne->num_lines = (ce->lno + ce->num_lines < end ?
+					 ce->lno + ce->num_lines : end) - lno;
+			ne->suspect = blame_origin_incref(origins[ce->origin]);
+			ne->s_lno = ce->s_lno + (lno - ce->lno);
+			ne->suspect->guilty = 1;
+
+			/* treat root commit as boundary */
+			c = ne->suspect->commit;
+			if (!c->parents && !sb->show_root)
+				c->object.flags |= UNINTERESTING;
+
+			if (sb->found_guilty_entry)
+				sb->found_guilty_entry(ne, sb->found_guilty_entry_data);
+			ne->next = sb->ent;
+			sb->ent = ne;
+			lno += ne->num_lines;
+		}
+		blame_origin_decref(e->suspect);
+		free(e);
+	}
+	suspect->suspects = NULL;
+	blame_cache_hits++;
+	ret = 1;
+
+out:
+	if (origins) {
+		for (i = 0; i < rec.origins_nr; i++)
+			blame_origin_decref(origins[i]);
+		free(origins);
+	}
+	blame_cache_record_release(&rec);
+	strbuf_release(&buf);
+	free(path);
+	return ret;
+}
+
+static int compare_entries_by_lno(const void *a_, const void *b_)
+{
+	const struct blame_entry *a = *(const struct blame_entry **)a_;
+	const struct blame_entry *b = *(const struct blame_entry **)b_;
+	return a->lno < b->lno ? -1 : a->lno > b->lno;
+}
+
+static int compare_origin_ptrs(const void *a_, const void *b_)
+{
+	uintptr_t a = (uintptr_t)*(struct blame_origin * const *)a_;
+	uintptr_t b = (uintptr_t)*(struct blame_origin * const *)b_;
+	return a < b ? -1 : a > b;
+}
+
+static int origin_index(struct blame_origin **origins, size_t nr,
+			struct blame_origin *o)
+{
+	struct blame_origin **found;
+
+	if (!o)
+		return -1;
+	found = bsearch(&o, origins, nr, sizeof(*origins),
+			compare_origin_ptrs);
+	return found ? found - origins : -1;
+}
+
+/*
+ * Store the result of a walk that covered every line of the final
+ * commit's blob.  Failing to write is not an error; the cache is
+ * only an optimization.
+ */
+static void write_blame_cache(struct blame_scoreboard *sb)
+{
+	struct blame_entry **ents = NULL, *e;
+	struct blame_origin **origins = NULL;
+	size_t ents_nr = 0, ents_alloc = 0, origins_nr = 0, i, j;
+	struct strbuf buf = STRBUF_INIT;
+	struct lock_file lk = LOCK_INIT;
+	struct object_id blob_oid;
+	unsigned short mode;
+	char *path = NULL;
+	int lines = 0;
+
+	if (is_null_oid(&sb->final->object.oid) || !sb->num_lines)
+		return;
+	for (e = sb->ent; e; e = e->next) {
+		ALLOC_GROW(ents, ents_nr + 1, ents_alloc);
+		ents[ents_nr++] = e;
+		lines += e->num_lines;
+	}
+	if (lines != sb->num_lines)
+		goto out;
+
+	path = blame_cache_path(sb, &sb->final->object.oid, sb->path);
+	if (!access(path, F_OK) ||
+	    get_tree_entry(sb->repo, &sb->final->object.oid, sb->path,
+			   &blob_oid, &mode))
+		goto out;
+
+	QSORT(ents, ents_nr, compare_entries_by_lno);
+	ALLOC_ARRAY(origins, 2 * ents_nr);
+	for (i = 0; i < ents_nr; i++) {
+		origins[origins_nr++] = ents[i]->suspect;
+		if (ents[i]->suspect->previous)
+			origins[origins_nr++] = ents[i]->suspect->previous;
+	}
+	QSORT(origins, origins_nr, compare_origin_ptrs);
+	for (i = j = 0; i < origins_nr; i++)
+		if (!j || origins[j - 1] != origins[i])
+			origins[j++] = origins[i];
+	origins_nr = j;
+
+	strbuf_addf(&buf, "blame-cache 1 %s %d\n",
+		    oid_to_hex(&blob_oid), sb->num_lines);
+	for (i = 0; i < origins_nr; i++) {
+		struct blame_origin *o = origins[i];
+
+		strbuf_addf(&buf, "origin %s",
+			    oid_to_hex(&o->commit->object.oid));
+		strbuf_addf(&buf, " %s %06o %d ", oid_to_hex(&o->blob_oid),
+			    o->mode,
+			    origin_index(origins, origins_nr, o->previous));
+		quote_c_style(o->path, &buf, NULL, 0);
+		strbuf_addch(&buf, '\n');
+	}
+	for (i = 0; i < ents_nr; i++) {
+		struct blame_entry *ent = ents[i];
+		int num_lines = ent->num_lines;
+
+		/* merge ranges that coalescing would merge anyway */
+		while (i + 1 < ents_nr &&
+		       ents[i + 1]->suspect == ent->suspect &&
+		       ents[i + 1]->s_lno == ent->s_lno + num_lines) {
+			num_lines += ents[i + 1]->num_lines;
+			i++;
+		}
+		strbuf_addf(&buf, "entry %d %d %d %d\n", ent->lno, num_lines,
+			    origin_index(origins, origins_nr, ent->suspect),
+			    ent->s_lno);
+	}
+
+	if (safe_create_leading_directories(sb->repo, path) ||
+	    hold_lock_file_for_update(&lk, path, 0) < 0)
+		goto out;
+	if (write_in_full(get_lock_file_fd(&lk), buf.buf, buf.len) < 0 ||
+	    commit_lock_file(&lk) < 0) {
+		rollback_lock_file(&lk);
+		goto out;
+	}
+	blame_cache_writes++;
+
+out:
+	strbuf_release(&buf);
+	free(origins);
+	free(ents);
+	free(path);
+}
+
 /*
  * The main loop -- while we have blobs with lines whose true origin
  * is still unknown, pick one blob, and allow its lines to pass blames
@@ -2586,6 +3038,7 @@ void assign_blame(struct blame_scoreboard *sb, int opt)
 {
 	struct rev_info *revs = sb->revs;
 	struct commit *commit = prio_queue_get(&sb->commits);
+	int use_cache = blame_cache_applicable(sb, opt);
 
 	while (commit) {
 		struct blame_entry *ent;
@@ -2608,7 +3061,9 @@ void assign_blame(struct blame_scoreboard *sb, int opt)
 		 */
 		blame_origin_incref(suspect);
 		repo_parse_commit(the_repository, commit);
-		if (sb->reverse ||
+		if (use_cache && splice_cached_blame(sb, suspect))
+			; /* all suspects were taken from the cache */
+		else if (sb->reverse ||
 		    (!(commit->object.flags & UNINTERESTING) &&
 		     !(revs->max_age != -1 && commit->date < revs->max_age)))
 			pass_blame(sb, suspect, opt);
@@ -2644,6 +3099,9 @@ void assign_blame(struct blame_scoreboard *sb, int opt)
 		if (sb->debug) /* sanity */
 			sanity_check_refcnt(sb);
 	}
+
+	if (use_cache)
+		write_blame_cache(sb);
 }
 
 /*
@@ -2947,4 +3405,11 @@ void cleanup_scoreboard(struct blame_scoreboard *sb)
 		trace2_data_intmax("blame", sb->repo,
 				   "bloom/response-no", bloom_count_no);
 	}
+
+	if (sb->use_cache) {
+		trace2_data_intmax("blame", sb->repo,
+				   "cache/hits", blame_cache_hits);
+		trace2_data_intmax("blame", sb->repo,
+				   "cache/writes", blame_cache_writes);
+	}
 }
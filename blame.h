@@ -14,6 +14,7 @@
 #define BLAME_DEFAULT_COPY_SCORE	40
 
 struct fingerprint;
+struct mem_pool;
 
 /*
  * One blob in a commit that is being suspected
@@ -52,6 +53,8 @@ struct blame_origin {
 	mmfile_t file;
 	int num_lines;
 	struct fingerprint *fingerprints;
+	/* backing store for the entries of `fingerprints` */
+	struct mem_pool *fingerprint_pool;
 	struct object_id blob_oid;
 	unsigned short mode;
 	/* guilty gets set when shipping any suspects to the final
@@ -150,6 +153,9 @@ struct blame_scoreboard {
 	int no_whole_file_rename;
 	int debug;
 
+	/* read and write the on-disk blame cache ("blame.cache") */
+	int use_cache;
+
 	/* callbacks */
 	void(*on_sanity_fail)(struct blame_scoreboard *, int);
 	void(*found_guilty_entry)(struct blame_entry *, void *);
@@ -12,6 +12,7 @@
 #include "tree-walk.h"
 #include "config.h"
 #include "repository.h"
+#include "odb.h"
 
 define_commit_slab(bloom_filter_slab, struct bloom_filter);
 
@@ -433,57 +434,80 @@ struct bloom_filter *get_bloom_filter(struct repository *r, struct commit *c)
 	return filter;
 }
 
-struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
-						 struct commit *c,
-						 int compute_if_not_present,
-						 const struct bloom_filter_settings *settings,
-						 enum bloom_filter_computed *computed)
-{
-	struct bloom_filter *filter;
-	int i;
-	struct diff_options diffopt;
-
-	if (computed)
-		*computed = BLOOM_NOT_COMPUTED;
-
-	if (!bloom_filters.slab_size)
-		return NULL;
-
-	filter = bloom_filter_slab_at(&bloom_filters, c);
-
-	if (!filter->data) {
-		struct commit_graph *g;
-		uint32_t graph_pos;
+struct bloom_diff_queue {
+	struct diff_queue_struct queue;
+	int max_changed_paths;
+};
 
-		g = repo_find_commit_pos_in_graph(r, c, &graph_pos);
-		if (g)
-			load_bloom_filter_from_graph(g, filter, graph_pos);
-	}
+/*
+ * diff_addremove() and diff_change() feed the global diff queue; these
+ * collect the changed paths of one commit in a queue of our own, so
+ * that several threads can compute filters at once.
+ */
+static void bloom_queue_addremove(struct diff_options *options,
+				  int addremove, unsigned mode,
+				  const struct object_id *oid,
+				  int oid_valid,
+				  const char *fullpath, unsigned dirty_submodule)
+{
+	struct bloom_diff_queue *q = options->change_fn_data;
+
+	/* submodule settings are loaded lazily */
+	if (S_ISGITLINK(mode))
+		obj_read_lock();
+	diff_queue_addremove(&q->queue, options, addremove, mode, oid,
+			     oid_valid, fullpath, dirty_submodule);
+	if (S_ISGITLINK(mode))
+		obj_read_unlock();
+
+	/* we only need to know that there are too many */
+	if (q->queue.nr > q->max_changed_paths)
+		options->flags.quick = 1;
+}
 
-	if (filter->data && filter->len) {
-		struct bloom_filter *upgrade;
-		if (!settings || settings->hash_version == filter->version)
-			return filter;
+static void bloom_queue_change(struct diff_options *options,
+			       unsigned old_mode, unsigned new_mode,
+			       const struct object_id *old_oid,
+			       const struct object_id *new_oid,
+			       int old_oid_valid, int new_oid_valid,
+			       const char *fullpath,
+			       unsigned old_dirty_submodule,
+			       unsigned new_dirty_submodule)
+{
+	struct bloom_diff_queue *q = options->change_fn_data;
+	int gitlink = S_ISGITLINK(old_mode) && S_ISGITLINK(new_mode);
+
+	if (gitlink)
+		obj_read_lock();
+	diff_queue_change(&q->queue, options, old_mode, new_mode,
+			  old_oid, new_oid, old_oid_valid, new_oid_valid,
+			  fullpath, old_dirty_submodule, new_dirty_submodule);
+	if (gitlink)
+		obj_read_unlock();
+
+	if (q->queue.nr > q->max_changed_paths)
+		options->flags.quick = 1;
+}
 
-		/* version mismatch, see if we can upgrade */
-		if (compute_if_not_present &&
-		    git_env_bool("GIT_TEST_UPGRADE_BLOOM_FILTERS", 1)) {
-			upgrade = upgrade_filter(r, c, filter,
-						 settings->hash_version);
-			if (upgrade) {
-				if (computed)
-					*computed |= BLOOM_UPGRADED;
-				return upgrade;
-			}
-		}
-	}
-	if (!compute_if_not_present)
-		return NULL;
+enum bloom_filter_computed compute_bloom_filter(struct repository *r,
+						struct commit *c,
+						const struct bloom_filter_settings *settings,
+						struct bloom_filter *filter)
+{
+	struct bloom_diff_queue q = {
+		.queue = DIFF_QUEUE_INIT,
+		.max_changed_paths = settings->max_changed_paths,
+	};
+	enum bloom_filter_computed computed = BLOOM_COMPUTED;
+	struct diff_options diffopt;
+	int i;
 
 	repo_diff_setup(r, &diffopt);
 	diffopt.flags.recursive = 1;
 	diffopt.detect_rename = 0;
-	diffopt.max_changes = settings->max_changed_paths;
+	diffopt.add_remove = bloom_queue_addremove;
+	diffopt.change = bloom_queue_change;
+	diffopt.change_fn_data = &q;
 	diff_setup_done(&diffopt);
 
 	/* ensure commit is parsed so we have parent information */
@@ -493,15 +517,14 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 		diff_tree_oid(&c->parents->item->object.oid, &c->object.oid, "", &diffopt);
 	else
 		diff_tree_oid(NULL, &c->object.oid, "", &diffopt);
-	diffcore_std(&diffopt);
 
-	if (diff_queued_diff.nr <= settings->max_changed_paths) {
+	if (q.queue.nr <= settings->max_changed_paths) {
 		struct hashmap pathmap = HASHMAP_INIT(pathmap_cmp, NULL);
 		struct pathmap_hash_entry *e;
 		struct hashmap_iter iter;
 
-		for (i = 0; i < diff_queued_diff.nr; i++) {
-			const char *path = diff_queued_diff.queue[i]->two->path;
+		for (i = 0; i < q.queue.nr; i++) {
+			const char *path = q.queue.queue[i]->two->path;
 
 			/*
 			 * Add each leading directory of the changed file, i.e. for
@@ -532,16 +555,14 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 		if (hashmap_get_size(&pathmap) > settings->max_changed_paths) {
 			init_truncated_large_filter(filter,
 						    settings->hash_version);
-			if (computed)
-				*computed |= BLOOM_TRUNC_LARGE;
+			computed |= BLOOM_TRUNC_LARGE;
 			goto cleanup;
 		}
 
 		filter->len = (hashmap_get_size(&pathmap) * settings->bits_per_entry + BITS_PER_WORD - 1) / BITS_PER_WORD;
 		filter->version = settings->hash_version;
 		if (!filter->len) {
-			if (computed)
-				*computed |= BLOOM_TRUNC_EMPTY;
+			computed |= BLOOM_TRUNC_EMPTY;
 			filter->len = 1;
 		}
 		CALLOC_ARRAY(filter->data, filter->len);
@@ -558,15 +579,98 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 		hashmap_clear_and_free(&pathmap, struct pathmap_hash_entry, entry);
 	} else {
 		init_truncated_large_filter(filter, settings->hash_version);
+		computed |= BLOOM_TRUNC_LARGE;
+	}
 
-		if (computed)
-			*computed |= BLOOM_TRUNC_LARGE;
+	diff_queue_clear(&q.queue);
+	return computed;
+}
+
+static struct bloom_filter *get_or_compute_bloom_filter_1(struct repository *r,
+							  struct commit *c,
+							  int compute_if_not_present,
+							  const struct bloom_filter_settings *settings,
+							  enum bloom_filter_computed *computed,
+							  struct bloom_filter *precomputed,
+							  enum bloom_filter_computed precomputed_flags)
+{
+	struct bloom_filter *filter;
+	enum bloom_filter_computed flags;
+
+	if (computed)
+		*computed = BLOOM_NOT_COMPUTED;
+
+	if (!bloom_filters.slab_size)
+		return NULL;
+
+	filter = bloom_filter_slab_at(&bloom_filters, c);
+
+	if (!filter->data) {
+		struct commit_graph *g;
+		uint32_t graph_pos;
+
+		g = repo_find_commit_pos_in_graph(r, c, &graph_pos);
+		if (g)
+			load_bloom_filter_from_graph(g, filter, graph_pos);
+	}
+
+	if (filter->data && filter->len) {
+		struct bloom_filter *upgrade;
+		if (!settings || settings->hash_version == filter->version)
+			return filter;
+
+		/* version mismatch, see if we can upgrade */
+		if (compute_if_not_present &&
+		    git_env_bool("GIT_TEST_UPGRADE_BLOOM_FILTERS", 1)) {
+			upgrade = upgrade_filter(r, c, filter,
+						 settings->hash_version);
+			if (upgrade) {
+				if (computed)
+					*computed |= BLOOM_UPGRADED;
+				return upgrade;
+			}
+		}
 	}
+	if (!compute_if_not_present)
+		return NULL;
 
+	if (precomputed) {
+		*filter = *precomputed;
+		memset(precomputed, 0, sizeof(*precomputed));
+		flags = precomputed_flags;
+	} else {
+		flags = compute_bloom_filter(r, c, settings, filter);
+	}
 	if (computed)
-		*computed |= BLOOM_COMPUTED;
+		*computed |= flags;
+	return filter;
+}
+
+struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
+						 struct commit *c,
+						 int compute_if_not_present,
+						 const struct bloom_filter_settings *settings,
+						 enum bloom_filter_computed *computed)
+{
+	return get_or_compute_bloom_filter_1(r, c, compute_if_not_present,
+					     settings, computed, NULL, 0);
+}
+
+struct bloom_filter *get_or_use_bloom_filter(struct repository *r,
+					     struct commit *c,
+					     int compute_if_not_present,
+					     const struct bloom_filter_settings *settings,
+					     enum bloom_filter_computed *computed,
+					     struct bloom_filter *precomputed,
+					     enum bloom_filter_computed precomputed_flags)
+{
+	struct bloom_filter *filter;
 
-	diff_queue_clear(&diff_queued_diff);
+	filter = get_or_compute_bloom_filter_1(r, c, compute_if_not_present,
+					       settings, computed, precomputed,
+					       precomputed_flags);
+	/* not needed after all */
+	FREE_AND_NULL(precomputed->to_free);
 	return filter;
 }
 
@@ -130,6 +130,34 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 						 const struct bloom_filter_settings *settings,
 						 enum bloom_filter_computed *computed);
 
+/*
+ * Compute the changed-path Bloom filter of "c" from scratch into "filter",
+ * the way get_or_compute_bloom_filter() does when it has to, and return
+ * the BLOOM_* flags describing the result.
+ *
+ * This neither looks at nor stores the filters kept for each commit, nor
+ * does it use the global diff queue, so several threads may call it at
+ * once while the object read lock is enabled. "c" must already be parsed.
+ */
+enum bloom_filter_computed compute_bloom_filter(struct repository *r,
+						struct commit *c,
+						const struct bloom_filter_settings *settings,
+						struct bloom_filter *filter);
+
+/*
+ * Like get_or_compute_bloom_filter(), but if the filter of "c" has to be
+ * computed, use "precomputed" and "precomputed_flags", as returned by
+ * compute_bloom_filter() with the same settings, instead. Takes ownership
+ * of the data in "precomputed" whether it is used or not.
+ */
+struct bloom_filter *get_or_use_bloom_filter(struct repository *r,
+					     struct commit *c,
+					     int compute_if_not_present,
+					     const struct bloom_filter_settings *settings,
+					     enum bloom_filter_computed *computed,
+					     struct bloom_filter *precomputed,
+					     enum bloom_filter_computed precomputed_flags);
+
 /*
  * Find the Bloom filter associated with the given commit "c".
  *
@@ -71,6 +71,7 @@ static int coloring_mode;
 static struct string_list ignore_revs_file_list = STRING_LIST_INIT_DUP;
 static int mark_unblamable_lines;
 static int mark_ignored_lines;
+static int blame_cache;
 
 static struct date_mode blame_date_mode = { DATE_ISO8601 };
 static size_t blame_date_width;
@@ -744,6 +745,10 @@ static int git_blame_config(const char *var, const char *value,
 		free(str);
 		return 0;
 	}
+	if (!strcmp(var, "blame.cache")) {
+		blame_cache = git_config_bool(var, value);
+		return 0;
+	}
 	if (!strcmp(var, "blame.markunblamablelines")) {
 		mark_unblamable_lines = git_config_bool(var, value);
 		return 0;
@@ -1247,6 +1252,7 @@ int cmd_blame(int argc,
 	sb.show_root = show_root;
 	sb.xdl_opts = xdl_opts;
 	sb.no_whole_file_rename = no_whole_file_rename;
+	sb.use_cache = blame_cache;
 
 	read_mailmap(&mailmap);
 
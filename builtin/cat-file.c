@@ -29,6 +29,7 @@
 #include "promisor-remote.h"
 #include "mailmap.h"
 #include "write-or-die.h"
+#include "thread-utils.h"
 
 enum batch_mode {
 	BATCH_MODE_CONTENTS,
@@ -48,6 +49,7 @@ struct batch_options {
 	char input_delim;
 	char output_delim;
 	const char *format;
+	int nr_threads;
 };
 
 static const char *force_path;
@@ -306,6 +308,17 @@ struct expand_data {
 	 * optimized out.
 	 */
 	unsigned skip_object_info : 1;
+
+	/*
+	 * Set by a --batch-threads worker that already looked up the
+	 * object info, in which case "prefetch_ret" holds the result of
+	 * that lookup. If the worker also read the object, "contents" is
+	 * non-NULL and is consumed by print_object_or_die().
+	 */
+	unsigned prefetched : 1;
+	int prefetch_ret;
+	void *contents;
+	unsigned long contents_size;
 };
 #define EXPAND_DATA_INIT  { .mode = S_IFINVALID }
 
@@ -415,6 +428,9 @@ static void print_object_or_die(struct batch_options *opt, struct expand_data *d
 				BUG("invalid transform_mode: %c", opt->transform_mode);
 			batch_write(opt, contents, size);
 			free(contents);
+		} else if (data->contents) {
+			batch_write(opt, data->contents, data->contents_size);
+			FREE_AND_NULL(data->contents);
 		} else {
 			stream_blob(oid);
 		}
@@ -424,8 +440,14 @@ static void print_object_or_die(struct batch_options *opt, struct expand_data *d
 		unsigned long size;
 		void *contents;
 
-		contents = odb_read_object(the_repository->objects, oid,
-					   &type, &size);
+		if (data->contents) {
+			contents = data->contents;
+			type = data->type;
+			size = data->contents_size;
+			data->contents = NULL;
+		} else
+			contents = odb_read_object(the_repository->objects, oid,
+						   &type, &size);
 		if (!contents)
 			die("object %s disappeared", oid_to_hex(oid));
 
@@ -463,6 +485,18 @@ static void report_object_status(struct batch_options *opt,
 	fflush(stdout);
 }
 
+static void prepare_object_info(struct batch_options *opt,
+				struct expand_data *data)
+{
+	if (use_mailmap ||
+	    opt->objects_filter.choice == LOFC_BLOB_NONE ||
+	    opt->objects_filter.choice == LOFC_BLOB_LIMIT ||
+	    opt->objects_filter.choice == LOFC_OBJECT_TYPE)
+		data->info.typep = &data->type;
+	if (opt->objects_filter.choice == LOFC_BLOB_LIMIT)
+		data->info.sizep = &data->size;
+}
+
 /*
  * If "pack" is non-NULL, then "offset" is the byte offset within the pack from
  * which the object may be accessed (though note that we may also rely on
@@ -478,15 +512,11 @@ static void batch_object_write(const char *obj_name,
 	if (!data->skip_object_info) {
 		int ret;
 
-		if (use_mailmap ||
-		    opt->objects_filter.choice == LOFC_BLOB_NONE ||
-		    opt->objects_filter.choice == LOFC_BLOB_LIMIT ||
-		    opt->objects_filter.choice == LOFC_OBJECT_TYPE)
-			data->info.typep = &data->type;
-		if (opt->objects_filter.choice == LOFC_BLOB_LIMIT)
-			data->info.sizep = &data->size;
+		prepare_object_info(opt, data);
 
-		if (pack)
+		if (data->prefetched)
+			ret = data->prefetch_ret;
+		else if (pack)
 			ret = packed_object_info(pack, offset, &data->info);
 		else
 			ret = odb_read_object_info_extended(the_repository->objects,
@@ -625,6 +655,262 @@ static void batch_one_object(const char *obj_name,
 	object_context_release(&ctx);
 }
 
+/*
+ * With --batch-threads, the names read from stdin are still resolved
+ * one by one on the main thread, but looking up the object info and
+ * reading the object contents is handed to a pool of workers. The
+ * output is then written in request order as soon as the oldest
+ * pending object is ready.
+ *
+ * At most BATCH_WINDOW_PER_THREAD objects per thread are in flight,
+ * and the contents of all objects read ahead of the output may not
+ * exceed BATCH_PREFETCH_MEMORY bytes; objects that would go over that
+ * budget are read (or streamed) by the main thread when their output
+ * is written, as without --batch-threads.
+ */
+#define BATCH_WINDOW_PER_THREAD 32
+#define BATCH_PREFETCH_MEMORY (64 * 1024 * 1024)
+
+struct batch_job {
+	struct expand_data data;
+	char *name;
+	char *rest;
+	unsigned long reserved;
+	unsigned resolved : 1;
+	unsigned done : 1;
+};
+
+struct batch_pool {
+	struct batch_options *opt;
+	struct batch_job *jobs;
+	size_t window;
+
+	/*
+	 * Jobs are numbered in request order and live in slot
+	 * "nr % window"; "head" is the next one to be written out,
+	 * "next" the next one to be picked up by a worker and "tail"
+	 * the next one to be queued.
+	 */
+	size_t head, next, tail;
+	size_t prefetched_bytes;
+	int finished;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	pthread_t *threads;
+	int nr_threads;
+};
+
+static int batch_pool_reserve(struct batch_pool *pool, unsigned long size)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&pool->mutex);
+	if (size <= BATCH_PREFETCH_MEMORY - pool->prefetched_bytes) {
+		pool->prefetched_bytes += size;
+		ret = 1;
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return ret;
+}
+
+static void batch_prefetch_object(struct batch_pool *pool,
+				  struct batch_job *job)
+{
+	struct expand_data *data = &job->data;
+	enum object_type type;
+	unsigned long size;
+
+	data->prefetch_ret = odb_read_object_info_extended(the_repository->objects,
+							   &data->oid, &data->info,
+							   OBJECT_INFO_LOOKUP_REPLACE);
+	data->prefetched = 1;
+
+	if (data->prefetch_ret < 0 ||
+	    pool->opt->batch_mode != BATCH_MODE_CONTENTS ||
+	    (data->type == OBJ_BLOB && pool->opt->transform_mode) ||
+	    !batch_pool_reserve(pool, data->size))
+		return;
+	job->reserved = data->size;
+
+	data->contents = odb_read_object(the_repository->objects, &data->oid,
+					 &type, &size);
+	/*
+	 * Let the main thread read the object again and complain if it
+	 * is not what we just looked up.
+	 */
+	if (data->contents && (type != data->type || size != data->size))
+		FREE_AND_NULL(data->contents);
+	data->contents_size = size;
+}
+
+static void *batch_worker(void *arg)
+{
+	struct batch_pool *pool = arg;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		struct batch_job *job;
+
+		while (pool->next == pool->tail && !pool->finished)
+			pthread_cond_wait(&pool->work_cond, &pool->mutex);
+		if (pool->next == pool->tail)
+			break;
+
+		job = &pool->jobs[pool->next++ % pool->window];
+		pthread_mutex_unlock(&pool->mutex);
+
+		if (job->resolved)
+			batch_prefetch_object(pool, job);
+
+		pthread_mutex_lock(&pool->mutex);
+		job->done = 1;
+		pthread_cond_signal(&pool->done_cond);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+static void batch_pool_start(struct batch_pool *pool,
+			     struct batch_options *opt,
+			     struct expand_data *data)
+{
+	memset(pool, 0, sizeof(*pool));
+	pool->opt = opt;
+	pool->nr_threads = opt->nr_threads;
+	pool->window = st_mult(BATCH_WINDOW_PER_THREAD, pool->nr_threads);
+	CALLOC_ARRAY(pool->jobs, pool->window);
+	CALLOC_ARRAY(pool->threads, pool->nr_threads);
+
+	/*
+	 * The workers need to know the size of the objects they read
+	 * ahead to account for it.
+	 */
+	prepare_object_info(opt, data);
+	if (opt->batch_mode == BATCH_MODE_CONTENTS)
+		data->info.sizep = &data->size;
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	enable_obj_read_lock();
+	for (int i = 0; i < pool->nr_threads; i++) {
+		int err = pthread_create(&pool->threads[i], NULL,
+					 batch_worker, pool);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+}
+
+static void batch_pool_write_head(struct batch_pool *pool,
+				  struct strbuf *scratch)
+{
+	struct batch_job *job = &pool->jobs[pool->head % pool->window];
+
+	pthread_mutex_lock(&pool->mutex);
+	while (!job->done)
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+
+	/*
+	 * Writing out the object may still need to access the object
+	 * database, e.g. to stream a large blob, which is not safe to do
+	 * while the workers are running without holding the lock.
+	 */
+	obj_read_lock();
+	if (job->resolved)
+		batch_object_write(job->name, scratch, pool->opt,
+				   &job->data, NULL, 0);
+	else
+		batch_one_object(job->name, scratch, pool->opt, &job->data);
+	obj_read_unlock();
+
+	free(job->data.contents);
+	FREE_AND_NULL(job->name);
+	FREE_AND_NULL(job->rest);
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->prefetched_bytes -= job->reserved;
+	pool->head++;
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+static void batch_pool_add(struct batch_pool *pool,
+			   const char *obj_name,
+			   struct strbuf *scratch,
+			   const struct expand_data *tmpl)
+{
+	struct batch_job *job;
+	struct expand_data *data;
+	struct object_context ctx = {0};
+	int flags =
+		GET_OID_HASH_ANY |
+		(pool->opt->follow_symlinks ? GET_OID_FOLLOW_SYMLINKS : 0);
+
+	if (pool->tail - pool->head == pool->window)
+		batch_pool_write_head(pool, scratch);
+
+	job = &pool->jobs[pool->tail % pool->window];
+	data = &job->data;
+	*data = *tmpl;
+	if (tmpl->info.typep)
+		data->info.typep = &data->type;
+	if (tmpl->info.sizep)
+		data->info.sizep = &data->size;
+	if (tmpl->info.disk_sizep)
+		data->info.disk_sizep = &data->disk_size;
+	if (tmpl->info.delta_base_oid)
+		data->info.delta_base_oid = &data->delta_base_oid;
+	job->name = xstrdup(obj_name);
+	job->rest = xstrdup_or_null(tmpl->rest);
+	data->rest = job->rest;
+	job->reserved = 0;
+	job->done = 0;
+
+	/*
+	 * Names that do not resolve to an object are resolved again by
+	 * batch_one_object() when it is their turn, so that the error
+	 * is reported in order.
+	 */
+	obj_read_lock();
+	job->resolved = get_oid_with_context(the_repository, obj_name, flags,
+					     &data->oid, &ctx) == FOUND &&
+			ctx.mode;
+	obj_read_unlock();
+	data->mode = ctx.mode;
+	object_context_release(&ctx);
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->tail++;
+	pthread_cond_signal(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+static void batch_pool_finish(struct batch_pool *pool,
+			      struct strbuf *scratch)
+{
+	pthread_mutex_lock(&pool->mutex);
+	pool->finished = 1;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	while (pool->head != pool->tail)
+		batch_pool_write_head(pool, scratch);
+
+	for (int i = 0; i < pool->nr_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+	disable_obj_read_lock();
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->threads);
+	free(pool->jobs);
+}
+
 struct object_cb_data {
 	struct batch_options *opt;
 	struct expand_data *expand;
@@ -875,6 +1161,7 @@ static int batch_objects(struct batch_options *opt)
 	struct strbuf input = STRBUF_INIT;
 	struct strbuf output = STRBUF_INIT;
 	struct expand_data data = EXPAND_DATA_INIT;
+	struct batch_pool pool;
 	int save_warning;
 	int retval = 0;
 
@@ -955,6 +1242,9 @@ static int batch_objects(struct batch_options *opt)
 		goto cleanup;
 	}
 
+	if (opt->nr_threads > 1)
+		batch_pool_start(&pool, opt, &data);
+
 	while (strbuf_getdelim_strip_crlf(&input, stdin, opt->input_delim) != EOF) {
 		if (data.split_on_whitespace) {
 			/*
@@ -970,9 +1260,15 @@ static int batch_objects(struct batch_options *opt)
 			data.rest = p;
 		}
 
-		batch_one_object(input.buf, &output, opt, &data);
+		if (opt->nr_threads > 1)
+			batch_pool_add(&pool, input.buf, &output, &data);
+		else
+			batch_one_object(input.buf, &output, opt, &data);
 	}
 
+	if (opt->nr_threads > 1)
+		batch_pool_finish(&pool, &output);
+
  cleanup:
 	strbuf_release(&input);
 	strbuf_release(&output);
@@ -1028,6 +1324,7 @@ int cmd_cat_file(int argc,
 	const char *exp_type = NULL, *obj_name = NULL;
 	struct batch_options batch = {
 		.objects_filter = LIST_OBJECTS_FILTER_INIT,
+		.nr_threads = 1,
 	};
 	int unknown_type = 0;
 	int input_nul_terminated = 0;
@@ -1041,7 +1338,7 @@ int cmd_cat_file(int argc,
 		   "             [<rev>:<path|tree-ish> | --path=<path|tree-ish> <rev>]"),
 		N_("git cat-file (--batch | --batch-check | --batch-command) [--batch-all-objects]\n"
 		   "             [--buffer] [--follow-symlinks] [--unordered]\n"
-		   "             [--textconv | --filters] [-Z]"),
+		   "             [--batch-threads=<n>] [--textconv | --filters] [-Z]"),
 		NULL
 	};
 	const struct option options[] = {
@@ -1084,6 +1381,8 @@ int cmd_cat_file(int argc,
 			 N_("follow in-tree symlinks")),
 		OPT_BOOL(0, "unordered", &batch.unordered,
 			 N_("do not order objects before emitting them")),
+		OPT_INTEGER(0, "batch-threads", &batch.nr_threads,
+			    N_("look up and read objects using <n> threads")),
 		/* Textconv options, stand-ole*/
 		OPT_GROUP(N_("Emit object (blob or tree) with conversion or filter (stand-alone, or with batch)")),
 		OPT_CMDMODE(0, "textconv", &opt,
@@ -1150,6 +1449,25 @@ int cmd_cat_file(int argc,
 	else if (nul_terminated)
 		usage_msg_optf(_("'%s' requires a batch mode"), builtin_catfile_usage,
 			       options, "-Z");
+	else if (batch.nr_threads != 1)
+		usage_msg_optf(_("'%s' requires a batch mode"), builtin_catfile_usage,
+			       options, "--batch-threads");
+
+	if (batch.nr_threads != 1) {
+		if (batch.all_objects)
+			die(_("options '%s' and '%s' cannot be used together"),
+			    "--batch-threads", "--batch-all-objects");
+		if (batch.batch_mode == BATCH_MODE_QUEUE_AND_DISPATCH)
+			die(_("options '%s' and '%s' cannot be used together"),
+			    "--batch-threads", "--batch-command");
+	}
+	if (!HAVE_THREADS && batch.nr_threads > 1) {
+		warning(_("no threads support, ignoring --batch-threads"));
+		batch.nr_threads = 1;
+	} else if (batch.nr_threads < 0)
+		die(_("invalid number of threads specified (%d)"), batch.nr_threads);
+	else if (batch.nr_threads == 0)
+		batch.nr_threads = HAVE_THREADS ? online_cpus() : 1;
 
 	batch.input_delim = batch.output_delim = '\n';
 	if (input_nul_terminated)
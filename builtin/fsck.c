@@ -27,6 +27,7 @@
 #include "worktree.h"
 #include "pack-revindex.h"
 #include "pack-bitmap.h"
+#include "thread-utils.h"
 
 #define REACHABLE 0x0001
 #define SEEN      0x0002
@@ -50,6 +51,7 @@ static int verbose;
 static int show_progress = -1;
 static int show_dangling = 1;
 static int name_objects;
+static int nr_threads = 1;
 static int check_references = 1;
 static timestamp_t now;
 #define ERROR_OBJECT 01
@@ -987,7 +989,8 @@ static char const * const fsck_usage[] = {
 	N_("git fsck [--tags] [--root] [--unreachable] [--cache] [--no-reflogs]\n"
 	   "         [--[no-]full] [--strict] [--verbose] [--lost-found]\n"
 	   "         [--[no-]dangling] [--[no-]progress] [--connectivity-only]\n"
-	   "         [--[no-]name-objects] [--[no-]references] [<object>...]"),
+	   "         [--[no-]name-objects] [--[no-]references] [--threads=<n>]\n"
+	   "         [<object>...]"),
 	NULL
 };
 
@@ -1007,6 +1010,7 @@ static struct option fsck_opts[] = {
 	OPT_BOOL(0, "progress", &show_progress, N_("show progress")),
 	OPT_BOOL(0, "name-objects", &name_objects, N_("show verbose names for reachable objects")),
 	OPT_BOOL(0, "references", &check_references, N_("check reference database consistency")),
+	OPT_INTEGER(0, "threads", &nr_threads, N_("use <n> threads to check packed objects")),
 	OPT_END(),
 };
 
@@ -1050,6 +1054,15 @@ int cmd_fsck(int argc,
 	if (name_objects)
 		fsck_enable_object_names(&fsck_walk_options);
 
+	if (!HAVE_THREADS && nr_threads != 1) {
+		warning(_("no threads support, ignoring --threads"));
+		nr_threads = 1;
+	} else if (nr_threads < 0) {
+		die(_("invalid number of threads specified (%d)"), nr_threads);
+	} else if (!nr_threads) {
+		nr_threads = online_cpus();
+	}
+
 	repo_config(the_repository, git_fsck_config, &fsck_obj_options);
 	prepare_repo_settings(the_repository);
 
@@ -1097,7 +1110,7 @@ int cmd_fsck(int argc,
 				/* verify gives error messages itself */
 				if (verify_pack(the_repository,
 						p, fsck_obj_buffer,
-						progress, count))
+						progress, count, nr_threads))
 					errors_found |= ERROR_PACK;
 				count += p->num_objects;
 			}
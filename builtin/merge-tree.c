@@ -16,6 +16,7 @@
 #include "blob.h"
 #include "merge-blobs.h"
 #include "quote.h"
+#include "trace2.h"
 #include "tree.h"
 #include "config.h"
 #include "strvec.h"
@@ -417,6 +418,12 @@ struct merge_tree_options {
 	int name_only;
 	int use_stdin;
 	struct merge_options merge_options;
+	/*
+	 * With --stdin, the result of the previous merge, so merge-ort can
+	 * reuse what it learned about renames when the next merge shares
+	 * a merge base and one side with it.
+	 */
+	struct merge_result batch_result;
 };
 
 static int real_merge(struct merge_tree_options *o,
@@ -426,7 +433,8 @@ static int real_merge(struct merge_tree_options *o,
 {
 	struct commit *parent1, *parent2;
 	struct commit_list *merge_bases = NULL;
-	struct merge_result result = { 0 };
+	struct merge_result one_shot = { 0 };
+	struct merge_result *result = o->use_stdin ? &o->batch_result : &one_shot;
 	int show_messages = o->show_messages;
 	struct merge_options opt;
 
@@ -465,7 +473,7 @@ static int real_merge(struct merge_tree_options *o,
 			die(_("unable to read tree (%s)"), oid_to_hex(&merge_oid));
 
 		opt.ancestor = merge_base;
-		merge_incore_nonrecursive(&opt, base_tree, parent1_tree, parent2_tree, &result);
+		merge_incore_nonrecursive(&opt, base_tree, parent1_tree, parent2_tree, result);
 	} else {
 		parent1 = get_merge_parent(branch1);
 		if (!parent1)
@@ -487,27 +495,27 @@ static int real_merge(struct merge_tree_options *o,
 		if (!merge_bases && !o->allow_unrelated_histories)
 			die(_("refusing to merge unrelated histories"));
 		merge_bases = reverse_commit_list(merge_bases);
-		merge_incore_recursive(&opt, merge_bases, parent1, parent2, &result);
+		merge_incore_recursive(&opt, merge_bases, parent1, parent2, result);
 		free_commit_list(merge_bases);
 	}
 
-	if (result.clean < 0)
+	if (result->clean < 0)
 		die(_("failure to merge"));
 
 	if (o->merge_options.mergeability_only)
 		goto cleanup;
 
 	if (show_messages == -1)
-		show_messages = !result.clean;
+		show_messages = !result->clean;
 
 	if (o->use_stdin)
-		printf("%d%c", result.clean, line_termination);
-	printf("%s%c", oid_to_hex(&result.tree->object.oid), line_termination);
-	if (!result.clean) {
+		printf("%d%c", result->clean, line_termination);
+	printf("%s%c", oid_to_hex(&result->tree->object.oid), line_termination);
+	if (!result->clean) {
 		struct string_list conflicted_files = STRING_LIST_INIT_NODUP;
 		const char *last = NULL;
 
-		merge_get_conflicted_files(&result, &conflicted_files);
+		merge_get_conflicted_files(result, &conflicted_files);
 		for (size_t i = 0; i < conflicted_files.nr; i++) {
 			const char *name = conflicted_files.items[i].string;
 			struct stage_info *c = conflicted_files.items[i].util;
@@ -525,15 +533,16 @@ static int real_merge(struct merge_tree_options *o,
 	if (show_messages) {
 		putchar(line_termination);
 		merge_display_update_messages(&opt, line_termination == '\0',
-					      &result);
+					      result);
 	}
 	if (o->use_stdin)
 		putchar(line_termination);
 
 cleanup:
-	merge_finalize(&opt, &result);
+	if (!o->use_stdin)
+		merge_finalize(&opt, result);
 	clear_merge_options(&opt);
-	return !result.clean; /* result.clean < 0 handled above */
+	return !result->clean; /* result->clean < 0 handled above */
 }
 
 int cmd_merge_tree(int argc,
@@ -614,6 +623,7 @@ int cmd_merge_tree(int argc,
 	/* Handle --stdin */
 	if (o.use_stdin) {
 		struct strbuf buf = STRBUF_INIT;
+		int nr = 0;
 
 		if (o.mode == MODE_TRIVIAL)
 			die(_("--trivial-merge is incompatible with all other options"));
@@ -625,6 +635,9 @@ int cmd_merge_tree(int argc,
 			struct string_list split = STRING_LIST_INIT_NODUP;
 			const char *input_merge_base = NULL;
 
+			trace2_region_enter_printf("merge-tree", "batch merge",
+						   the_repository, "%d", ++nr);
+
 			string_list_split_in_place_f(&split, buf.buf, " ", -1,
 						     STRING_LIST_SPLIT_TRIM);
 
@@ -648,10 +661,15 @@ int cmd_merge_tree(int argc,
 				die(_("malformed input line: '%s'."), buf.buf);
 			}
 			maybe_flush_or_die(stdout, "stdout");
+			trace2_region_leave_printf("merge-tree", "batch merge",
+						   the_repository, "%d", nr);
 
 			string_list_clear(&split, 0);
 		}
 		strbuf_release(&buf);
+		merge_finalize(&o.merge_options, &o.batch_result);
+		trace2_data_intmax("merge-tree", the_repository,
+				   "batch/merges", nr);
 
 		ret = 0;
 		goto out;
@@ -257,6 +257,7 @@ static int exclude_promisor_objects;
 static int exclude_promisor_objects_best_effort;
 
 static int use_delta_islands;
+static int prefetch_window;
 
 static unsigned long delta_cache_size = 0;
 static unsigned long max_delta_cache_size = DEFAULT_DELTA_CACHE_SIZE;
@@ -1312,6 +1313,25 @@ static const char no_split_warning[] = N_(
 "disabling bitmap writing, packs are split due to pack.packSizeLimit"
 );
 
+/*
+ * Hint to the OS that we will soon read the packed representation of
+ * "e", so that the disk read can overlap with writing out the objects
+ * that come before it.
+ */
+static void prefetch_object(struct object_entry *e)
+{
+	struct packed_git *p = IN_PACK(e);
+	uint32_t pos;
+	off_t end;
+
+	if (!p)
+		return;
+	if (offset_to_pack_pos(p, e->in_pack_offset, &pos) < 0)
+		return;
+	end = pack_pos_to_offset(p, pos + 1);
+	packfile_prefetch(p, e->in_pack_offset, end - e->in_pack_offset);
+}
+
 static void write_pack_file(void)
 {
 	uint32_t i = 0, j;
@@ -1320,6 +1340,7 @@ static void write_pack_file(void)
 	uint32_t nr_remaining = nr_result;
 	time_t last_mtime = 0;
 	struct object_entry **write_order;
+	uint32_t prefetched = 0;
 
 	if (progress > pack_to_stdout)
 		progress_state = start_progress(the_repository,
@@ -1353,6 +1374,15 @@ static void write_pack_file(void)
 		nr_written = 0;
 		for (; i < to_pack.nr_objects; i++) {
 			struct object_entry *e = write_order[i];
+			if (prefetch_window) {
+				uint32_t ahead = i + prefetch_window;
+
+				if (prefetched < i)
+					prefetched = i;
+				for (; prefetched <= ahead &&
+				       prefetched < to_pack.nr_objects; prefetched++)
+					prefetch_object(write_order[prefetched]);
+			}
 			if (write_one(f, e, &offset) == WRITE_ONE_BREAK)
 				break;
 			display_progress(progress_state, written);
@@ -3685,6 +3715,13 @@ static int git_pack_config(const char *k, const char *v,
 		}
 		return 0;
 	}
+	if (!strcmp(k, "pack.prefetchwindow")) {
+		prefetch_window = git_config_int(k, v, ctx->kvi);
+		if (prefetch_window < 0)
+			die(_("invalid pack.prefetchWindow value: %d"),
+			    prefetch_window);
+		return 0;
+	}
 	if (!strcmp(k, "pack.indexversion")) {
 		pack_idx_opts.version = git_config_int(k, v, ctx->kvi);
 		if (pack_idx_opts.version > 2)
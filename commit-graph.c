@@ -27,6 +27,7 @@
 #include "trace2.h"
 #include "tree.h"
 #include "chunk-format.h"
+#include "thread-utils.h"
 
 void git_test_write_commit_graph_or_die(struct odb_source *source)
 {
@@ -1167,6 +1168,8 @@ struct write_commit_graph_context {
 	int count_bloom_filter_trunc_empty;
 	int count_bloom_filter_trunc_large;
 	int count_bloom_filter_upgraded;
+
+	int nr_threads;
 };
 
 static int write_graph_chunk_fanout(struct hashfile *f,
@@ -1516,12 +1519,227 @@ static void add_missing_parents(struct write_commit_graph_context *ctx, struct c
 	}
 }
 
+/*
+ * Number of commits each thread may read ahead of the main thread while
+ * expanding the reachable closure.
+ */
+#define COMMIT_PREFETCH_PER_THREAD 512
+
+enum commit_prefetch_state {
+	COMMIT_PREFETCH_QUEUED,
+	COMMIT_PREFETCH_READING,
+	COMMIT_PREFETCH_DONE,
+};
+
+struct commit_prefetch_entry {
+	struct commit *commit;
+	size_t pos; /* in ctx->oids */
+	enum commit_prefetch_state state;
+	void *buffer;
+	unsigned long size;
+	enum object_type type;
+};
+
+/*
+ * Worker threads read commits that the main thread will parse soon. The
+ * main thread queues the commits in the order in which it will get to
+ * them, in a ring of fixed size, and takes them out in the same order.
+ * An entry belongs to the worker that marked it COMMIT_PREFETCH_READING
+ * until it is COMMIT_PREFETCH_DONE.
+ */
+struct commit_prefetch {
+	struct repository *r;
+	struct commit_prefetch_entry *ring;
+	size_t alloc;
+	size_t head, nr;
+	size_t taken; /* entries from "head" on that a worker has taken */
+	size_t scan; /* next position in ctx->oids to consider */
+	int quit;
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	pthread_t *threads;
+	int nr_threads;
+};
+
+static void *commit_prefetch_thread(void *data)
+{
+	struct commit_prefetch *pf = data;
+	unsigned flags = OBJECT_INFO_LOOKUP_REPLACE | OBJECT_INFO_SKIP_FETCH_OBJECT;
+
+	pthread_mutex_lock(&pf->mutex);
+	for (;;) {
+		struct commit_prefetch_entry *e;
+		struct object_info oi = OBJECT_INFO_INIT;
+
+		while (!pf->quit && pf->taken == pf->nr)
+			pthread_cond_wait(&pf->work_cond, &pf->mutex);
+		if (pf->quit)
+			break;
+
+		e = &pf->ring[(pf->head + pf->taken++) % pf->alloc];
+		e->state = COMMIT_PREFETCH_READING;
+		pthread_mutex_unlock(&pf->mutex);
+
+		oi.typep = &e->type;
+		oi.sizep = &e->size;
+		oi.contentp = &e->buffer;
+		/*
+		 * Errors are not reported here; the main thread falls back
+		 * to parsing the commit itself, which reports them.
+		 */
+		if (odb_read_object_info_extended(pf->r->objects,
+						  &e->commit->object.oid,
+						  &oi, flags) < 0)
+			e->buffer = NULL;
+
+		pthread_mutex_lock(&pf->mutex);
+		e->state = COMMIT_PREFETCH_DONE;
+		pthread_cond_broadcast(&pf->done_cond);
+	}
+	pthread_mutex_unlock(&pf->mutex);
+
+	return NULL;
+}
+
+static void start_commit_prefetch(struct write_commit_graph_context *ctx,
+				  struct commit_prefetch *pf)
+{
+	pf->r = ctx->r;
+	pf->alloc = st_mult(ctx->nr_threads, COMMIT_PREFETCH_PER_THREAD);
+	CALLOC_ARRAY(pf->ring, pf->alloc);
+	pthread_mutex_init(&pf->mutex, NULL);
+	pthread_cond_init(&pf->work_cond, NULL);
+	pthread_cond_init(&pf->done_cond, NULL);
+
+	enable_obj_read_lock();
+	pf->nr_threads = ctx->nr_threads;
+	ALLOC_ARRAY(pf->threads, pf->nr_threads);
+	for (int i = 0; i < pf->nr_threads; i++) {
+		int err = pthread_create(&pf->threads[i], NULL,
+					 commit_prefetch_thread, pf);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+}
+
+static void stop_commit_prefetch(struct commit_prefetch *pf)
+{
+	pthread_mutex_lock(&pf->mutex);
+	pf->quit = 1;
+	pthread_cond_broadcast(&pf->work_cond);
+	pthread_mutex_unlock(&pf->mutex);
+	for (int i = 0; i < pf->nr_threads; i++)
+		if (pthread_join(pf->threads[i], NULL))
+			die(_("unable to join thread"));
+	disable_obj_read_lock();
+
+	for (size_t i = 0; i < pf->nr; i++)
+		free(pf->ring[(pf->head + i) % pf->alloc].buffer);
+	free(pf->ring);
+	free(pf->threads);
+	pthread_cond_destroy(&pf->done_cond);
+	pthread_cond_destroy(&pf->work_cond);
+	pthread_mutex_destroy(&pf->mutex);
+}
+
+/*
+ * Queue the commits after ctx->oids[pos] that still need to be parsed
+ * for the workers, as far as the ring has room. Commits which are
+ * already parsed, or which we will load from an existing commit-graph,
+ * are skipped.
+ *
+ * When fewer commits than threads are known (e.g. while walking linear
+ * history, where each commit only adds its parent), handing them out
+ * costs more than it saves, and the main thread parses them itself.
+ */
+static void queue_commit_prefetch(struct write_commit_graph_context *ctx,
+				  struct commit_prefetch *pf, size_t pos)
+{
+	int queued = 0;
+
+	if (pf->scan <= pos)
+		pf->scan = pos + 1;
+	if (ctx->oids.nr - pf->scan < pf->nr_threads)
+		return;
+
+	pthread_mutex_lock(&pf->mutex);
+	while (pf->scan < ctx->oids.nr && pf->nr < pf->alloc) {
+		const struct object_id *oid = &ctx->oids.oid[pf->scan++];
+		struct commit *commit = lookup_commit(ctx->r, oid);
+		struct commit_prefetch_entry *e;
+		uint32_t graph_pos;
+
+		if (!commit || commit->object.parsed)
+			continue;
+		if (ctx->split &&
+		    repo_find_commit_pos_in_graph(ctx->r, commit, &graph_pos))
+			continue;
+
+		e = &pf->ring[(pf->head + pf->nr++) % pf->alloc];
+		memset(e, 0, sizeof(*e));
+		e->commit = commit;
+		e->pos = pf->scan - 1;
+		e->state = COMMIT_PREFETCH_QUEUED;
+		queued = 1;
+	}
+	if (queued)
+		pthread_cond_broadcast(&pf->work_cond);
+	pthread_mutex_unlock(&pf->mutex);
+}
+
+/*
+ * Parse "commit", which is ctx->oids[pos], from the prefetched buffer if
+ * we have one for it. If no worker has started reading it yet, leave it
+ * to the caller.
+ */
+static void parse_prefetched_commit(struct write_commit_graph_context *ctx,
+				    struct commit_prefetch *pf,
+				    struct commit *commit, size_t pos)
+{
+	struct commit_prefetch_entry e;
+
+	pthread_mutex_lock(&pf->mutex);
+	if (!pf->nr || pf->ring[pf->head].pos != pos) {
+		pthread_mutex_unlock(&pf->mutex);
+		return;
+	}
+	if (!pf->taken) {
+		/* drop it; reading it here is as fast as waiting for it */
+		pf->head = (pf->head + 1) % pf->alloc;
+		pf->nr--;
+		pthread_mutex_unlock(&pf->mutex);
+		return;
+	}
+	while (pf->ring[pf->head].state != COMMIT_PREFETCH_DONE)
+		pthread_cond_wait(&pf->done_cond, &pf->mutex);
+	e = pf->ring[pf->head];
+	pf->head = (pf->head + 1) % pf->alloc;
+	pf->nr--;
+	pf->taken--;
+	pthread_mutex_unlock(&pf->mutex);
+
+	if (!e.buffer)
+		return;
+
+	if (e.type == OBJ_COMMIT && !commit->object.parsed &&
+	    !parse_commit_buffer(ctx->r, commit, e.buffer, e.size, 0) &&
+	    save_commit_buffer &&
+	    !get_cached_commit_buffer(ctx->r, commit, NULL)) {
+		set_commit_buffer(ctx->r, commit, e.buffer, e.size);
+		return;
+	}
+	free(e.buffer);
+}
+
 static void close_reachable(struct write_commit_graph_context *ctx)
 {
 	int i;
 	struct commit *commit;
 	enum commit_graph_split_flags flags = ctx->opts ?
 		ctx->opts->split_flags : COMMIT_GRAPH_SPLIT_UNSPECIFIED;
+	struct commit_prefetch prefetch = { 0 };
+	int use_prefetch = ctx->nr_threads > 1;
 
 	if (ctx->report_progress)
 		ctx->progress = start_delayed_progress(
@@ -1546,10 +1764,19 @@ static void close_reachable(struct write_commit_graph_context *ctx)
 					ctx->r,
 					_("Expanding reachable commits in commit graph"),
 					0);
+	if (use_prefetch)
+		start_commit_prefetch(ctx, &prefetch);
 	for (i = 0; i < ctx->oids.nr; i++) {
 		display_progress(ctx->progress, i + 1);
 		commit = lookup_commit(ctx->r, &ctx->oids.oid[i]);
 
+		if (use_prefetch) {
+			queue_commit_prefetch(ctx, &prefetch, i);
+			if (commit)
+				parse_prefetched_commit(ctx, &prefetch,
+							commit, i);
+		}
+
 		if (!commit)
 			continue;
 		if (ctx->split) {
@@ -1561,6 +1788,8 @@ static void close_reachable(struct write_commit_graph_context *ctx)
 			add_missing_parents(ctx, commit);
 	}
 	stop_progress(&ctx->progress);
+	if (use_prefetch)
+		stop_commit_prefetch(&prefetch);
 
 	if (ctx->report_progress)
 		ctx->progress = start_delayed_progress(
@@ -1783,12 +2012,132 @@ static void trace2_bloom_filter_write_statistics(struct write_commit_graph_conte
 			   ctx->count_bloom_filter_upgraded);
 }
 
+struct bloom_compute_item {
+	struct commit *commit;
+	struct bloom_filter filter;
+	enum bloom_filter_computed computed;
+	int done;
+};
+
+/*
+ * Worker threads compute the filters of the commits that have none yet,
+ * in the order in which the main thread stores them.
+ */
+struct bloom_compute {
+	struct write_commit_graph_context *ctx;
+	struct bloom_compute_item *items;
+	size_t nr, alloc;
+	size_t next; /* next item to hand to a worker */
+	pthread_mutex_t mutex;
+	pthread_cond_t done_cond;
+	pthread_t *threads;
+	int nr_threads;
+};
+
+static void *bloom_compute_thread(void *data)
+{
+	struct bloom_compute *bc = data;
+
+	pthread_mutex_lock(&bc->mutex);
+	while (bc->next < bc->nr) {
+		struct bloom_compute_item *item = &bc->items[bc->next++];
+
+		pthread_mutex_unlock(&bc->mutex);
+		item->computed = compute_bloom_filter(bc->ctx->r, item->commit,
+						      bc->ctx->bloom_settings,
+						      &item->filter);
+		pthread_mutex_lock(&bc->mutex);
+		item->done = 1;
+		pthread_cond_broadcast(&bc->done_cond);
+	}
+	pthread_mutex_unlock(&bc->mutex);
+
+	return NULL;
+}
+
+/*
+ * Find the commits among the first "max_new_filters" without a usable
+ * filter, i.e. those that get_or_compute_bloom_filter() may have to
+ * compute a filter for, and start computing them on worker threads.
+ * Commits whose filter has a different version are left alone, as they
+ * might be upgraded instead.
+ */
+static void start_bloom_compute(struct write_commit_graph_context *ctx,
+				struct bloom_compute *bc,
+				struct commit **sorted_commits,
+				int max_new_filters)
+{
+	bc->ctx = ctx;
+	for (int i = 0; i < ctx->commits.nr && bc->nr < max_new_filters; i++) {
+		struct commit *c = sorted_commits[i];
+
+		if (get_or_compute_bloom_filter(ctx->r, c, 0, NULL, NULL))
+			continue;
+		/* workers must not parse */
+		repo_parse_commit(ctx->r, c);
+		ALLOC_GROW(bc->items, bc->nr + 1, bc->alloc);
+		memset(&bc->items[bc->nr], 0, sizeof(*bc->items));
+		bc->items[bc->nr++].commit = c;
+	}
+	if (bc->nr < 2)
+		return;
+
+	pthread_mutex_init(&bc->mutex, NULL);
+	pthread_cond_init(&bc->done_cond, NULL);
+	enable_obj_read_lock();
+	bc->nr_threads = ctx->nr_threads;
+	ALLOC_ARRAY(bc->threads, bc->nr_threads);
+	for (int i = 0; i < bc->nr_threads; i++) {
+		int err = pthread_create(&bc->threads[i], NULL,
+					 bloom_compute_thread, bc);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+}
+
+/*
+ * Return the computed filter of "c" if the workers have one for it,
+ * waiting for them to finish it if necessary.
+ */
+static struct bloom_compute_item *get_computed_bloom_filter(struct bloom_compute *bc,
+							    size_t *next,
+							    struct commit *c)
+{
+	struct bloom_compute_item *item;
+
+	if (!bc->nr_threads || *next >= bc->nr || bc->items[*next].commit != c)
+		return NULL;
+
+	item = &bc->items[(*next)++];
+	pthread_mutex_lock(&bc->mutex);
+	while (!item->done)
+		pthread_cond_wait(&bc->done_cond, &bc->mutex);
+	pthread_mutex_unlock(&bc->mutex);
+	return item;
+}
+
+static void stop_bloom_compute(struct bloom_compute *bc)
+{
+	if (bc->nr_threads) {
+		for (int i = 0; i < bc->nr_threads; i++)
+			if (pthread_join(bc->threads[i], NULL))
+				die(_("unable to join thread"));
+		disable_obj_read_lock();
+		pthread_cond_destroy(&bc->done_cond);
+		pthread_mutex_destroy(&bc->mutex);
+		free(bc->threads);
+	}
+	free(bc->items);
+}
+
 static void compute_bloom_filters(struct write_commit_graph_context *ctx)
 {
 	int i;
 	struct progress *progress = NULL;
 	struct commit **sorted_commits;
 	int max_new_filters;
+	struct bloom_compute bc = { 0 };
+	size_t next_computed = 0;
 
 	init_bloom_filters();
 
@@ -1808,15 +2157,36 @@ static void compute_bloom_filters(struct write_commit_graph_context *ctx)
 	max_new_filters = ctx->opts && ctx->opts->max_new_filters >= 0 ?
 		ctx->opts->max_new_filters : ctx->commits.nr;
 
+	if (ctx->nr_threads > 1)
+		start_bloom_compute(ctx, &bc, sorted_commits, max_new_filters);
+
 	for (i = 0; i < ctx->commits.nr; i++) {
 		enum bloom_filter_computed computed = 0;
 		struct commit *c = sorted_commits[i];
-		struct bloom_filter *filter = get_or_compute_bloom_filter(
-			ctx->r,
-			c,
-			ctx->count_bloom_filter_computed < max_new_filters,
-			ctx->bloom_settings,
-			&computed);
+		struct bloom_compute_item *item =
+			get_computed_bloom_filter(&bc, &next_computed, c);
+		struct bloom_filter *filter;
+
+		/*
+		 * With a filter computed by a worker, the decision whether
+		 * to use it is still made here, in order.
+		 */
+		if (item)
+			filter = get_or_use_bloom_filter(
+				ctx->r,
+				c,
+				ctx->count_bloom_filter_computed < max_new_filters,
+				ctx->bloom_settings,
+				&computed,
+				&item->filter,
+				item->computed);
+		else
+			filter = get_or_compute_bloom_filter(
+				ctx->r,
+				c,
+				ctx->count_bloom_filter_computed < max_new_filters,
+				ctx->bloom_settings,
+				&computed);
 		if (computed & BLOOM_COMPUTED) {
 			ctx->count_bloom_filter_computed++;
 			if (computed & BLOOM_TRUNC_EMPTY)
@@ -1832,6 +2202,8 @@ static void compute_bloom_filters(struct write_commit_graph_context *ctx)
 		display_progress(progress, i + 1);
 	}
 
+	stop_bloom_compute(&bc);
+
 	if (trace2_is_enabled())
 		trace2_bloom_filter_write_statistics(ctx);
 
@@ -2546,6 +2918,18 @@ int write_commit_graph(struct odb_source *source,
 							 bloom_settings.max_changed_paths);
 	ctx.bloom_settings = &bloom_settings;
 
+	if (repo_config_get_int(r, "commitgraph.threads", &ctx.nr_threads))
+		ctx.nr_threads = 0;
+	if (ctx.nr_threads < 0) {
+		warning(_("invalid number of threads specified (%d) for %s"),
+			ctx.nr_threads, "commitGraph.threads");
+		ctx.nr_threads = 1;
+	} else if (!HAVE_THREADS) {
+		ctx.nr_threads = 1;
+	} else if (!ctx.nr_threads) {
+		ctx.nr_threads = online_cpus();
+	}
+
 	init_topo_level_slab(&topo_levels);
 	ctx.topo_levels = &topo_levels;
 
@@ -5,10 +5,15 @@
 #include "commit-graph.h"
 #include "decorate.h"
 #include "hex.h"
+#include "oidmap.h"
+#include "pack-bitmap.h"
 #include "prio-queue.h"
 #include "ref-filter.h"
+#include "replace-object.h"
 #include "revision.h"
+#include "shallow.h"
 #include "tag.h"
+#include "trace2.h"
 #include "commit-reach.h"
 #include "ewah/ewok.h"
 
@@ -1047,16 +1052,13 @@ static void free_bit_array(struct commit *c)
 	*bitmap = NULL;
 }
 
-void ahead_behind(struct repository *r,
-		  struct commit **commits, size_t commits_nr,
-		  struct ahead_behind_count *counts, size_t counts_nr)
+static void ahead_behind_walk(struct repository *r,
+			      struct commit **commits, size_t commits_nr,
+			      struct ahead_behind_count *counts, size_t counts_nr)
 {
 	struct prio_queue queue = { .compare = compare_commits_by_gen_then_commit_date };
 	size_t width = DIV_ROUND_UP(commits_nr, BITS_IN_EWORD);
 
-	if (!commits_nr || !counts_nr)
-		return;
-
 	for (size_t i = 0; i < counts_nr; i++) {
 		counts[i].ahead = 0;
 		counts[i].behind = 0;
@@ -1125,6 +1127,111 @@ void ahead_behind(struct repository *r,
 	clear_prio_queue(&queue);
 }
 
+/*
+ * Reachability bitmaps record the history as it was packed, so they
+ * cannot be trusted when grafts, replacements or a shallow boundary
+ * change the parents a walk would see.
+ */
+static int ahead_behind_can_use_bitmaps(struct repository *r)
+{
+	if (replace_refs_enabled(r)) {
+		prepare_replace_object(r);
+		if (oidmap_get_size(&r->objects->replace_map))
+			return 0;
+	}
+
+	prepare_commit_graft(r);
+	if (r->parsed_objects &&
+	    (r->parsed_objects->grafts_nr || r->parsed_objects->substituted_parent))
+		return 0;
+
+	return !is_repository_shallow(r);
+}
+
+/*
+ * Walk only the counts that the bitmaps could not answer, restricted to
+ * the commits those counts refer to.
+ */
+static void ahead_behind_walk_remaining(struct repository *r,
+					struct commit **commits, size_t commits_nr,
+					struct ahead_behind_count *counts,
+					size_t counts_nr, struct bitmap *done)
+{
+	struct commit **sub_commits;
+	struct ahead_behind_count *sub_counts;
+	size_t *sub_index;
+	size_t sub_commits_nr = 0, sub_counts_nr = 0;
+
+	ALLOC_ARRAY(sub_commits, commits_nr);
+	ALLOC_ARRAY(sub_counts, counts_nr);
+	CALLOC_ARRAY(sub_index, commits_nr);
+
+	for (size_t i = 0; i < counts_nr; i++) {
+		size_t tip = counts[i].tip_index, base = counts[i].base_index;
+
+		if (bitmap_get(done, i))
+			continue;
+
+		if (!sub_index[tip]) {
+			sub_commits[sub_commits_nr++] = commits[tip];
+			sub_index[tip] = sub_commits_nr;
+		}
+		if (!sub_index[base]) {
+			sub_commits[sub_commits_nr++] = commits[base];
+			sub_index[base] = sub_commits_nr;
+		}
+
+		sub_counts[sub_counts_nr].tip_index = sub_index[tip] - 1;
+		sub_counts[sub_counts_nr].base_index = sub_index[base] - 1;
+		sub_counts_nr++;
+	}
+
+	ahead_behind_walk(r, sub_commits, sub_commits_nr,
+			  sub_counts, sub_counts_nr);
+
+	for (size_t i = 0, j = 0; i < counts_nr; i++) {
+		if (bitmap_get(done, i))
+			continue;
+		counts[i].ahead = sub_counts[j].ahead;
+		counts[i].behind = sub_counts[j].behind;
+		j++;
+	}
+
+	free(sub_commits);
+	free(sub_counts);
+	free(sub_index);
+}
+
+void ahead_behind(struct repository *r,
+		  struct commit **commits, size_t commits_nr,
+		  struct ahead_behind_count *counts, size_t counts_nr)
+{
+	struct bitmap *done;
+	int nr;
+
+	if (!commits_nr || !counts_nr)
+		return;
+
+	if (!ahead_behind_can_use_bitmaps(r)) {
+		ahead_behind_walk(r, commits, commits_nr, counts, counts_nr);
+		return;
+	}
+
+	done = bitmap_word_alloc(DIV_ROUND_UP(counts_nr, BITS_IN_EWORD));
+	nr = bitmap_ahead_behind(r, commits, commits_nr,
+				 counts, counts_nr, done);
+	if (nr >= 0)
+		trace2_data_intmax("ahead_behind", r, "bitmap_counts", nr);
+
+	if (nr <= 0)
+		ahead_behind_walk(r, commits, commits_nr, counts, counts_nr);
+	else if ((size_t)nr < counts_nr)
+		ahead_behind_walk_remaining(r, commits, commits_nr,
+					    counts, counts_nr, done);
+
+	bitmap_free(done);
+}
+
 struct commit_and_index {
 	struct commit *commit;
 	unsigned int index;
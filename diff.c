@@ -46,6 +46,7 @@
 #include "setup.h"
 #include "strmap.h"
 #include "ws.h"
+#include "thread-utils.h"
 
 #ifdef NO_FAST_WORKING_DIRECTORY
 #define FAST_WORKING_DIRECTORY 0
@@ -56,6 +57,7 @@
 static int diff_detect_rename_default;
 static int diff_indent_heuristic = 1;
 static int diff_rename_limit_default = 1000;
+static int diff_rename_threads_default = 1;
 static int diff_suppress_blank_empty;
 static enum git_colorbool diff_use_color_default = GIT_COLOR_UNKNOWN;
 static int diff_color_moved_default;
@@ -484,6 +486,18 @@ int git_diff_basic_config(const char *var, const char *value,
 		return 0;
 	}
 
+	if (!strcmp(var, "diff.renamethreads")) {
+		diff_rename_threads_default = git_config_int(var, value, ctx->kvi);
+		if (diff_rename_threads_default < 0) {
+			warning(_("invalid number of threads specified (%d) for %s"),
+				diff_rename_threads_default, "diff.renameThreads");
+			diff_rename_threads_default = 1;
+		} else if (!diff_rename_threads_default) {
+			diff_rename_threads_default = online_cpus();
+		}
+		return 0;
+	}
+
 	if (userdiff_config(var, value) < 0)
 		return -1;
 
@@ -4836,6 +4850,7 @@ void repo_diff_setup(struct repository *r, struct diff_options *options)
 	options->line_termination = '\n';
 	options->break_opt = -1;
 	options->rename_limit = -1;
+	options->rename_threads = diff_rename_threads_default;
 	options->dirstat_permille = diff_dirstat_permille_default;
 	options->context = diff_context_default;
 	options->interhunkcontext = diff_interhunk_context_default;
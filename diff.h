@@ -316,6 +316,7 @@ struct diff_options {
 	 */
 	int rename_score;
 	int rename_limit;
+	int rename_threads; /* for inexact renames; 0 is taken as 1 */
 
 	int needed_rename_limit;
 	int degraded_cc_to_c;
@@ -6,6 +6,7 @@
 #define USE_THE_REPOSITORY_VARIABLE
 
 #include "git-compat-util.h"
+#include "config.h"
 #include "diff.h"
 #include "diffcore.h"
 #include "object-file.h"
@@ -16,6 +17,7 @@
 #include "promisor-remote.h"
 #include "string-list.h"
 #include "strmap.h"
+#include "thread-utils.h"
 #include "trace2.h"
 
 /* Table of rename/copy destinations */
@@ -129,6 +131,26 @@ static void inexact_prefetch(void *prefetch_options)
 	oid_array_clear(&to_fetch);
 }
 
+/*
+ * We would not consider edits that change the file size so
+ * drastically.  delta_size must be smaller than
+ * (MAX_SCORE-minimum_score)/MAX_SCORE * min(src->size, dst->size).
+ *
+ * Note that base_size == 0 case is handled here already
+ * and the final score computation in estimate_similarity()
+ * would not have a divide-by-zero issue.
+ */
+static int too_different_in_size(unsigned long src_size,
+				 unsigned long dst_size,
+				 int minimum_score)
+{
+	unsigned long max_size = src_size > dst_size ? src_size : dst_size;
+	unsigned long base_size = src_size < dst_size ? src_size : dst_size;
+	unsigned long delta_size = max_size - base_size;
+
+	return max_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE;
+}
+
 static int estimate_similarity(struct repository *r,
 			       struct diff_filespec *src,
 			       struct diff_filespec *dst,
@@ -147,8 +169,12 @@ static int estimate_similarity(struct repository *r,
 	 * When there is an exact match, it is considered a better
 	 * match than anything else; the destination does not even
 	 * call into this function in that case.
+	 *
+	 * Without "dpf_opt" nothing is populated here, and the caller
+	 * must already have computed "cnt_data" for every file that
+	 * can pass the size check below.
 	 */
-	unsigned long max_size, delta_size, base_size, src_copied, literal_added;
+	unsigned long max_size, src_copied, literal_added;
 	int score;
 
 	/* We deal only with regular files.  Symlink renames are handled
@@ -167,36 +193,32 @@ static int estimate_similarity(struct repository *r,
 	 * is a possible size - we really should have a flag to
 	 * say whether the size is valid or not!)
 	 */
-	dpf_opt->check_size_only = 1;
-
-	if (!src->cnt_data &&
-	    diff_populate_filespec(r, src, dpf_opt))
-		return 0;
-	if (!dst->cnt_data &&
-	    diff_populate_filespec(r, dst, dpf_opt))
-		return 0;
+	if (!dpf_opt) {
+		if (!src->cnt_data || !dst->cnt_data)
+			return 0;
+	} else {
+		dpf_opt->check_size_only = 1;
 
-	max_size = ((src->size > dst->size) ? src->size : dst->size);
-	base_size = ((src->size < dst->size) ? src->size : dst->size);
-	delta_size = max_size - base_size;
+		if (!src->cnt_data &&
+		    diff_populate_filespec(r, src, dpf_opt))
+			return 0;
+		if (!dst->cnt_data &&
+		    diff_populate_filespec(r, dst, dpf_opt))
+			return 0;
+	}
 
-	/* We would not consider edits that change the file size so
-	 * drastically.  delta_size must be smaller than
-	 * (MAX_SCORE-minimum_score)/MAX_SCORE * min(src->size, dst->size).
-	 *
-	 * Note that base_size == 0 case is handled here already
-	 * and the final score computation below would not have a
-	 * divide-by-zero issue.
-	 */
-	if (max_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE)
+	if (too_different_in_size(src->size, dst->size, minimum_score))
 		return 0;
+	max_size = ((src->size > dst->size) ? src->size : dst->size);
 
-	dpf_opt->check_size_only = 0;
+	if (dpf_opt) {
+		dpf_opt->check_size_only = 0;
 
-	if (!src->cnt_data && diff_populate_filespec(r, src, dpf_opt))
-		return 0;
-	if (!dst->cnt_data && diff_populate_filespec(r, dst, dpf_opt))
-		return 0;
+		if (!src->cnt_data && diff_populate_filespec(r, src, dpf_opt))
+			return 0;
+		if (!dst->cnt_data && diff_populate_filespec(r, dst, dpf_opt))
+			return 0;
+	}
 
 	if (diffcore_count_changes(r, src, dst,
 				   &src->cnt_data, &dst->cnt_data,
@@ -1077,6 +1099,250 @@ static void record_if_better(struct diff_score m[], struct diff_score *o)
 		m[worst] = *o;
 }
 
+static int inexact_rename_threads(struct diff_options *options)
+{
+	if (!HAVE_THREADS || options->rename_threads < 1)
+		return 1;
+	return options->rename_threads;
+}
+
+struct inexact_rename_context {
+	struct repository *repo;
+	int minimum_score;
+	int skip_unmodified;
+	struct diff_populate_filespec_options *dpf_opt;
+
+	/* files whose cnt_data is computed in the first pass */
+	struct diff_filespec **specs;
+	int nr_specs;
+
+	/* rows of the score matrix, and the rename_dst entry of each */
+	struct diff_score *mx;
+	int *rows;
+	int nr_rows;
+
+	struct progress *progress;
+	uint64_t rows_done;
+
+	/* next spec or row to hand out */
+	int next;
+	pthread_mutex_t mutex;
+};
+
+static void *prepare_counts_thread(void *data)
+{
+	struct inexact_rename_context *ctx = data;
+
+	for (;;) {
+		struct diff_filespec *spec;
+		int ok;
+
+		/*
+		 * Reading the blob and loading its diff driver use state
+		 * shared with the rest of the process, so only one thread
+		 * at a time may populate a filespec. Hashing its contents
+		 * is private to the filespec and happens unlocked.
+		 */
+		pthread_mutex_lock(&ctx->mutex);
+		if (ctx->next >= ctx->nr_specs) {
+			pthread_mutex_unlock(&ctx->mutex);
+			break;
+		}
+		spec = ctx->specs[ctx->next++];
+		ctx->dpf_opt->check_size_only = 0;
+		ok = !diff_populate_filespec(ctx->repo, spec, ctx->dpf_opt);
+		if (ok)
+			diff_filespec_is_binary(ctx->repo, spec);
+		pthread_mutex_unlock(&ctx->mutex);
+
+		if (ok)
+			spec->cnt_data = diffcore_count_prepare(ctx->repo, spec);
+		diff_free_filespec_blob(spec);
+	}
+	return NULL;
+}
+
+static void *score_rows_thread(void *data)
+{
+	struct inexact_rename_context *ctx = data;
+
+	for (;;) {
+		struct diff_filespec *two;
+		struct diff_score *m;
+		int row, dst, j;
+
+		pthread_mutex_lock(&ctx->mutex);
+		if (ctx->next >= ctx->nr_rows) {
+			pthread_mutex_unlock(&ctx->mutex);
+			break;
+		}
+		row = ctx->next++;
+		pthread_mutex_unlock(&ctx->mutex);
+
+		dst = ctx->rows[row];
+		two = rename_dst[dst].p->two;
+		m = &ctx->mx[row * NUM_CANDIDATE_PER_DST];
+		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+			m[j].dst = -1;
+
+		for (j = 0; j < rename_src_nr; j++) {
+			struct diff_filespec *one = rename_src[j].p->one;
+			struct diff_score this_src;
+
+			if (ctx->skip_unmodified &&
+			    diff_unmodified_pair(rename_src[j].p))
+				continue;
+
+			this_src.score = estimate_similarity(ctx->repo, one, two,
+							     ctx->minimum_score,
+							     NULL);
+			this_src.name_score = basename_same(one, two);
+			this_src.dst = dst;
+			this_src.src = j;
+			record_if_better(m, &this_src);
+		}
+
+		pthread_mutex_lock(&ctx->mutex);
+		ctx->rows_done++;
+		display_progress(ctx->progress,
+				 ctx->rows_done * (uint64_t)rename_src_nr);
+		pthread_mutex_unlock(&ctx->mutex);
+	}
+	return NULL;
+}
+
+static void run_inexact_rename_threads(struct inexact_rename_context *ctx,
+				       void *(*fn)(void *), int nr_threads)
+{
+	pthread_t *threads;
+	int i;
+
+	ctx->next = 0;
+	ALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&threads[i], NULL, fn, ctx);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+}
+
+static int spec_ptr_cmp(const void *a_, const void *b_)
+{
+	const struct diff_filespec *a = *(const struct diff_filespec **)a_;
+	const struct diff_filespec *b = *(const struct diff_filespec **)b_;
+
+	return a < b ? -1 : a > b;
+}
+
+/*
+ * Fill the score matrix "mx" like the serial loop in
+ * diffcore_rename_extended() does, but with "nr_threads" threads.
+ *
+ * We first learn the size of every candidate, serially, and use that to
+ * find the files that pass the size check against at least one
+ * counterpart. Only those are ever hashed by the serial loop, too. Their
+ * span hashes are then computed in parallel, after which scoring a pair
+ * is a read-only operation and each thread can fill whole rows of the
+ * matrix. Every row is scored in the same order as the serial loop, so
+ * the result does not depend on the number of threads.
+ *
+ * Returns the number of rows filled in.
+ */
+static int score_inexact_renames_parallel(struct repository *r,
+					  struct diff_score *mx,
+					  int minimum_score,
+					  int skip_unmodified,
+					  struct diff_populate_filespec_options *dpf_opt,
+					  struct progress *progress,
+					  int nr_threads)
+{
+	struct inexact_rename_context ctx = {
+		.repo = r,
+		.minimum_score = minimum_score,
+		.skip_unmodified = skip_unmodified,
+		.dpf_opt = dpf_opt,
+		.mx = mx,
+		.progress = progress,
+	};
+	unsigned char *src_ok, *src_need;
+	int specs_alloc = 0;
+	int i, j, nr;
+
+	trace2_data_intmax("diff", r, "inexact renames/threads", nr_threads);
+
+	CALLOC_ARRAY(src_ok, rename_src_nr);
+	CALLOC_ARRAY(src_need, rename_src_nr);
+	dpf_opt->check_size_only = 1;
+	for (j = 0; j < rename_src_nr; j++) {
+		struct diff_filespec *one = rename_src[j].p->one;
+
+		if (skip_unmodified && diff_unmodified_pair(rename_src[j].p))
+			continue;
+		if (!S_ISREG(one->mode))
+			continue;
+		if (!one->cnt_data && diff_populate_filespec(r, one, dpf_opt))
+			continue;
+		src_ok[j] = 1;
+	}
+
+	ALLOC_ARRAY(ctx.rows, rename_dst_nr);
+	for (i = 0; i < rename_dst_nr; i++) {
+		struct diff_filespec *two = rename_dst[i].p->two;
+		int need = 0;
+
+		if (rename_dst[i].is_rename)
+			continue; /* exact or basename match already handled */
+		ctx.rows[ctx.nr_rows++] = i;
+
+		if (!S_ISREG(two->mode))
+			continue;
+		dpf_opt->check_size_only = 1;
+		if (!two->cnt_data && diff_populate_filespec(r, two, dpf_opt))
+			continue;
+
+		for (j = 0; j < rename_src_nr; j++) {
+			if (!src_ok[j] ||
+			    too_different_in_size(rename_src[j].p->one->size,
+						  two->size, minimum_score))
+				continue;
+			src_need[j] = need = 1;
+		}
+		if (need && !two->cnt_data) {
+			ALLOC_GROW(ctx.specs, ctx.nr_specs + 1, specs_alloc);
+			ctx.specs[ctx.nr_specs++] = two;
+		}
+	}
+	for (j = 0; j < rename_src_nr; j++) {
+		struct diff_filespec *one = rename_src[j].p->one;
+
+		if (!src_need[j] || one->cnt_data)
+			continue;
+		ALLOC_GROW(ctx.specs, ctx.nr_specs + 1, specs_alloc);
+		ctx.specs[ctx.nr_specs++] = one;
+	}
+
+	/* a filespec may be shared between pairs; hash it only once */
+	QSORT(ctx.specs, ctx.nr_specs, spec_ptr_cmp);
+	for (i = nr = 0; i < ctx.nr_specs; i++)
+		if (!nr || ctx.specs[nr - 1] != ctx.specs[i])
+			ctx.specs[nr++] = ctx.specs[i];
+	ctx.nr_specs = nr;
+
+	pthread_mutex_init(&ctx.mutex, NULL);
+	run_inexact_rename_threads(&ctx, prepare_counts_thread, nr_threads);
+	run_inexact_rename_threads(&ctx, score_rows_thread, nr_threads);
+	pthread_mutex_destroy(&ctx.mutex);
+
+	free(ctx.specs);
+	free(ctx.rows);
+	free(src_need);
+	free(src_ok);
+	return ctx.nr_rows;
+}
+
 /*
  * Returns:
  * 0 if we are under the limit;
@@ -1391,7 +1657,7 @@ void diffcore_rename_extended(struct diff_options *options,
 	struct diff_score *mx;
 	int i, j, rename_count, skip_unmodified = 0;
 	int num_destinations, dst_cnt;
-	int num_sources, want_copies;
+	int num_sources, want_copies, nr_threads;
 	struct progress *progress = NULL;
 	struct mem_pool local_pool;
 	struct dir_rename_info info;
@@ -1580,45 +1846,54 @@ void diffcore_rename_extended(struct diff_options *options,
 	}
 
 	CALLOC_ARRAY(mx, st_mult(NUM_CANDIDATE_PER_DST, num_destinations));
-	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
-		struct diff_filespec *two = rename_dst[i].p->two;
-		struct diff_score *m;
-
-		if (rename_dst[i].is_rename)
-			continue; /* exact or basename match already handled */
-
-		m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
-		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
-			m[j].dst = -1;
-
-		for (j = 0; j < rename_src_nr; j++) {
-			struct diff_filespec *one = rename_src[j].p->one;
-			struct diff_score this_src;
-
-			assert(!one->rename_used || want_copies || break_idx);
-
-			if (skip_unmodified &&
-			    diff_unmodified_pair(rename_src[j].p))
-				continue;
-
-			this_src.score = estimate_similarity(options->repo,
-							     one, two,
-							     minimum_score,
-							     &dpf_options);
-			this_src.name_score = basename_same(one, two);
-			this_src.dst = i;
-			this_src.src = j;
-			record_if_better(m, &this_src);
-			/*
-			 * Once we run estimate_similarity,
-			 * We do not need the text anymore.
-			 */
-			diff_free_filespec_blob(one);
-			diff_free_filespec_blob(two);
+	nr_threads = inexact_rename_threads(options);
+	if (nr_threads > 1 && num_destinations > 1) {
+		dst_cnt = score_inexact_renames_parallel(options->repo, mx,
+							 minimum_score,
+							 skip_unmodified,
+							 &dpf_options, progress,
+							 nr_threads);
+	} else {
+		for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
+			struct diff_filespec *two = rename_dst[i].p->two;
+			struct diff_score *m;
+
+			if (rename_dst[i].is_rename)
+				continue; /* exact or basename match already handled */
+
+			m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
+			for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+				m[j].dst = -1;
+
+			for (j = 0; j < rename_src_nr; j++) {
+				struct diff_filespec *one = rename_src[j].p->one;
+				struct diff_score this_src;
+
+				assert(!one->rename_used || want_copies || break_idx);
+
+				if (skip_unmodified &&
+				    diff_unmodified_pair(rename_src[j].p))
+					continue;
+
+				this_src.score = estimate_similarity(options->repo,
+								     one, two,
+								     minimum_score,
+								     &dpf_options);
+				this_src.name_score = basename_same(one, two);
+				this_src.dst = i;
+				this_src.src = j;
+				record_if_better(m, &this_src);
+				/*
+				 * Once we run estimate_similarity,
+				 * We do not need the text anymore.
+				 */
+				diff_free_filespec_blob(one);
+				diff_free_filespec_blob(two);
+			}
+			dst_cnt++;
+			display_progress(progress,
+					 (uint64_t)dst_cnt * (uint64_t)num_sources);
 		}
-		dst_cnt++;
-		display_progress(progress,
-				 (uint64_t)dst_cnt * (uint64_t)num_sources);
 	}
 	stop_progress(&progress);
 
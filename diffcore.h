@@ -217,6 +217,13 @@ void diff_debug_queue(const char *, struct diff_queue_struct *);
 #define diff_debug_queue(a,b) do { /* nothing */ } while (0)
 #endif
 
+/*
+ * Compute the data diffcore_count_changes() caches in "cnt_data" for
+ * the already populated "one". The binary-ness of "one" must already
+ * be known, so that this can run without touching any shared state.
+ */
+void *diffcore_count_prepare(struct repository *r, struct diff_filespec *one);
+
 int diffcore_count_changes(struct repository *r,
 			   struct diff_filespec *src,
 			   struct diff_filespec *dst,
@@ -18,6 +18,7 @@
 #include "gettext.h"
 #include "name-hash.h"
 #include "object-file.h"
+#include "odb.h"
 #include "path.h"
 #include "refs.h"
 #include "repository.h"
@@ -33,6 +34,7 @@
 #include "strbuf.h"
 #include "submodule-config.h"
 #include "symlinks.h"
+#include "thread-utils.h"
 #include "trace2.h"
 #include "tree.h"
 #include "hex.h"
@@ -71,10 +73,30 @@ struct cached_dir {
 	struct untracked_cache_dir *ucd;
 };
 
+/*
+ * Shared by the threads of a read_directory() that walks the working
+ * tree in parallel; see read_directory_threaded().
+ */
+struct read_dir_threads {
+	struct index_state *istate;
+	const struct pathspec *pathspec;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	char **queue;		/* directories no thread has taken yet */
+	size_t queue_nr, queue_alloc;
+	size_t nr_idle;		/* threads waiting for a directory */
+	size_t nr_busy;		/* threads walking a directory */
+
+	/* read_gitfile_gently() returns a static buffer */
+	pthread_mutex_t gitdir_mutex;
+};
+
 static enum path_treatment read_directory_recursive(struct dir_struct *dir,
 	struct index_state *istate, const char *path, int len,
 	struct untracked_cache_dir *untracked,
-	int check_only, int stop_at_first_file, const struct pathspec *pathspec);
+	int check_only, int stop_at_first_file, const struct pathspec *pathspec,
+	int share_subdirs);
 static int resolve_dtype(int dtype, struct index_state *istate,
 			 const char *path, int len);
 struct dirent *readdir_skip_dot_and_dotdot(DIR *dirp)
@@ -969,6 +991,162 @@ int hashmap_contains_parent(struct hashmap *map,
 	return 0;
 }
 
+/*
+ * A pattern_list with at least this many patterns gets a pattern_matcher.
+ * Shorter lists are cheaper to match one pattern at a time.
+ */
+#define PATTERN_MATCHER_MIN_NR 32
+
+/* Patterns of a list that match a single name, by their position */
+struct pattern_matcher_entry {
+	struct hashmap_entry ent;
+	const char *name;
+	int namelen;
+	int nr, alloc;
+	int *pos;
+};
+
+struct pattern_matcher {
+	/* "name": patterns without a slash or wildcard */
+	struct hashmap basenames;
+
+	/* "*suffix": patterns without a slash or other wildcard */
+	struct hashmap suffixes;
+	int *suffix_lens;
+	int suffix_lens_nr, suffix_lens_alloc;
+
+	/* "dir/name": other patterns without a wildcard, after their base */
+	struct hashmap paths;
+
+	/* the remaining patterns, matched one by one */
+	int *others;
+	int others_nr, others_alloc;
+};
+
+static int pattern_matcher_entry_cmp(const void *cmp_data UNUSED,
+				     const struct hashmap_entry *eptr,
+				     const struct hashmap_entry *entry_or_key,
+				     const void *keydata UNUSED)
+{
+	const struct pattern_matcher_entry *a, *b;
+
+	a = container_of(eptr, const struct pattern_matcher_entry, ent);
+	b = container_of(entry_or_key, const struct pattern_matcher_entry, ent);
+	return a->namelen != b->namelen || fspathncmp(a->name, b->name, a->namelen);
+}
+
+/*
+ * The hash folds case, so that it stays valid for both values of
+ * ignore_case; the comparison above is what honors it.
+ */
+static struct pattern_matcher_entry *pattern_matcher_find(struct hashmap *map,
+							  const char *name,
+							  int namelen)
+{
+	struct pattern_matcher_entry key;
+
+	hashmap_entry_init(&key.ent, memihash(name, namelen));
+	key.name = name;
+	key.namelen = namelen;
+	return hashmap_get_entry(map, &key, ent, NULL);
+}
+
+static void pattern_matcher_insert(struct hashmap *map,
+				   const char *name, int namelen, int pos)
+{
+	struct pattern_matcher_entry *e = pattern_matcher_find(map, name, namelen);
+
+	if (!e) {
+		CALLOC_ARRAY(e, 1);
+		hashmap_entry_init(&e->ent, memihash(name, namelen));
+		e->name = xmemdupz(name, namelen);
+		e->namelen = namelen;
+		hashmap_add(map, &e->ent);
+	}
+	ALLOC_GROW(e->pos, e->nr + 1, e->alloc);
+	e->pos[e->nr++] = pos;
+}
+
+static void pattern_matcher_add(struct pattern_matcher *pm,
+				const struct path_pattern *pattern, int pos)
+{
+	const char *name = pattern->pattern;
+	int namelen = pattern->patternlen;
+	int i;
+
+	if (pattern->flags & PATTERN_FLAG_NODIR) {
+		if (pattern->nowildcardlen == namelen) {
+			pattern_matcher_insert(&pm->basenames, name, namelen, pos);
+			return;
+		}
+		if (pattern->flags & PATTERN_FLAG_ENDSWITH) {
+			pattern_matcher_insert(&pm->suffixes, name + 1,
+					       namelen - 1, pos);
+			for (i = 0; i < pm->suffix_lens_nr; i++)
+				if (pm->suffix_lens[i] == namelen - 1)
+					return;
+			ALLOC_GROW(pm->suffix_lens, pm->suffix_lens_nr + 1,
+				   pm->suffix_lens_alloc);
+			pm->suffix_lens[pm->suffix_lens_nr++] = namelen - 1;
+			return;
+		}
+	} else if (pattern->nowildcardlen == namelen &&
+		   namelen > (*name == '/')) {
+		/* see match_pathname() */
+		struct strbuf path = STRBUF_INIT;
+
+		strbuf_add(&path, pattern->base, pattern->baselen);
+		if (*name == '/')
+			strbuf_add(&path, name + 1, namelen - 1);
+		else
+			strbuf_add(&path, name, namelen);
+		pattern_matcher_insert(&pm->paths, path.buf, path.len, pos);
+		strbuf_release(&path);
+		return;
+	}
+
+	ALLOC_GROW(pm->others, pm->others_nr + 1, pm->others_alloc);
+	pm->others[pm->others_nr++] = pos;
+}
+
+static void create_pattern_matcher(struct pattern_list *pl)
+{
+	struct pattern_matcher *pm;
+	int i;
+
+	CALLOC_ARRAY(pm, 1);
+	hashmap_init(&pm->basenames, pattern_matcher_entry_cmp, NULL, 0);
+	hashmap_init(&pm->suffixes, pattern_matcher_entry_cmp, NULL, 0);
+	hashmap_init(&pm->paths, pattern_matcher_entry_cmp, NULL, 0);
+	for (i = 0; i < pl->nr; i++)
+		pattern_matcher_add(pm, pl->patterns[i], i);
+	pl->matcher = pm;
+}
+
+static void clear_pattern_matcher_entries(struct hashmap *map)
+{
+	struct hashmap_iter iter;
+	struct pattern_matcher_entry *e;
+
+	hashmap_for_each_entry(map, &iter, e, ent) {
+		free((char *)e->name);
+		free(e->pos);
+	}
+	hashmap_clear_and_free(map, struct pattern_matcher_entry, ent);
+}
+
+static void free_pattern_matcher(struct pattern_matcher *pm)
+{
+	if (!pm)
+		return;
+	clear_pattern_matcher_entries(&pm->basenames);
+	clear_pattern_matcher_entries(&pm->suffixes);
+	clear_pattern_matcher_entries(&pm->paths);
+	free(pm->suffix_lens);
+	free(pm->others);
+	free(pm);
+}
+
 void add_pattern(const char *string, const char *base,
 		 int baselen, struct pattern_list *pl, int srcpos)
 {
@@ -989,6 +1167,11 @@ void add_pattern(const char *string, const char *base,
 	pl->patterns[pl->nr++] = pattern;
 	pattern->pl = pl;
 
+	if (pl->matcher)
+		pattern_matcher_add(pl->matcher, pattern, pl->nr - 1);
+	else if (pl->nr >= PATTERN_MATCHER_MIN_NR)
+		create_pattern_matcher(pl);
+
 	add_pattern_to_hashsets(pl, pattern);
 }
 
@@ -1022,6 +1205,7 @@ void clear_pattern_list(struct pattern_list *pl)
 	free(pl->patterns);
 	clear_pattern_entry_hashmap(&pl->recursive_hashmap);
 	clear_pattern_entry_hashmap(&pl->parent_hashmap);
+	free_pattern_matcher(pl->matcher);
 
 	memset(pl, 0, sizeof(*pl));
 }
@@ -1414,6 +1598,105 @@ int match_pathname(const char *pathname, int pathlen,
 				 WM_PATHNAME) == 0;
 }
 
+static int path_pattern_matches(const struct path_pattern *pattern,
+				const char *pathname, int pathlen,
+				const char *basename, int *dtype,
+				struct index_state *istate)
+{
+	const char *exclude = pattern->pattern;
+	int prefix = pattern->nowildcardlen;
+
+	if (pattern->flags & PATTERN_FLAG_MUSTBEDIR) {
+		*dtype = resolve_dtype(*dtype, istate, pathname, pathlen);
+		if (*dtype != DT_DIR)
+			return 0;
+	}
+
+	if (pattern->flags & PATTERN_FLAG_NODIR)
+		return match_basename(basename,
+				      pathlen - (basename - pathname),
+				      exclude, prefix, pattern->patternlen,
+				      pattern->flags);
+
+	assert(pattern->baselen == 0 ||
+	       pattern->base[pattern->baselen - 1] == '/');
+	return match_pathname(pathname, pathlen,
+			      pattern->base,
+			      pattern->baselen ? pattern->baselen - 1 : 0,
+			      exclude, prefix, pattern->patternlen);
+}
+
+/*
+ * Return the last position after 'best' among the patterns of 'e' (which
+ * all match the name) that also apply to the type of pathname, or 'best'.
+ */
+static int last_matching_entry_pos(struct pattern_list *pl,
+				   const struct pattern_matcher_entry *e,
+				   int best, const char *pathname, int pathlen,
+				   int *dtype, struct index_state *istate)
+{
+	int i;
+
+	for (i = e->nr - 1; i >= 0 && e->pos[i] > best; i--) {
+		if (pl->patterns[e->pos[i]]->flags & PATTERN_FLAG_MUSTBEDIR) {
+			*dtype = resolve_dtype(*dtype, istate, pathname, pathlen);
+			if (*dtype != DT_DIR)
+				continue;
+		}
+		return e->pos[i];
+	}
+	return best;
+}
+
+/*
+ * Same as the loop in last_matching_pattern_from_list(), but looks up the
+ * patterns without wildcards by name, and only matches the others that
+ * come after the last one found that way.
+ */
+static struct path_pattern *last_matching_pattern_from_matcher(const char *pathname,
+							      int pathlen,
+							      const char *basename,
+							      int *dtype,
+							      struct pattern_list *pl,
+							      struct index_state *istate)
+{
+	struct pattern_matcher *pm = pl->matcher;
+	struct pattern_matcher_entry *e;
+	int basenamelen = pathlen - (basename - pathname);
+	int best = -1;
+	int i;
+
+	e = pattern_matcher_find(&pm->basenames, basename, basenamelen);
+	if (e)
+		best = last_matching_entry_pos(pl, e, best, pathname, pathlen,
+					       dtype, istate);
+	for (i = 0; i < pm->suffix_lens_nr; i++) {
+		int len = pm->suffix_lens[i];
+
+		if (len > basenamelen)
+			continue;
+		e = pattern_matcher_find(&pm->suffixes,
+					 basename + basenamelen - len, len);
+		if (e)
+			best = last_matching_entry_pos(pl, e, best, pathname,
+						       pathlen, dtype, istate);
+	}
+	e = pattern_matcher_find(&pm->paths, pathname, pathlen);
+	if (e)
+		best = last_matching_entry_pos(pl, e, best, pathname, pathlen,
+					       dtype, istate);
+
+	for (i = pm->others_nr - 1; i >= 0 && pm->others[i] > best; i--) {
+		if (path_pattern_matches(pl->patterns[pm->others[i]],
+					 pathname, pathlen, basename,
+					 dtype, istate)) {
+			best = pm->others[i];
+			break;
+		}
+	}
+	return best < 0 ? NULL : pl->patterns[best];
+}
+
 /*
  * Scan the given exclude list in reverse to see whether pathname
  * should be ignored.  The first match (i.e. the last on the list), if
@@ -1427,45 +1710,24 @@ static struct path_pattern *last_matching_pattern_from_list(const char *pathname
 						       struct pattern_list *pl,
 						       struct index_state *istate)
 {
-	struct path_pattern *res = NULL; /* undecided */
 	int i;
 
 	if (!pl->nr)
 		return NULL;	/* undefined */
 
+	if (pl->matcher)
+		return last_matching_pattern_from_matcher(pathname, pathlen,
+							  basename, dtype,
+							  pl, istate);
+
 	for (i = pl->nr - 1; 0 <= i; i--) {
 		struct path_pattern *pattern = pl->patterns[i];
-		const char *exclude = pattern->pattern;
-		int prefix = pattern->nowildcardlen;
 
-		if (pattern->flags & PATTERN_FLAG_MUSTBEDIR) {
-			*dtype = resolve_dtype(*dtype, istate, pathname, pathlen);
-			if (*dtype != DT_DIR)
-				continue;
-		}
-
-		if (pattern->flags & PATTERN_FLAG_NODIR) {
-			if (match_basename(basename,
-					   pathlen - (basename - pathname),
-					   exclude, prefix, pattern->patternlen,
-					   pattern->flags)) {
-				res = pattern;
-				break;
-			}
-			continue;
-		}
-
-		assert(pattern->baselen == 0 ||
-		       pattern->base[pattern->baselen - 1] == '/');
-		if (match_pathname(pathname, pathlen,
-				   pattern->base,
-				   pattern->baselen ? pattern->baselen - 1 : 0,
-				   exclude, prefix, pattern->patternlen)) {
-			res = pattern;
-			break;
-		}
+		if (path_pattern_matches(pattern, pathname, pathlen, basename,
+					 dtype, istate))
+			return pattern;
 	}
-	return res;
+	return NULL;
 }
 
 /*
@@ -2017,7 +2279,11 @@ static enum path_treatment treat_directory(struct dir_struct *dir,
 		int nested_repo;
 		struct strbuf sb = STRBUF_INIT;
 		strbuf_addstr(&sb, dirname);
+		if (dir->internal.threads)
+			pthread_mutex_lock(&dir->internal.threads->gitdir_mutex);
 		nested_repo = is_nonbare_repository_dir(&sb);
+		if (dir->internal.threads)
+			pthread_mutex_unlock(&dir->internal.threads->gitdir_mutex);
 
 		if (nested_repo) {
 			char *real_dirname, *real_gitdir;
@@ -2059,7 +2325,8 @@ static enum path_treatment treat_directory(struct dir_struct *dir,
 				return path_excluded;
 
 			if (read_directory_recursive(dir, istate, dirname, len,
-						     untracked, 1, 1, pathspec) == path_excluded)
+						     untracked, 1, 1, pathspec,
+						     0) == path_excluded)
 				return path_excluded;
 
 			return path_none;
@@ -2160,7 +2427,7 @@ static enum path_treatment treat_directory(struct dir_struct *dir,
 	untracked = lookup_untracked(dir->untracked, untracked,
 				     dirname + baselen, len - baselen);
 	state = read_directory_recursive(dir, istate, dirname, len, untracked,
-					 check_only, stop_early, pathspec);
+					 check_only, stop_early, pathspec, 0);
 
 	/* There are a variety of reasons we may need to fixup the state... */
 	if (state == path_excluded) {
@@ -2411,7 +2678,7 @@ static enum path_treatment treat_path_fast(struct dir_struct *dir,
 		 * with check_only set.
 		 */
 		return read_directory_recursive(dir, istate, path->buf, path->len,
-						cdir->ucd, 1, 0, pathspec);
+						cdir->ucd, 1, 0, pathspec, 0);
 	/*
 	 * We get path_recurse in the first run when
 	 * directory_exists_in_index() returns index_nonexistent. We
@@ -2674,6 +2941,27 @@ static void add_path_to_appropriate_result_list(struct dir_struct *dir,
 	}
 }
 
+/*
+ * Queue the directory in 'path' for a thread of the parallel walk that
+ * has nothing to do.  Returns 0 when all threads are busy, and the
+ * caller should recurse into the directory itself.
+ */
+static int share_directory(struct read_dir_threads *rdt,
+			   const struct strbuf *path)
+{
+	int shared = 0;
+
+	pthread_mutex_lock(&rdt->mutex);
+	if (rdt->queue_nr < rdt->nr_idle) {
+		ALLOC_GROW(rdt->queue, rdt->queue_nr + 1, rdt->queue_alloc);
+		rdt->queue[rdt->queue_nr++] = xstrdup(path->buf);
+		pthread_cond_signal(&rdt->cond);
+		shared = 1;
+	}
+	pthread_mutex_unlock(&rdt->mutex);
+	return shared;
+}
+
 /*
  * Read a directory tree. We currently ignore anything but
  * directories, regular files and symlinks. That's because git
@@ -2691,12 +2979,17 @@ static void add_path_to_appropriate_result_list(struct dir_struct *dir,
  * Returns the most significant path_treatment value encountered in the scan.
  * If 'stop_at_first_file' is specified, `path_excluded` is the most
  * significant path_treatment value that will be returned.
+ *
+ * If 'share_subdirs' is specified, subdirectories to recurse into may be
+ * handed to idle threads of a parallel walk instead; their state is then
+ * not included in the return value, which the caller must not need.
  */
 
 static enum path_treatment read_directory_recursive(struct dir_struct *dir,
 	struct index_state *istate, const char *base, int baselen,
 	struct untracked_cache_dir *untracked, int check_only,
-	int stop_at_first_file, const struct pathspec *pathspec)
+	int stop_at_first_file, const struct pathspec *pathspec,
+	int share_subdirs)
 {
 	/*
 	 * WARNING: Do NOT recurse unless path_recurse is returned from
@@ -2725,6 +3018,11 @@ static enum path_treatment read_directory_recursive(struct dir_struct *dir,
 		if (state > dir_state)
 			dir_state = state;
 
+		/* let an idle thread recurse into it instead */
+		if (state == path_recurse && share_subdirs &&
+		    share_directory(dir->internal.threads, &path))
+			continue;
+
 		/* recurse into subdir if instructed by treat_path */
 		if (state == path_recurse) {
 			struct untracked_cache_dir *ud;
@@ -2735,7 +3033,8 @@ static enum path_treatment read_directory_recursive(struct dir_struct *dir,
 			subdir_state =
 				read_directory_recursive(dir, istate, path.buf,
 							 path.len, ud,
-							 check_only, stop_at_first_file, pathspec);
+							 check_only, stop_at_first_file, pathspec,
+							 share_subdirs);
 			if (subdir_state > dir_state)
 				dir_state = subdir_state;
 
@@ -3130,6 +3429,208 @@ static void emit_traversal_statistics(struct dir_struct *dir,
 			   "opendir", dir->untracked->dir_opened);
 }
 
+static int read_directory_nr_threads(struct dir_struct *dir,
+				     struct index_state *istate,
+				     const struct pathspec *pathspec)
+{
+	int nr_threads = 1;
+
+	/*
+	 * The untracked cache, the sparse index and attribute pathspecs
+	 * are updated or loaded lazily during the walk.
+	 */
+	if (!HAVE_THREADS || !istate->repo || dir->untracked ||
+	    istate->sparse_index ||
+	    (pathspec && (pathspec->magic & PATHSPEC_ATTR)))
+		return 1;
+
+	repo_config_get_int(istate->repo, "core.untrackedthreads", &nr_threads);
+	if (nr_threads < 0) {
+		warning(_("invalid number of threads specified (%d) for %s"),
+			nr_threads, "core.untrackedThreads");
+		nr_threads = 1;
+	} else if (!nr_threads) {
+		nr_threads = online_cpus();
+	}
+	return nr_threads;
+}
+
+/*
+ * Take directories from the queue and walk them until the queue is empty
+ * and no other thread can add to it any more.
+ */
+static void read_queued_directories(struct read_dir_threads *rdt,
+				    struct dir_struct *dir)
+{
+	pthread_mutex_lock(&rdt->mutex);
+	for (;;) {
+		char *path;
+
+		if (!rdt->queue_nr) {
+			if (!rdt->nr_busy)
+				break;
+			rdt->nr_idle++;
+			pthread_cond_wait(&rdt->cond, &rdt->mutex);
+			rdt->nr_idle--;
+			continue;
+		}
+
+		path = rdt->queue[--rdt->queue_nr];
+		rdt->nr_busy++;
+		pthread_mutex_unlock(&rdt->mutex);
+
+		read_directory_recursive(dir, rdt->istate, path, strlen(path),
+					 NULL, 0, 0, rdt->pathspec, 1);
+		free(path);
+
+		pthread_mutex_lock(&rdt->mutex);
+		if (!--rdt->nr_busy && !rdt->queue_nr)
+			pthread_cond_broadcast(&rdt->cond);
+	}
+	pthread_mutex_unlock(&rdt->mutex);
+}
+
+struct read_dir_worker {
+	pthread_t thread;
+	struct read_dir_threads *rdt;
+	struct dir_struct dir;
+};
+
+static void *read_directory_thread(void *data)
+{
+	struct read_dir_worker *worker = data;
+
+	trace2_thread_start("read_directory");
+	read_queued_directories(worker->rdt, &worker->dir);
+	trace2_thread_exit();
+	return NULL;
+}
+
+/*
+ * Give a worker thread its own copy of 'dir' that shares the command line
+ * and global exclude lists, but has its own stack of per-directory
+ * exclude lists and its own results.
+ */
+static void copy_dir_for_thread(struct dir_struct *copy,
+				const struct dir_struct *dir)
+{
+	*copy = *dir;
+	copy->nr = copy->ignored_nr = 0;
+	copy->entries = copy->ignored = NULL;
+	copy->internal.alloc = copy->internal.ignored_alloc = 0;
+	memset(&copy->internal.exclude_list_group[EXC_DIRS], 0,
+	       sizeof(copy->internal.exclude_list_group[EXC_DIRS]));
+	copy->internal.exclude_stack = NULL;
+	copy->internal.pattern = NULL;
+	strbuf_init(&copy->internal.basebuf, PATH_MAX);
+	copy->internal.visited_paths = 0;
+	copy->internal.visited_directories = 0;
+}
+
+static void merge_dir_from_thread(struct dir_struct *dir,
+				  struct dir_struct *copy)
+{
+	struct exclude_list_group *group;
+	struct exclude_stack *stk;
+	int i;
+
+	ALLOC_GROW(dir->entries, dir->nr + copy->nr, dir->internal.alloc);
+	COPY_ARRAY(dir->entries + dir->nr, copy->entries, copy->nr);
+	dir->nr += copy->nr;
+	ALLOC_GROW(dir->ignored, dir->ignored_nr + copy->ignored_nr,
+		   dir->internal.ignored_alloc);
+	COPY_ARRAY(dir->ignored + dir->ignored_nr, copy->ignored,
+		   copy->ignored_nr);
+	dir->ignored_nr += copy->ignored_nr;
+	dir->internal.visited_paths += copy->internal.visited_paths;
+	dir->internal.visited_directories +=
+		copy->internal.visited_directories;
+
+	free(copy->entries);
+	free(copy->ignored);
+	group = &copy->internal.exclude_list_group[EXC_DIRS];
+	for (i = 0; i < group->nr; i++) {
+		free((char *)group->pl[i].src);
+		clear_pattern_list(&group->pl[i]);
+	}
+	free(group->pl);
+	stk = copy->internal.exclude_stack;
+	while (stk) {
+		struct exclude_stack *prev = stk->prev;
+		free(stk);
+		stk = prev;
+	}
+	strbuf_release(&copy->internal.basebuf);
+}
+
+/*
+ * Walk the working tree below 'path' on 'nr_threads' threads, the calling
+ * one included.  A thread walks its directories depth-first like the
+ * serial walk, but hands a subdirectory it would recurse into to another
+ * thread whenever one is idle.  The results of all threads are collected
+ * in 'dir'; read_directory() sorts them, so they do not depend on which
+ * thread found what.
+ */
+static void read_directory_threaded(struct dir_struct *dir,
+				    struct index_state *istate,
+				    const char *path, int len,
+				    const struct pathspec *pathspec,
+				    int nr_threads)
+{
+	struct read_dir_threads rdt = {
+		.istate = istate,
+		.pathspec = pathspec,
+		.nr_busy = 1,
+	};
+	struct read_dir_worker *workers;
+	int i, err;
+
+	trace2_region_enter("dir", "read_directory_threaded", istate->repo);
+	trace2_data_intmax("dir", istate->repo, "threads", nr_threads);
+
+	/* looked up from all threads */
+	lazy_init_name_hash(istate);
+
+	pthread_mutex_init(&rdt.mutex, NULL);
+	pthread_cond_init(&rdt.cond, NULL);
+	pthread_mutex_init(&rdt.gitdir_mutex, NULL);
+	enable_obj_read_lock();
+	dir->internal.threads = &rdt;
+
+	CALLOC_ARRAY(workers, nr_threads - 1);
+	for (i = 0; i < nr_threads - 1; i++) {
+		workers[i].rdt = &rdt;
+		copy_dir_for_thread(&workers[i].dir, dir);
+		err = pthread_create(&workers[i].thread, NULL,
+				     read_directory_thread, &workers[i]);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+
+	read_directory_recursive(dir, istate, path, len, NULL, 0, 0,
+				 pathspec, 1);
+	pthread_mutex_lock(&rdt.mutex);
+	if (!--rdt.nr_busy && !rdt.queue_nr)
+		pthread_cond_broadcast(&rdt.cond);
+	pthread_mutex_unlock(&rdt.mutex);
+	read_queued_directories(&rdt, dir);
+
+	for (i = 0; i < nr_threads - 1; i++) {
+		pthread_join(workers[i].thread, NULL);
+		merge_dir_from_thread(dir, &workers[i].dir);
+	}
+	free(workers);
+
+	dir->internal.threads = NULL;
+	disable_obj_read_lock();
+	pthread_mutex_destroy(&rdt.gitdir_mutex);
+	pthread_cond_destroy(&rdt.cond);
+	pthread_mutex_destroy(&rdt.mutex);
+	free(rdt.queue);
+
+	trace2_region_leave("dir", "read_directory_threaded", istate->repo);
+}
+
 int read_directory(struct dir_struct *dir, struct index_state *istate,
 		   const char *path, int len, const struct pathspec *pathspec)
 {
@@ -3151,8 +3652,16 @@ int read_directory(struct dir_struct *dir, struct index_state *istate,
 		 * e.g. prep_exclude()
 		 */
 		dir->untracked = NULL;
-	if (!len || treat_leading_path(dir, istate, path, len, pathspec))
-		read_directory_recursive(dir, istate, path, len, untracked, 0, 0, pathspec);
+	if (!len || treat_leading_path(dir, istate, path, len, pathspec)) {
+		int nr_threads = read_directory_nr_threads(dir, istate, pathspec);
+
+		if (nr_threads > 1)
+			read_directory_threaded(dir, istate, path, len,
+						pathspec, nr_threads);
+		else
+			read_directory_recursive(dir, istate, path, len,
+						 untracked, 0, 0, pathspec, 0);
+	}
 	QSORT(dir->entries, dir->nr, cmp_dir_entry);
 	QSORT(dir->ignored, dir->ignored_nr, cmp_dir_entry);
 
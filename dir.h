@@ -7,6 +7,8 @@
 #include "statinfo.h"
 #include "strbuf.h"
 
+struct pattern_matcher;
+struct read_dir_threads;
 struct repository;
 
 /**
@@ -118,6 +120,13 @@ struct pattern_list {
 	 * Used to check single-level parents of blobs.
 	 */
 	struct hashmap parent_hashmap;
+
+	/*
+	 * Once the list is long enough, patterns without wildcards are
+	 * also looked up by name, so that only the other patterns need
+	 * to be matched one by one.
+	 */
+	struct pattern_matcher *matcher;
 };
 
 /*
@@ -353,6 +362,9 @@ struct dir_struct {
 		/* Stats about the traversal */
 		unsigned visited_paths;
 		unsigned visited_directories;
+
+		/* Set while read_directory() walks on several threads */
+		struct read_dir_threads *threads;
 	} internal;
 };
 
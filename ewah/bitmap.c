@@ -18,10 +18,59 @@
  */
 #include "git-compat-util.h"
 #include "ewok.h"
+#include "ewok_rlw.h"
 
 #define EWAH_MASK(x) ((eword_t)1 << (x % BITS_IN_EWORD))
 #define EWAH_BLOCK(x) (x / BITS_IN_EWORD)
 
+/*
+ * One run-length word of a compressed bitmap: `run_len` words that are all
+ * ones or all zeros depending on `run_bit`, followed by `literal_len` words
+ * stored verbatim at `literals`.
+ */
+struct ewah_run {
+	const eword_t *literals;
+	size_t run_len;
+	size_t literal_len;
+	int run_bit;
+};
+
+/*
+ * Decode the run-length word at `*pointer` and advance past its literals.
+ * Consumers that handle a whole run at once avoid the per-word branching
+ * of ewah_iterator_next(), and turn the literal part into a plain loop
+ * over an array that the compiler can vectorize.
+ */
+static int ewah_next_run(struct ewah_bitmap *ewah, size_t *pointer,
+			 struct ewah_run *run)
+{
+	const eword_t *rlw;
+
+	if (*pointer >= ewah->buffer_size)
+		return 0;
+
+	rlw = &ewah->buffer[(*pointer)++];
+	run->run_bit = rlw_get_run_bit(rlw);
+	run->run_len = rlw_get_running_len(rlw);
+	run->literal_len = rlw_get_literal_words(rlw);
+	if (run->literal_len > ewah->buffer_size - *pointer)
+		run->literal_len = ewah->buffer_size - *pointer;
+	run->literals = ewah->buffer + *pointer;
+
+	*pointer += run->literal_len;
+	return 1;
+}
+
+static size_t popcount_words(const eword_t *words, size_t nr)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < nr; i++)
+		count += ewah_bit_popcount64(words[i]);
+
+	return count;
+}
+
 struct bitmap *bitmap_word_alloc(size_t word_alloc)
 {
 	struct bitmap *bitmap = xmalloc(sizeof(struct bitmap));
@@ -101,19 +150,26 @@ struct ewah_bitmap *bitmap_to_ewah(struct bitmap *bitmap)
 
 struct bitmap *ewah_to_bitmap(struct ewah_bitmap *ewah)
 {
-	struct bitmap *bitmap = bitmap_new();
-	struct ewah_iterator it;
-	eword_t blowup;
-	size_t i = 0;
+	struct bitmap *bitmap;
+	struct ewah_run run;
+	size_t pointer = 0, i = 0;
+
+	while (ewah_next_run(ewah, &pointer, &run))
+		i = st_add3(i, run.run_len, run.literal_len);
 
-	ewah_iterator_init(&it, ewah);
+	bitmap = bitmap_word_alloc(i);
 
-	while (ewah_iterator_next(&blowup, &it)) {
-		ALLOC_GROW(bitmap->words, i + 1, bitmap->word_alloc);
-		bitmap->words[i++] = blowup;
+	pointer = i = 0;
+	while (ewah_next_run(ewah, &pointer, &run)) {
+		if (run.run_bit)
+			memset(bitmap->words + i, 0xff,
+			       st_mult(run.run_len, sizeof(eword_t)));
+		i += run.run_len;
+
+		COPY_ARRAY(bitmap->words + i, run.literals, run.literal_len);
+		i += run.literal_len;
 	}
 
-	bitmap->word_alloc = i;
 	return bitmap;
 }
 
@@ -184,9 +240,8 @@ void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other)
 {
 	size_t original_size = self->word_alloc;
 	size_t other_final = (other->bit_size / BITS_IN_EWORD) + 1;
-	size_t i = 0;
-	struct ewah_iterator it;
-	eword_t word;
+	size_t pointer = 0, i = 0;
+	struct ewah_run run;
 
 	if (self->word_alloc < other_final) {
 		self->word_alloc = other_final;
@@ -195,32 +250,41 @@ void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other)
 		              (self->word_alloc - original_size));
 	}
 
-	ewah_iterator_init(&it, other);
-
-	while (ewah_iterator_next(&word, &it))
-		self->words[i++] |= word;
+	while (i < self->word_alloc && ewah_next_run(other, &pointer, &run)) {
+		eword_t *dst;
+		size_t j;
+
+		if (run.run_len > self->word_alloc - i)
+			run.run_len = self->word_alloc - i;
+		if (run.run_bit)
+			memset(self->words + i, 0xff,
+			       st_mult(run.run_len, sizeof(eword_t)));
+		i += run.run_len;
+
+		if (run.literal_len > self->word_alloc - i)
+			run.literal_len = self->word_alloc - i;
+		dst = self->words + i;
+		for (j = 0; j < run.literal_len; j++)
+			dst[j] |= run.literals[j];
+		i += run.literal_len;
+	}
 }
 
 size_t bitmap_popcount(struct bitmap *self)
 {
-	size_t i, count = 0;
-
-	for (i = 0; i < self->word_alloc; ++i)
-		count += ewah_bit_popcount64(self->words[i]);
-
-	return count;
+	return popcount_words(self->words, self->word_alloc);
 }
 
 size_t ewah_bitmap_popcount(struct ewah_bitmap *self)
 {
-	struct ewah_iterator it;
-	eword_t word;
-	size_t count = 0;
+	struct ewah_run run;
+	size_t pointer = 0, count = 0;
 
-	ewah_iterator_init(&it, self);
-
-	while (ewah_iterator_next(&word, &it))
-		count += ewah_bit_popcount64(word);
+	while (ewah_next_run(self, &pointer, &run)) {
+		if (run.run_bit)
+			count += run.run_len * BITS_IN_EWORD;
+		count += popcount_words(run.literals, run.literal_len);
+	}
 
 	return count;
 }
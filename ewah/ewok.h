@@ -24,11 +24,15 @@ typedef uint64_t eword_t;
 #define BITS_IN_EWORD (sizeof(eword_t) * 8)
 
 /**
- * Do not use __builtin_popcountll. The GCC implementation
- * is notoriously slow on all platforms.
+ * Do not use __builtin_popcountll unless the target has a popcount
+ * instruction. Otherwise the GCC implementation is notoriously slow on
+ * all platforms.
  *
  * See: http://gcc.gnu.org/bugzilla/show_bug.cgi?id=36041
  */
+#if defined(__GNUC__) && (defined(__POPCNT__) || defined(__ARM_NEON))
+#define ewah_bit_popcount64(x) ((uint32_t)__builtin_popcountll(x))
+#else
 static inline uint32_t ewah_bit_popcount64(uint64_t x)
 {
 	x = (x & 0x5555555555555555ULL) + ((x >>  1) & 0x5555555555555555ULL);
@@ -36,6 +40,7 @@ static inline uint32_t ewah_bit_popcount64(uint64_t x)
 	x = (x & 0x0F0F0F0F0F0F0F0FULL) + ((x >>  4) & 0x0F0F0F0F0F0F0F0FULL);
 	return (x * 0x0101010101010101ULL) >> 56;
 }
+#endif
 
 /* __builtin_ctzll was not available until 3.4.0 */
 #if defined(__GNUC__) && (__GNUC__ > 3 || (__GNUC__ == 3  && __GNUC_MINOR > 3))
@@ -403,29 +403,16 @@ static void normalize_file(mmfile_t *mm, const char *path, struct index_state *i
 	}
 }
 
-enum ll_merge_result ll_merge(mmbuffer_t *result_buf,
-	     const char *path,
-	     mmfile_t *ancestor, const char *ancestor_label,
-	     mmfile_t *ours, const char *our_label,
-	     mmfile_t *theirs, const char *their_label,
-	     struct index_state *istate,
-	     const struct ll_merge_options *opts)
+static const struct ll_merge_driver *find_merge_driver_for_path(struct index_state *istate,
+								const char *path,
+								const struct ll_merge_options *opts,
+								int *marker_size_p)
 {
 	struct attr_check *check = load_merge_attributes();
-	static const struct ll_merge_options default_opts = LL_MERGE_OPTIONS_INIT;
 	const char *ll_driver_name = NULL;
 	int marker_size = DEFAULT_CONFLICT_MARKER_SIZE;
 	const struct ll_merge_driver *driver;
 
-	if (!opts)
-		opts = &default_opts;
-
-	if (opts->renormalize) {
-		normalize_file(ancestor, path, istate);
-		normalize_file(ours, path, istate);
-		normalize_file(theirs, path, istate);
-	}
-
 	git_check_attr(istate, path, check);
 	ll_driver_name = check->items[0].value;
 	if (check->items[1].value) {
@@ -445,6 +432,61 @@ enum ll_merge_result ll_merge(mmbuffer_t *result_buf,
 	if (opts->extra_marker_size) {
 		marker_size += opts->extra_marker_size;
 	}
+	*marker_size_p = marker_size;
+	return driver;
+}
+
+enum ll_merge_result ll_merge(mmbuffer_t *result_buf,
+	     const char *path,
+	     mmfile_t *ancestor, const char *ancestor_label,
+	     mmfile_t *ours, const char *our_label,
+	     mmfile_t *theirs, const char *their_label,
+	     struct index_state *istate,
+	     const struct ll_merge_options *opts)
+{
+	static const struct ll_merge_options default_opts = LL_MERGE_OPTIONS_INIT;
+	int marker_size;
+	const struct ll_merge_driver *driver;
+
+	if (!opts)
+		opts = &default_opts;
+
+	if (opts->renormalize) {
+		normalize_file(ancestor, path, istate);
+		normalize_file(ours, path, istate);
+		normalize_file(theirs, path, istate);
+	}
+
+	driver = find_merge_driver_for_path(istate, path, opts, &marker_size);
+	return driver->fn(driver, result_buf, path, ancestor, ancestor_label,
+			  ours, our_label, theirs, their_label,
+			  opts, marker_size);
+}
+
+const struct ll_merge_driver *ll_merge_find_builtin(struct index_state *istate,
+						    const char *path,
+						    const struct ll_merge_options *opts,
+						    int *marker_size)
+{
+	const struct ll_merge_driver *driver;
+
+	if (opts->renormalize)
+		return NULL;
+	driver = find_merge_driver_for_path(istate, path, opts, marker_size);
+	if (driver < ll_merge_drv || driver >= ll_merge_drv + ARRAY_SIZE(ll_merge_drv))
+		return NULL;
+	return driver;
+}
+
+enum ll_merge_result ll_merge_builtin(const struct ll_merge_driver *driver,
+				      mmbuffer_t *result_buf,
+				      const char *path,
+				      mmfile_t *ancestor, const char *ancestor_label,
+				      mmfile_t *ours, const char *our_label,
+				      mmfile_t *theirs, const char *their_label,
+				      const struct ll_merge_options *opts,
+				      int marker_size)
+{
 	return driver->fn(driver, result_buf, path, ancestor, ancestor_label,
 			  ours, our_label, theirs, their_label,
 			  opts, marker_size);
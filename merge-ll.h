@@ -108,6 +108,29 @@ enum ll_merge_result ll_merge(mmbuffer_t *result_buf,
 	     struct index_state *istate,
 	     const struct ll_merge_options *opts);
 
+/*
+ * The two halves of ll_merge(), for callers that want to run many merges
+ * in parallel.  ll_merge_find_builtin() looks at the attributes of "path"
+ * to find the merge driver and conflict marker size ll_merge() would use.
+ * If that is one of the built-in drivers and no renormalization was asked
+ * for, it returns the driver, otherwise NULL.  ll_merge_builtin() then
+ * runs such a driver; it neither reads attributes nor configuration and
+ * may be called from several threads at once.
+ */
+struct ll_merge_driver;
+const struct ll_merge_driver *ll_merge_find_builtin(struct index_state *istate,
+						    const char *path,
+						    const struct ll_merge_options *opts,
+						    int *marker_size);
+enum ll_merge_result ll_merge_builtin(const struct ll_merge_driver *driver,
+				      mmbuffer_t *result_buf,
+				      const char *path,
+				      mmfile_t *ancestor, const char *ancestor_label,
+				      mmfile_t *ours, const char *our_label,
+				      mmfile_t *theirs, const char *their_label,
+				      const struct ll_merge_options *opts,
+				      int marker_size);
+
 int ll_merge_marker_size(struct index_state *istate, const char *path);
 void reset_merge_attributes(void);
 
@@ -47,6 +47,7 @@
 #include "refs.h"
 #include "revision.h"
 #include "sparse-index.h"
+#include "thread-utils.h"
 #include "strmap.h"
 #include "trace2.h"
 #include "tree.h"
@@ -275,6 +276,20 @@ struct rename_info {
 	 */
 	struct strset cached_irrelevant[3];
 
+	/*
+	 * cached_dir_renamed: cached_pairs that depend on the other side
+	 *
+	 * When a directory rename on one side of history moves a file that
+	 * the other side added or renamed, possibly_cache_new_pair() records
+	 * the result of applying that directory rename in cached_pairs.
+	 * Such entries are only valid when the next merge builds on the
+	 * result of this one (as when rebasing or cherry-picking), not when
+	 * it merges the same side with a different other side.  This is
+	 * the set of keys of cached_pairs[side] that were recorded that
+	 * way, so they can be dropped in the latter case.
+	 */
+	struct strset cached_dir_renamed[3];
+
 	/*
 	 * redo_after_renames: optimization flag for "restarting" the merge
 	 *
@@ -408,6 +423,15 @@ struct merge_options_internal {
 	/* call_depth: recursion level counter for merging merge bases */
 	int call_depth;
 
+	/*
+	 * precomputed_merges: content merges done ahead of time by worker
+	 * threads; see precompute_content_merges()
+	 *
+	 * The keys are paths from opt->priv->paths, the values are struct
+	 * precomputed_merge owned by process_entries().
+	 */
+	struct strmap precomputed_merges;
+
 	/* field that holds submodule conflict information */
 	struct string_list conflicted_submodules;
 };
@@ -676,6 +700,36 @@ static void free_strmap_strings(struct strmap *map)
 	}
 }
 
+static void clear_conflict_messages(struct strmap *conflicts,
+				    int reinitialize)
+{
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+
+	/* Release and free each strbuf found in output */
+	strmap_for_each_entry(conflicts, &iter, e) {
+		struct string_list *list = e->value;
+		for (int i = 0; i < list->nr; i++) {
+			struct logical_conflict_info *info =
+				list->items[i].util;
+			strvec_clear(&info->paths);
+		}
+		/*
+		 * While strictly speaking we don't need to free(conflicts)
+		 * here because we could pass free_values=1 when calling
+		 * strmap_clear() on conflicts, that would require
+		 * strmap_clear to do another strmap_for_each_entry() loop,
+		 * so we just free it while we're iterating anyway.
+		 */
+		string_list_clear(list, 1);
+		free(list);
+	}
+	if (reinitialize)
+		strmap_partial_clear(conflicts, 0);
+	else
+		strmap_clear(conflicts, 0);
+}
+
 static void clear_or_reinit_internal_opts(struct merge_options_internal *opti,
 					  int reinitialize)
 {
@@ -696,6 +750,7 @@ static void clear_or_reinit_internal_opts(struct merge_options_internal *opti,
 	 * don't free the keys and we pass 0 for free_values.
 	 */
 	strmap_clear_func(&opti->conflicted, 0);
+	strmap_clear_func(&opti->precomputed_merges, 0);
 
 	discard_index(&opti->attr_index);
 
@@ -711,6 +766,7 @@ static void clear_or_reinit_internal_opts(struct merge_options_internal *opti,
 			strset_clear_func(&renames->cached_target_names[i]);
 			strmap_clear_func(&renames->cached_pairs[i], 1);
 			strset_clear_func(&renames->cached_irrelevant[i]);
+			strset_clear_func(&renames->cached_dir_renamed[i]);
 			partial_clear_dir_rename_count(&renames->dir_rename_count[i]);
 			if (!reinitialize)
 				strmap_clear(&renames->dir_rename_count[i], 1);
@@ -724,31 +780,8 @@ static void clear_or_reinit_internal_opts(struct merge_options_internal *opti,
 	renames->cached_pairs_valid_side = 0;
 	renames->dir_rename_mask = 0;
 
-	if (!reinitialize) {
-		struct hashmap_iter iter;
-		struct strmap_entry *e;
-
-		/* Release and free each strbuf found in output */
-		strmap_for_each_entry(&opti->conflicts, &iter, e) {
-			struct string_list *list = e->value;
-			for (int i = 0; i < list->nr; i++) {
-				struct logical_conflict_info *info =
-					list->items[i].util;
-				strvec_clear(&info->paths);
-			}
-			/*
-			 * While strictly speaking we don't need to
-			 * free(conflicts) here because we could pass
-			 * free_values=1 when calling strmap_clear() on
-			 * opti->conflicts, that would require strmap_clear
-			 * to do another strmap_for_each_entry() loop, so we
-			 * just free it while we're iterating anyway.
-			 */
-			string_list_clear(list, 1);
-			free(list);
-		}
-		strmap_clear(&opti->conflicts, 0);
-	}
+	if (!reinitialize)
+		clear_conflict_messages(&opti->conflicts, 0);
 
 	mem_pool_discard(&opti->pool, 0);
 
@@ -2086,6 +2119,33 @@ static void initialize_attr_index(struct merge_options *opt)
 	}
 }
 
+static void setup_ll_merge_options(struct merge_options *opt,
+				   struct ll_merge_options *ll_opts,
+				   int extra_marker_size)
+{
+	ll_opts->renormalize = opt->renormalize;
+	ll_opts->extra_marker_size = extra_marker_size;
+	ll_opts->xdl_opts = opt->xdl_opts;
+	ll_opts->conflict_style = opt->conflict_style;
+
+	if (opt->priv->call_depth) {
+		ll_opts->virtual_ancestor = 1;
+		ll_opts->variant = 0;
+	} else {
+		switch (opt->recursive_variant) {
+		case MERGE_VARIANT_OURS:
+			ll_opts->variant = XDL_MERGE_FAVOR_OURS;
+			break;
+		case MERGE_VARIANT_THEIRS:
+			ll_opts->variant = XDL_MERGE_FAVOR_THEIRS;
+			break;
+		default:
+			ll_opts->variant = 0;
+			break;
+		}
+	}
+}
+
 static int merge_3way(struct merge_options *opt,
 		      const char *path,
 		      const struct object_id *o,
@@ -2103,27 +2163,7 @@ static int merge_3way(struct merge_options *opt,
 	if (!opt->priv->attr_index.initialized)
 		initialize_attr_index(opt);
 
-	ll_opts.renormalize = opt->renormalize;
-	ll_opts.extra_marker_size = extra_marker_size;
-	ll_opts.xdl_opts = opt->xdl_opts;
-	ll_opts.conflict_style = opt->conflict_style;
-
-	if (opt->priv->call_depth) {
-		ll_opts.virtual_ancestor = 1;
-		ll_opts.variant = 0;
-	} else {
-		switch (opt->recursive_variant) {
-		case MERGE_VARIANT_OURS:
-			ll_opts.variant = XDL_MERGE_FAVOR_OURS;
-			break;
-		case MERGE_VARIANT_THEIRS:
-			ll_opts.variant = XDL_MERGE_FAVOR_THEIRS;
-			break;
-		default:
-			ll_opts.variant = 0;
-			break;
-		}
-	}
+	setup_ll_merge_options(opt, &ll_opts, extra_marker_size);
 
 	assert(pathnames[0] && pathnames[1] && pathnames[2] && opt->ancestor);
 	if (pathnames[0] == pathnames[1] && pathnames[1] == pathnames[2]) {
@@ -2158,6 +2198,48 @@ static int merge_3way(struct merge_options *opt,
 	return merge_status;
 }
 
+/*
+ * A content merge of a single path that precompute_content_merges() ran
+ * before process_entries() got to the path.
+ */
+struct precomputed_merge {
+	const char *path;
+	struct object_id base, side1, side2;
+	const struct ll_merge_driver *driver;
+	int marker_size;
+	int record_object;
+
+	/* results, filled in by content_merge_worker() */
+	int merge_status;
+	int write_failed;
+	struct object_id result;
+};
+
+static struct precomputed_merge *find_precomputed_merge(struct merge_options *opt,
+							 const char *path,
+							 const struct object_id *base,
+							 const struct object_id *side1,
+							 const struct object_id *side2,
+							 const char *pathnames[3],
+							 int extra_marker_size,
+							 int record_object)
+{
+	struct precomputed_merge *pm;
+
+	pm = strmap_get(&opt->priv->precomputed_merges, path);
+	if (!pm ||
+	    pm->record_object != record_object ||
+	    extra_marker_size != opt->priv->call_depth * 2 ||
+	    strcmp(pathnames[0], path) ||
+	    strcmp(pathnames[1], path) ||
+	    strcmp(pathnames[2], path) ||
+	    !oideq(&pm->base, base) ||
+	    !oideq(&pm->side1, side1) ||
+	    !oideq(&pm->side2, side2))
+		return NULL;
+	return pm;
+}
+
 static int handle_content_merge(struct merge_options *opt,
 				const char *path,
 				const struct version_info *o,
@@ -2229,23 +2311,37 @@ static int handle_content_merge(struct merge_options *opt,
 
 	/* Remaining rules depend on file vs. submodule vs. symlink. */
 	else if (S_ISREG(a->mode)) {
-		mmbuffer_t result_buf;
+		mmbuffer_t result_buf = { 0 };
 		int ret = 0, merge_status;
 		int two_way;
+		const struct object_id *base;
+		struct precomputed_merge *pm;
 
 		/*
 		 * If 'o' is different type, treat it as null so we do a
 		 * two-way merge.
 		 */
 		two_way = ((S_IFMT & o->mode) != (S_IFMT & a->mode));
+		base = two_way ? null_oid(the_hash_algo) : &o->oid;
+
+		pm = find_precomputed_merge(opt, path, base, &a->oid, &b->oid,
+					    pathnames, extra_marker_size,
+					    record_object);
+		if (pm) {
+			merge_status = pm->merge_status;
+			if (merge_status == LL_MERGE_BINARY_CONFLICT)
+				path_msg(opt, CONFLICT_BINARY, 0,
+					 path, NULL, NULL, NULL,
+					 "warning: Cannot merge binary files: %s (%s vs. %s)",
+					 path, opt->branch1, opt->branch2);
+		} else {
+			merge_status = merge_3way(opt, path, base,
+						  &a->oid, &b->oid,
+						  pathnames, extra_marker_size,
+						  &result_buf);
+		}
 
-		merge_status = merge_3way(opt, path,
-					  two_way ? null_oid(the_hash_algo) : &o->oid,
-					  &a->oid, &b->oid,
-					  pathnames, extra_marker_size,
-					  &result_buf);
-
-		if ((merge_status < 0) || !result_buf.ptr) {
+		if ((merge_status < 0) || (!pm && !result_buf.ptr)) {
 			path_msg(opt, ERROR_THREEWAY_CONTENT_MERGE_FAILED, 0,
 				 pathnames[0], pathnames[1], pathnames[2], NULL,
 				 _("error: failed to execute internal merge for %s"),
@@ -2253,13 +2349,23 @@ static int handle_content_merge(struct merge_options *opt,
 			ret = -1;
 		}
 
-		if (!ret && record_object &&
-		    odb_write_object(the_repository->objects, result_buf.ptr, result_buf.size,
-				     OBJ_BLOB, &result->oid)) {
-			path_msg(opt, ERROR_OBJECT_WRITE_FAILED, 0,
-				 pathnames[0], pathnames[1], pathnames[2], NULL,
-				 _("error: unable to add %s to database"), path);
-			ret = -1;
+		if (!ret && record_object) {
+			int write_failed;
+
+			if (pm) {
+				write_failed = pm->write_failed;
+				oidcpy(&result->oid, &pm->result);
+			} else {
+				write_failed = odb_write_object(the_repository->objects,
+								result_buf.ptr, result_buf.size,
+								OBJ_BLOB, &result->oid);
+			}
+			if (write_failed) {
+				path_msg(opt, ERROR_OBJECT_WRITE_FAILED, 0,
+					 pathnames[0], pathnames[1], pathnames[2], NULL,
+					 _("error: unable to add %s to database"), path);
+				ret = -1;
+			}
 		}
 		free(result_buf.ptr);
 
@@ -3391,15 +3497,22 @@ static void possibly_cache_new_pair(struct rename_info *renames,
 		 */
 		strmap_put(&renames->cached_pairs[side], p->one->path, NULL);
 	} else if (p->status == 'R') {
-		if (!new_path)
+		if (!new_path) {
 			new_path = p->two->path;
-		else
+		} else {
 			cache_new_pair(renames, dir_renamed_side,
 				       p->two->path, new_path, 0);
+			strset_add(&renames->cached_dir_renamed[dir_renamed_side],
+				   p->two->path);
+			strset_add(&renames->cached_dir_renamed[side],
+				   p->one->path);
+		}
 		cache_new_pair(renames, side, p->one->path, new_path, 1);
 	} else if (p->status == 'A' && new_path) {
 		cache_new_pair(renames, dir_renamed_side,
 			       p->two->path, new_path, 0);
+		strset_add(&renames->cached_dir_renamed[dir_renamed_side],
+			   p->two->path);
 	}
 }
 
@@ -3437,6 +3550,7 @@ static int detect_regular_renames(struct merge_options *opt,
 	diff_opts.rename_limit = opt->rename_limit;
 	if (opt->rename_limit <= 0)
 		diff_opts.rename_limit = 7000;
+	diff_opts.rename_threads = opt->rename_threads;
 	diff_opts.rename_score = opt->rename_score;
 	diff_opts.show_rename_progress = opt->show_rename_progress;
 	diff_opts.output_format = DIFF_FORMAT_NO_OUTPUT;
@@ -4480,6 +4594,185 @@ static void prefetch_for_content_merges(struct merge_options *opt,
 	oid_array_clear(&to_fetch);
 }
 
+static int content_merge_threads(struct merge_options *opt)
+{
+	if (!HAVE_THREADS)
+		return 1;
+	return opt->nr_threads;
+}
+
+struct content_merge_pool {
+	struct merge_options *opt;
+	struct ll_merge_options ll_opts;
+	struct precomputed_merge *merges;
+	size_t nr, next;
+	pthread_mutex_t mutex;
+};
+
+static void *content_merge_worker(void *data)
+{
+	struct content_merge_pool *pool = data;
+	struct merge_options *opt = pool->opt;
+
+	for (;;) {
+		struct precomputed_merge *pm = NULL;
+		mmfile_t orig, src1, src2;
+		mmbuffer_t result_buf = { 0 };
+
+		pthread_mutex_lock(&pool->mutex);
+		if (pool->next < pool->nr)
+			pm = &pool->merges[pool->next++];
+		pthread_mutex_unlock(&pool->mutex);
+		if (!pm)
+			break;
+
+		read_mmblob(&orig, &pm->base);
+		read_mmblob(&src1, &pm->side1);
+		read_mmblob(&src2, &pm->side2);
+
+		pm->merge_status = ll_merge_builtin(pm->driver, &result_buf,
+						    pm->path,
+						    &orig, opt->ancestor,
+						    &src1, opt->branch1,
+						    &src2, opt->branch2,
+						    &pool->ll_opts,
+						    pm->marker_size);
+		if (!result_buf.ptr)
+			pm->merge_status = LL_MERGE_ERROR;
+
+		/* Object writes share the lock that guards object reads. */
+		if (pm->merge_status >= 0 && pm->record_object) {
+			obj_read_lock();
+			pm->write_failed = !!odb_write_object(the_repository->objects,
+							      result_buf.ptr,
+							      result_buf.size,
+							      OBJ_BLOB, &pm->result);
+			obj_read_unlock();
+		}
+
+		free(orig.ptr);
+		free(src1.ptr);
+		free(src2.ptr);
+		free(result_buf.ptr);
+	}
+	return NULL;
+}
+
+/*
+ * With merge.threads, run the content merges of regular files that
+ * process_entry() is going to need, and write their results, on a pool
+ * of threads before walking the entries.  Only paths that were not
+ * renamed and use a built-in merge driver are handled here; the walk
+ * itself still runs in order on the main thread, picks these results
+ * up in handle_content_merge() and emits all messages, so the result
+ * does not depend on the number of threads.
+ *
+ * Returns the array of precomputed merges, to be freed by the caller.
+ */
+static struct precomputed_merge *precompute_content_merges(struct merge_options *opt,
+							   struct string_list *plist)
+{
+	struct content_merge_pool pool = {
+		.opt = opt,
+		.ll_opts = LL_MERGE_OPTIONS_INIT,
+	};
+	struct string_list_item *e;
+	size_t alloc = 0;
+	int nr_threads = content_merge_threads(opt);
+	const int record_object = (!opt->mergeability_only ||
+				   opt->priv->call_depth);
+	pthread_t *threads;
+	int i;
+
+	/* a mergeability check stops at the first conflict anyway */
+	if (nr_threads < 2 || (opt->mergeability_only && !opt->priv->call_depth))
+		return NULL;
+
+	if (!opt->priv->attr_index.initialized)
+		initialize_attr_index(opt);
+	setup_ll_merge_options(opt, &pool.ll_opts, opt->priv->call_depth * 2);
+
+	for (e = &plist->items[plist->nr-1]; e >= plist->items; --e) {
+		const char *path = e->string;
+		struct conflict_info *ci = e->util;
+		struct version_info *o, *a, *b;
+		struct precomputed_merge *pm;
+		const struct ll_merge_driver *driver;
+		int two_way, marker_size;
+
+		if (ci->merged.clean)
+			continue;
+
+		/* Only plain content merges, as process_entry() does them */
+		o = &ci->stages[0];
+		a = &ci->stages[1];
+		b = &ci->stages[2];
+		if (ci->dirmask || ci->df_conflict || ci->match_mask ||
+		    ci->filemask < 6 ||
+		    !S_ISREG(a->mode) || !S_ISREG(b->mode) ||
+		    oideq(&a->oid, &b->oid))
+			continue;
+		two_way = ((S_IFMT & o->mode) != (S_IFMT & a->mode));
+		if (!two_way &&
+		    (oideq(&o->oid, &a->oid) || oideq(&o->oid, &b->oid)))
+			continue;
+		if (strcmp(ci->pathnames[0], path) ||
+		    strcmp(ci->pathnames[1], path) ||
+		    strcmp(ci->pathnames[2], path))
+			continue;
+
+		driver = ll_merge_find_builtin(&opt->priv->attr_index, path,
+					       &pool.ll_opts, &marker_size);
+		if (!driver)
+			continue;
+
+		ALLOC_GROW(pool.merges, pool.nr + 1, alloc);
+		pm = &pool.merges[pool.nr++];
+		memset(pm, 0, sizeof(*pm));
+		pm->path = path;
+		oidcpy(&pm->base, two_way ? null_oid(the_hash_algo) : &o->oid);
+		oidcpy(&pm->side1, &a->oid);
+		oidcpy(&pm->side2, &b->oid);
+		pm->driver = driver;
+		pm->marker_size = marker_size;
+		pm->record_object = record_object;
+	}
+
+	if (pool.nr < 2) {
+		free(pool.merges);
+		return NULL;
+	}
+	if (nr_threads > pool.nr)
+		nr_threads = pool.nr;
+
+	trace2_region_enter("merge", "precompute content merges", opt->repo);
+	trace2_data_intmax("merge", opt->repo, "content_merges/count", pool.nr);
+	trace2_data_intmax("merge", opt->repo, "content_merges/threads",
+			   nr_threads);
+
+	pthread_mutex_init(&pool.mutex, NULL);
+	enable_obj_read_lock();
+	ALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&threads[i], NULL,
+					 content_merge_worker, &pool);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	disable_obj_read_lock();
+	pthread_mutex_destroy(&pool.mutex);
+
+	for (size_t j = 0; j < pool.nr; j++)
+		strmap_put(&opt->priv->precomputed_merges,
+			   pool.merges[j].path, &pool.merges[j]);
+	trace2_region_leave("merge", "precompute content merges", opt->repo);
+
+	return pool.merges;
+}
+
 static int process_entries(struct merge_options *opt,
 			   struct object_id *result_oid)
 {
@@ -4490,6 +4783,7 @@ static int process_entries(struct merge_options *opt,
 	struct directory_versions dir_metadata = { STRING_LIST_INIT_NODUP,
 						   STRING_LIST_INIT_NODUP,
 						   NULL, 0 };
+	struct precomputed_merge *precomputed = NULL;
 	int ret = 0;
 	const int record_tree = (!opt->mergeability_only ||
 				 opt->priv->call_depth);
@@ -4530,6 +4824,7 @@ static int process_entries(struct merge_options *opt,
 	 */
 	trace2_region_enter("merge", "processing", opt->repo);
 	prefetch_for_content_merges(opt, &plist);
+	precomputed = precompute_content_merges(opt, &plist);
 	for (entry = &plist.items[plist.nr-1]; entry >= plist.items; --entry) {
 		char *path = entry->string;
 		/*
@@ -4577,6 +4872,8 @@ static int process_entries(struct merge_options *opt,
 		       opt->repo->hash_algo->rawsz) < 0)
 		ret = -1;
 cleanup:
+	strmap_partial_clear(&opt->priv->precomputed_merges, 0);
+	free(precomputed);
 	string_list_clear(&plist, 0);
 	string_list_clear(&dir_metadata.versions, 0);
 	string_list_clear(&dir_metadata.offsets, 0);
@@ -5026,6 +5323,7 @@ static void merge_start(struct merge_options *opt, struct merge_result *result)
 	assert(opt->detect_directory_renames >= MERGE_DIRECTORY_RENAMES_NONE &&
 	       opt->detect_directory_renames <= MERGE_DIRECTORY_RENAMES_TRUE);
 	assert(opt->rename_limit >= -1);
+	assert(opt->rename_threads >= 1);
 	assert(opt->rename_score >= 0 && opt->rename_score <= MAX_SCORE);
 	assert(opt->show_rename_progress >= 0 && opt->show_rename_progress <= 1);
 
@@ -5035,6 +5333,7 @@ static void merge_start(struct merge_options *opt, struct merge_result *result)
 
 	if (opt->msg_header_prefix)
 		assert(opt->record_conflict_msgs_as_headers);
+	assert(opt->nr_threads >= 1);
 
 	/*
 	 * detect_renames, verbosity, buffer_output, and obuf are ignored
@@ -5074,6 +5373,12 @@ static void merge_start(struct merge_options *opt, struct merge_result *result)
 	trace2_region_enter("merge", "allocate/init", opt->repo);
 	if (opt->priv) {
 		clear_or_reinit_internal_opts(opt->priv, 1);
+		/*
+		 * Messages from the previous merge are only kept around so
+		 * the caller could display them; do not let them leak into
+		 * this one.
+		 */
+		clear_conflict_messages(&opt->priv->conflicts, 1);
 		string_list_init_nodup(&opt->priv->conflicted_submodules);
 		trace2_region_leave("merge", "allocate/init", opt->repo);
 		return;
@@ -5107,6 +5412,8 @@ static void merge_start(struct merge_options *opt, struct merge_result *result)
 					 NULL, 1);
 		strset_init_with_options(&renames->cached_target_names[i],
 					 NULL, 0);
+		strset_init_with_options(&renames->cached_dir_renamed[i],
+					 NULL, 1);
 	}
 	for (i = MERGE_SIDE1; i <= MERGE_SIDE2; i++) {
 		strintmap_init_with_options(&renames->deferred[i].possible_trivial_merges,
@@ -5135,9 +5442,35 @@ static void merge_start(struct merge_options *opt, struct merge_result *result)
 	 */
 	strmap_init(&opt->priv->conflicts);
 
+	strmap_init_with_options(&opt->priv->precomputed_merges, NULL, 0);
+
 	trace2_region_leave("merge", "allocate/init", opt->repo);
 }
 
+/*
+ * Forget the cached_pairs[side] entries that came from applying the other
+ * side's directory renames; see the comment on cached_dir_renamed.
+ */
+static void drop_dir_renamed_pairs(struct rename_info *renames, int side)
+{
+	struct hashmap_iter iter;
+	struct strmap_entry *entry;
+
+	if (strset_empty(&renames->cached_dir_renamed[side]))
+		return;
+
+	strset_for_each_entry(&renames->cached_dir_renamed[side], &iter, entry)
+		strmap_remove(&renames->cached_pairs[side], entry->key, 1);
+	strset_partial_clear(&renames->cached_dir_renamed[side]);
+
+	/* cached_target_names points into the values we just freed */
+	strset_partial_clear(&renames->cached_target_names[side]);
+	strmap_for_each_entry(&renames->cached_pairs[side], &iter, entry)
+		if (entry->value)
+			strset_add(&renames->cached_target_names[side],
+				   entry->value);
+}
+
 static void merge_check_renames_reusable(struct merge_options *opt,
 					 struct merge_result *result,
 					 struct tree *merge_base,
@@ -5199,8 +5532,27 @@ static void merge_check_renames_reusable(struct merge_options *opt,
 	else if (oideq(&merge_base->object.oid, &merge_trees[1]->object.oid) &&
 		 oideq(&side2->object.oid, &result->tree->object.oid))
 		renames->cached_pairs_valid_side = MERGE_SIDE2;
-	else
+	/*
+	 * A batch of merges against a common base (e.g. testing several
+	 * topics against the same tip) repeats the same base and one of
+	 * the sides; the renames on that side are exactly the ones we
+	 * found last time, except for those that the other side's
+	 * directory renames had a hand in.
+	 */
+	else if (oideq(&merge_base->object.oid, &merge_trees[0]->object.oid) &&
+		 oideq(&side1->object.oid, &merge_trees[1]->object.oid)) {
+		renames->cached_pairs_valid_side = MERGE_SIDE1;
+		drop_dir_renamed_pairs(renames, MERGE_SIDE1);
+	} else if (oideq(&merge_base->object.oid, &merge_trees[0]->object.oid) &&
+		   oideq(&side2->object.oid, &merge_trees[2]->object.oid)) {
+		renames->cached_pairs_valid_side = MERGE_SIDE2;
+		drop_dir_renamed_pairs(renames, MERGE_SIDE2);
+	} else
 		renames->cached_pairs_valid_side = 0; /* neither side valid */
+
+	if (renames->cached_pairs_valid_side)
+		trace2_data_intmax("merge", opt->repo, "renames/reused_side",
+				   renames->cached_pairs_valid_side);
 }
 
 /*** Function Grouping: merge_incore_*() and their internal variants ***/
@@ -5418,6 +5770,8 @@ void merge_incore_recursive(struct merge_options *opt,
 			    struct commit *side2,
 			    struct merge_result *result)
 {
+	struct tree *merge_trees[3] = { NULL };
+
 	trace2_region_enter("merge", "incore_recursive", opt->repo);
 
 	/*
@@ -5429,7 +5783,29 @@ void merge_incore_recursive(struct merge_options *opt,
 	       (merge_bases && !merge_bases->next));
 
 	trace2_region_enter("merge", "merge_start", opt->repo);
+	if (merge_bases && !merge_bases->next) {
+		merge_trees[0] = repo_get_commit_tree(opt->repo,
+						      merge_bases->item);
+		merge_trees[1] = repo_get_commit_tree(opt->repo, side1);
+		merge_trees[2] = repo_get_commit_tree(opt->repo, side2);
+		merge_check_renames_reusable(opt, result, merge_trees[0],
+					     merge_trees[1], merge_trees[2]);
+	} else if (result->priv) {
+		struct merge_options_internal *opti = result->priv;
+
+		/*
+		 * Virtual merge bases clobber the cached renames; nothing
+		 * from a previous merge can be trusted.
+		 */
+		opti->renames.cached_pairs_valid_side = 0;
+	}
 	merge_start(opt, result);
+	/*
+	 * With a single merge base this is just a non-recursive merge, so
+	 * record the trees as merge_incore_nonrecursive() does.  Otherwise
+	 * record nothing, so the next merge does not reuse anything.
+	 */
+	COPY_ARRAY(opt->priv->renames.merge_trees, merge_trees, 3);
 	trace2_region_leave("merge", "merge_start", opt->repo);
 
 	merge_ort_internal(opt, merge_bases, side1, side2, result);
@@ -5443,8 +5819,24 @@ static void merge_recursive_config(struct merge_options *opt, int ui)
 	repo_config_get_int(the_repository, "merge.verbosity", &opt->verbosity);
 	repo_config_get_int(the_repository, "diff.renamelimit", &opt->rename_limit);
 	repo_config_get_int(the_repository, "merge.renamelimit", &opt->rename_limit);
+	repo_config_get_int(the_repository, "diff.renamethreads", &opt->rename_threads);
+	if (opt->rename_threads < 0) {
+		warning(_("invalid number of threads specified (%d) for %s"),
+			opt->rename_threads, "diff.renameThreads");
+		opt->rename_threads = 1;
+	} else if (!opt->rename_threads) {
+		opt->rename_threads = online_cpus();
+	}
 	repo_config_get_bool(the_repository, "merge.renormalize", &renormalize);
 	opt->renormalize = renormalize;
+	repo_config_get_int(the_repository, "merge.threads", &opt->nr_threads);
+	if (opt->nr_threads < 0) {
+		warning(_("invalid number of threads specified (%d) for %s"),
+			opt->nr_threads, "merge.threads");
+		opt->nr_threads = 1;
+	} else if (!opt->nr_threads) {
+		opt->nr_threads = online_cpus();
+	}
 	if (!repo_config_get_string(the_repository, "diff.renames", &value)) {
 		opt->detect_renames = git_config_rename("diff.renames", value);
 		free(value);
@@ -5488,12 +5880,14 @@ static void init_merge_options(struct merge_options *opt,
 	opt->detect_renames = -1;
 	opt->detect_directory_renames = MERGE_DIRECTORY_RENAMES_CONFLICT;
 	opt->rename_limit = -1;
+	opt->rename_threads = 1;
 
 	opt->verbosity = 2;
 	opt->buffer_output = 1;
 	strbuf_init(&opt->obuf, 0);
 
 	opt->renormalize = 0;
+	opt->nr_threads = 1;
 
 	opt->conflict_style = -1;
 	opt->xdl_opts = DIFF_WITH_ALG(opt, HISTOGRAM_DIFF);
@@ -62,6 +62,7 @@ struct merge_options {
 		MERGE_DIRECTORY_RENAMES_TRUE = 2
 	} detect_directory_renames;
 	int rename_limit;
+	int rename_threads; /* as for struct diff_options */
 	int rename_score;
 	int show_rename_progress;
 
@@ -86,6 +87,7 @@ struct merge_options {
 	unsigned mergeability_only : 1; /* exit early, write fewer objects */
 	unsigned record_conflict_msgs_as_headers : 1;
 	const char *msg_header_prefix;
+	int nr_threads; /* for content merges */
 
 	/* internal fields used by the implementation */
 	struct merge_options_internal *priv;
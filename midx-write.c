@@ -17,6 +17,7 @@
 #include "list-objects.h"
 #include "path.h"
 #include "pack-revindex.h"
+#include "thread-utils.h"
 
 #define PACK_EXPIRED UINT_MAX
 #define BITMAP_POS_UNKNOWN (~((uint32_t)0))
@@ -110,6 +111,8 @@ struct write_midx_context {
 
 	struct string_list *to_include;
 
+	int nr_threads;
+
 	struct repository *repo;
 	struct odb_source *source;
 };
@@ -327,30 +330,28 @@ static void midx_fanout_add_pack_fanout(struct midx_fanout *fanout,
  *
  * Copy only the de-duplicated entries (selected by most-recent modified time
  * of a packfile containing the object).
+ *
+ * This handles the fanout values in [fanout_start, fanout_end), appending
+ * the resulting entries to "entries". Since each fanout value is handled
+ * on its own and only reads from the packs and MIDXs involved, disjoint
+ * ranges may be computed in parallel.
  */
-static void compute_sorted_entries(struct write_midx_context *ctx,
-				   uint32_t start_pack)
+static void compute_sorted_entries_range(const struct write_midx_context *ctx,
+					 uint32_t start_pack,
+					 uint32_t fanout_start,
+					 uint32_t fanout_end,
+					 size_t fanout_alloc,
+					 struct pack_midx_entry **entries,
+					 size_t *entries_nr,
+					 size_t *entries_alloc)
 {
 	uint32_t cur_fanout, cur_pack, cur_object;
-	size_t alloc_objects, total_objects = 0;
 	struct midx_fanout fanout = { 0 };
 
-	for (cur_pack = start_pack; cur_pack < ctx->nr; cur_pack++)
-		total_objects = st_add(total_objects,
-				       ctx->info[cur_pack].p->num_objects);
-
-	/*
-	 * As we de-duplicate by fanout value, we expect the fanout
-	 * slices to be evenly distributed, with some noise. Hence,
-	 * allocate slightly more than one 256th.
-	 */
-	alloc_objects = fanout.alloc = total_objects > 3200 ? total_objects / 200 : 16;
-
+	fanout.alloc = fanout_alloc;
 	ALLOC_ARRAY(fanout.entries, fanout.alloc);
-	ALLOC_ARRAY(ctx->entries, alloc_objects);
-	ctx->entries_nr = 0;
 
-	for (cur_fanout = 0; cur_fanout < 256; cur_fanout++) {
+	for (cur_fanout = fanout_start; cur_fanout < fanout_end; cur_fanout++) {
 		fanout.nr = 0;
 
 		if (ctx->m && !ctx->incremental)
@@ -385,18 +386,118 @@ static void compute_sorted_entries(struct write_midx_context *ctx,
 					 &fanout.entries[cur_object].oid))
 				continue;
 
-			ALLOC_GROW(ctx->entries, st_add(ctx->entries_nr, 1),
-				   alloc_objects);
-			memcpy(&ctx->entries[ctx->entries_nr],
+			ALLOC_GROW(*entries, st_add(*entries_nr, 1),
+				   *entries_alloc);
+			memcpy(&(*entries)[*entries_nr],
 			       &fanout.entries[cur_object],
 			       sizeof(struct pack_midx_entry));
-			ctx->entries_nr++;
+			(*entries_nr)++;
 		}
 	}
 
 	free(fanout.entries);
 }
 
+struct sorted_entries_worker {
+	pthread_t thread;
+	const struct write_midx_context *ctx;
+	uint32_t start_pack;
+	uint32_t fanout_start, fanout_end;
+	size_t fanout_alloc;
+
+	struct pack_midx_entry *entries;
+	size_t entries_nr, entries_alloc;
+};
+
+static void *sorted_entries_worker(void *data)
+{
+	struct sorted_entries_worker *w = data;
+
+	compute_sorted_entries_range(w->ctx, w->start_pack,
+				     w->fanout_start, w->fanout_end,
+				     w->fanout_alloc, &w->entries,
+				     &w->entries_nr, &w->entries_alloc);
+	return NULL;
+}
+
+static void compute_sorted_entries(struct write_midx_context *ctx,
+				   uint32_t start_pack)
+{
+	uint32_t cur_pack;
+	size_t alloc_objects, total_objects = 0;
+	struct sorted_entries_worker *workers;
+	int nr_threads = ctx->nr_threads;
+
+	for (cur_pack = start_pack; cur_pack < ctx->nr; cur_pack++)
+		total_objects = st_add(total_objects,
+				       ctx->info[cur_pack].p->num_objects);
+
+	/*
+	 * As we de-duplicate by fanout value, we expect the fanout
+	 * slices to be evenly distributed, with some noise. Hence,
+	 * allocate slightly more than one 256th.
+	 */
+	alloc_objects = total_objects > 3200 ? total_objects / 200 : 16;
+
+	ctx->entries = NULL;
+	ctx->entries_nr = 0;
+
+	if (nr_threads > 256)
+		nr_threads = 256;
+	if (nr_threads <= 1) {
+		size_t alloc = alloc_objects;
+
+		ALLOC_ARRAY(ctx->entries, alloc);
+		compute_sorted_entries_range(ctx, start_pack, 0, 256,
+					     alloc_objects, &ctx->entries,
+					     &ctx->entries_nr, &alloc);
+		return;
+	}
+
+	/*
+	 * Give each thread a contiguous range of fanout values, so that
+	 * concatenating their results in order yields the sorted list.
+	 */
+	trace2_region_enter("midx", "compute_sorted_entries", ctx->repo);
+	CALLOC_ARRAY(workers, nr_threads);
+	for (int i = 0; i < nr_threads; i++) {
+		struct sorted_entries_worker *w = &workers[i];
+		int err;
+
+		w->ctx = ctx;
+		w->start_pack = start_pack;
+		w->fanout_start = 256 * i / nr_threads;
+		w->fanout_end = 256 * (i + 1) / nr_threads;
+		w->fanout_alloc = alloc_objects;
+
+		err = pthread_create(&w->thread, NULL,
+				     sorted_entries_worker, w);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+
+	for (int i = 0; i < nr_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		ctx->entries_nr = st_add(ctx->entries_nr, workers[i].entries_nr);
+	}
+
+	ALLOC_ARRAY(ctx->entries, ctx->entries_nr);
+	ctx->entries_nr = 0;
+	for (int i = 0; i < nr_threads; i++) {
+		struct sorted_entries_worker *w = &workers[i];
+
+		COPY_ARRAY(ctx->entries + ctx->entries_nr, w->entries,
+			   w->entries_nr);
+		ctx->entries_nr += w->entries_nr;
+		free(w->entries);
+	}
+	free(workers);
+
+	trace2_data_intmax("midx", ctx->repo, "compute_sorted_entries/threads",
+			   nr_threads);
+	trace2_region_leave("midx", "compute_sorted_entries", ctx->repo);
+}
+
 static int write_midx_pack_names(struct hashfile *f, void *data)
 {
 	struct write_midx_context *ctx = data;
@@ -1292,6 +1393,18 @@ static int write_midx_internal(struct odb_source *source,
 		}
 	}
 
+	if (repo_config_get_int(r, "multipackindex.threads", &ctx.nr_threads))
+		ctx.nr_threads = 0;
+	if (ctx.nr_threads < 0) {
+		warning(_("invalid number of threads specified (%d) for %s"),
+			ctx.nr_threads, "multiPackIndex.threads");
+		ctx.nr_threads = 1;
+	} else if (!HAVE_THREADS) {
+		ctx.nr_threads = 1;
+	} else if (!ctx.nr_threads) {
+		ctx.nr_threads = online_cpus();
+	}
+
 	compute_sorted_entries(&ctx, start_pack);
 
 	ctx.large_offsets_needed = 0;
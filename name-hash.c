@@ -588,7 +588,7 @@ static void threaded_lazy_init_name_hash(
 	free(lazy_entries);
 }
 
-static void lazy_init_name_hash(struct index_state *istate)
+void lazy_init_name_hash(struct index_state *istate)
 {
 
 	if (istate->name_hash_initialized)
@@ -10,6 +10,12 @@ int index_dir_find(struct index_state *istate, const char *name, int namelen,
 
 #define index_dir_exists(i, n, l) index_dir_find((i), (n), (l), NULL)
 
+/*
+ * Build the name hash of the index now rather than on its first lookup,
+ * e.g. before looking up names from several threads.
+ */
+void lazy_init_name_hash(struct index_state *istate);
+
 void adjust_dirname_case(struct index_state *istate, char *name);
 struct cache_entry *index_file_exists(struct index_state *istate, const char *name, int namelen, int igncase);
 
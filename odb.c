@@ -637,23 +637,28 @@ int odb_has_alternates(struct object_database *odb)
 
 int obj_read_use_lock = 0;
 pthread_mutex_t obj_read_mutex;
+static int obj_read_lock_users;
 
 void enable_obj_read_lock(void)
 {
-	if (obj_read_use_lock)
+	if (obj_read_lock_users++)
 		return;
 
 	obj_read_use_lock = 1;
 	init_recursive_mutex(&obj_read_mutex);
+	enable_delta_base_cache_lock();
 }
 
 void disable_obj_read_lock(void)
 {
-	if (!obj_read_use_lock)
+	if (!obj_read_lock_users)
+		BUG("disable_obj_read_lock() without enable_obj_read_lock()");
+	if (--obj_read_lock_users)
 		return;
 
 	obj_read_use_lock = 0;
 	pthread_mutex_destroy(&obj_read_mutex);
+	disable_delta_base_cache_lock();
 }
 
 int fetch_if_missing = 1;
@@ -418,12 +418,18 @@ void odb_assert_oid_type(struct object_database *odb,
  * obj_read_lock() and obj_read_unlock() may also be used to protect other
  * section which cannot execute in parallel with object reading. Since the used
  * lock is a recursive mutex, these sections can even contain calls to object
- * reading functions. However, beware that in these cases zlib inflation won't
- * be performed in parallel, losing performance.
+ * reading functions. However, beware that in these cases zlib inflation and
+ * delta application won't be performed in parallel, losing performance.
  *
  * TODO: odb_read_object_info_extended()'s call stack has a recursive behavior. If
  * any of its callees end up calling it, this recursive call won't benefit from
  * parallel inflation.
+ *
+ * Calls to enable_obj_read_lock() and disable_obj_read_lock() nest: the lock
+ * stays enabled until each enable_obj_read_lock() has been matched by a
+ * disable_obj_read_lock(), so code that starts its own threads may do so even
+ * while other threads are reading objects. Both must be called from the main
+ * thread.
  */
 void enable_obj_read_lock(void);
 void disable_obj_read_lock(void);
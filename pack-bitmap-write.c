@@ -27,6 +27,7 @@
 #include "strmap.h"
 #include "midx.h"
 #include "pack-revindex.h"
+#include "thread-utils.h"
 
 struct bitmapped_commit {
 	struct commit *commit;
@@ -59,6 +60,19 @@ void bitmap_writer_init(struct bitmap_writer *writer, struct repository *r,
 	string_list_init_dup(&writer->pseudo_merge_groups);
 
 	load_pseudo_merges_from_config(r, &writer->pseudo_merge_groups);
+
+	if (repo_config_get_int(r, "pack.writebitmapthreads",
+				&writer->nr_threads))
+		writer->nr_threads = 1;
+	if (writer->nr_threads < 0) {
+		warning(_("invalid number of threads specified (%d) for %s"),
+			writer->nr_threads, "pack.writeBitmapThreads");
+		writer->nr_threads = 1;
+	} else if (!HAVE_THREADS) {
+		writer->nr_threads = 1;
+	} else if (!writer->nr_threads) {
+		writer->nr_threads = online_cpus();
+	}
 }
 
 static void free_pseudo_merge_commit_idx(struct pseudo_merge_commit_idx *idx)
@@ -302,6 +316,7 @@ struct bb_commit {
 		 maximal:1,
 		 pseudo_merge:1;
 	unsigned idx; /* within selected array */
+	unsigned pending; /* parents not yet built, when building in parallel */
 };
 
 static void clear_bb_commit(struct bb_commit *commit)
@@ -454,42 +469,53 @@ static void bitmap_builder_clear(struct bitmap_builder *bb)
 	commit_stack_clear(&bb->commits);
 }
 
+/*
+ * Trees are read directly from the object database rather than through
+ * "struct tree", whose buffer would be shared (and freed) by concurrent
+ * walks when building bitmaps in parallel.
+ */
 static int fill_bitmap_tree(struct bitmap_writer *writer,
 			    struct bitmap *bitmap,
-			    struct tree *tree)
+			    const struct object_id *oid)
 {
-	int found;
+	int found, ret = 0;
 	uint32_t pos;
 	struct tree_desc desc;
 	struct name_entry entry;
+	enum object_type type;
+	unsigned long size;
+	void *buf;
 
 	/*
 	 * If our bit is already set, then there is nothing to do. Both this
 	 * tree and all of its children will be set.
 	 */
-	pos = find_object_pos(writer, &tree->object.oid, &found);
+	pos = find_object_pos(writer, oid, &found);
 	if (!found)
 		return -1;
 	if (bitmap_get(bitmap, pos))
 		return 0;
 	bitmap_set(bitmap, pos);
 
-	if (repo_parse_tree(writer->repo, tree) < 0)
-		die("unable to load tree object %s",
-		    oid_to_hex(&tree->object.oid));
-	init_tree_desc(&desc, &tree->object.oid, tree->buffer, tree->size);
+	buf = odb_read_object(writer->repo->objects, oid, &type, &size);
+	if (!buf || type != OBJ_TREE)
+		die("unable to load tree object %s", oid_to_hex(oid));
+	init_tree_desc(&desc, oid, buf, size);
 
 	while (tree_entry(&desc, &entry)) {
 		switch (object_type(entry.mode)) {
 		case OBJ_TREE:
-			if (fill_bitmap_tree(writer, bitmap,
-					     lookup_tree(writer->repo, &entry.oid)) < 0)
-				return -1;
+			if (fill_bitmap_tree(writer, bitmap, &entry.oid) < 0) {
+				ret = -1;
+				goto out;
+			}
 			break;
 		case OBJ_BLOB:
 			pos = find_object_pos(writer, &entry.oid, &found);
-			if (!found)
-				return -1;
+			if (!found) {
+				ret = -1;
+				goto out;
+			}
 			bitmap_set(bitmap, pos);
 			break;
 		default:
@@ -498,13 +524,35 @@ static int fill_bitmap_tree(struct bitmap_writer *writer,
 		}
 	}
 
-	free_tree_buffer(tree);
-	return 0;
+out:
+	free(buf);
+	return ret;
 }
 
 static int reused_bitmaps_nr;
 static int reused_pseudo_merge_bitmaps_nr;
 
+/*
+ * When building bitmaps in parallel, this lock protects the state
+ * shared between the workers that fill_bitmap_commit() may modify:
+ * the lazily-loaded existing bitmaps, the counters above and the
+ * commit trees loaded from the commit-graph.
+ */
+static int bitmap_build_use_lock;
+static pthread_mutex_t bitmap_build_mutex;
+
+static inline void bitmap_build_lock(void)
+{
+	if (bitmap_build_use_lock)
+		pthread_mutex_lock(&bitmap_build_mutex);
+}
+
+static inline void bitmap_build_unlock(void)
+{
+	if (bitmap_build_use_lock)
+		pthread_mutex_unlock(&bitmap_build_mutex);
+}
+
 static int fill_bitmap_commit(struct bitmap_writer *writer,
 			      struct bb_commit *ent,
 			      struct commit *commit,
@@ -528,10 +576,12 @@ static int fill_bitmap_commit(struct bitmap_writer *writer,
 			struct ewah_bitmap *old;
 			struct bitmap *remapped = bitmap_new();
 
+			bitmap_build_lock();
 			if (commit->object.flags & BITMAP_PSEUDO_MERGE)
 				old = pseudo_merge_bitmap_for_commit(old_bitmap, c);
 			else
 				old = bitmap_for_commit(old_bitmap, c);
+			bitmap_build_unlock();
 			/*
 			 * If this commit has an old bitmap, then translate that
 			 * bitmap and add its bits to this one. No need to walk
@@ -540,10 +590,12 @@ static int fill_bitmap_commit(struct bitmap_writer *writer,
 			if (old && !rebuild_bitmap(mapping, old, remapped)) {
 				bitmap_or(ent->bitmap, remapped);
 				bitmap_free(remapped);
+				bitmap_build_lock();
 				if (commit->object.flags & BITMAP_PSEUDO_MERGE)
 					reused_pseudo_merge_bitmaps_nr++;
 				else
 					reused_bitmaps_nr++;
+				bitmap_build_unlock();
 				continue;
 			}
 			bitmap_free(remapped);
@@ -554,12 +606,17 @@ static int fill_bitmap_commit(struct bitmap_writer *writer,
 		 * walk ensures we cover all parents.
 		 */
 		if (!(c->object.flags & BITMAP_PSEUDO_MERGE)) {
+			struct tree *tree;
+
 			pos = find_object_pos(writer, &c->object.oid, &found);
 			if (!found)
 				return -1;
 			bitmap_set(ent->bitmap, pos);
-			prio_queue_put(tree_queue,
-				       repo_get_commit_tree(writer->repo, c));
+
+			bitmap_build_lock();
+			tree = repo_get_commit_tree(writer->repo, c);
+			bitmap_build_unlock();
+			prio_queue_put(tree_queue, tree);
 		}
 
 		for (p = c->parents; p; p = p->next) {
@@ -575,8 +632,10 @@ static int fill_bitmap_commit(struct bitmap_writer *writer,
 	}
 
 	while (tree_queue->nr) {
+		struct tree *tree = prio_queue_get(tree_queue);
+
 		if (fill_bitmap_tree(writer, ent->bitmap,
-				     prio_queue_get(tree_queue)) < 0)
+				     &tree->object.oid) < 0)
 			return -1;
 	}
 	return 0;
@@ -601,6 +660,167 @@ static void store_selected(struct bitmap_writer *writer,
 	kh_value(writer->bitmaps, hash_pos) = stored;
 }
 
+struct bitmap_build_context {
+	struct bitmap_writer *writer;
+	struct bitmap_builder *bb;
+	struct bitmap_index *old_bitmap;
+	const uint32_t *mapping;
+
+	/* commits whose parents have all been built */
+	struct commit_stack ready;
+	size_t remaining;
+	int nr_stored;
+	int closed;
+
+	pthread_cond_t cond;
+};
+
+static void *build_bitmaps_thread(void *data)
+{
+	struct bitmap_build_context *ctx = data;
+	struct bitmap_writer *writer = ctx->writer;
+	struct prio_queue queue = { compare_commits_by_gen_then_commit_date };
+	struct prio_queue tree_queue = { NULL };
+
+	pthread_mutex_lock(&bitmap_build_mutex);
+	for (;;) {
+		struct commit *commit, *child;
+		struct bb_commit *ent;
+		int reused = 0;
+
+		while (ctx->closed && ctx->remaining && !ctx->ready.nr)
+			pthread_cond_wait(&ctx->cond, &bitmap_build_mutex);
+		if (!ctx->closed || !ctx->remaining)
+			break;
+
+		commit = commit_stack_pop(&ctx->ready);
+		ent = bb_data_at(&ctx->bb->data, commit);
+		pthread_mutex_unlock(&bitmap_build_mutex);
+
+		/*
+		 * The bitmaps of all parents of this commit have already
+		 * been folded into ent->bitmap, and no other thread touches
+		 * it until we are done.
+		 */
+		if (fill_bitmap_commit(writer, ent, commit, &queue, &tree_queue,
+				       ctx->old_bitmap, ctx->mapping) < 0) {
+			pthread_mutex_lock(&bitmap_build_mutex);
+			ctx->closed = 0;
+			pthread_cond_broadcast(&ctx->cond);
+			break;
+		}
+		clear_prio_queue(&tree_queue);
+
+		if (ent->selected)
+			store_selected(writer, ent, commit);
+
+		pthread_mutex_lock(&bitmap_build_mutex);
+		if (ent->selected)
+			display_progress(writer->progress, ++ctx->nr_stored);
+
+		while ((child = pop_commit(&ent->reverse_edges))) {
+			struct bb_commit *child_ent =
+				bb_data_at(&ctx->bb->data, child);
+
+			if (child_ent->bitmap)
+				bitmap_or(child_ent->bitmap, ent->bitmap);
+			else if (reused)
+				child_ent->bitmap = bitmap_dup(ent->bitmap);
+			else {
+				child_ent->bitmap = ent->bitmap;
+				reused = 1;
+			}
+
+			if (!--child_ent->pending)
+				commit_stack_push(&ctx->ready, child);
+		}
+		if (!reused)
+			bitmap_free(ent->bitmap);
+		ent->bitmap = NULL;
+
+		ctx->remaining--;
+		pthread_cond_broadcast(&ctx->cond);
+	}
+	pthread_mutex_unlock(&bitmap_build_mutex);
+
+	clear_prio_queue(&queue);
+	clear_prio_queue(&tree_queue);
+	return NULL;
+}
+
+/*
+ * Build the bitmaps of all commits in "bb" using writer->nr_threads
+ * threads. A commit is handed to a thread as soon as all of the commits
+ * whose bitmaps it inherits (those which list it in their
+ * reverse_edges) have been built; since each bitmap ends up holding
+ * exactly the objects reachable from its commit, the result does not
+ * depend on the order in which the commits are built.
+ */
+static int build_bitmaps_parallel(struct bitmap_writer *writer,
+				  struct bitmap_builder *bb,
+				  struct bitmap_index *old_bitmap,
+				  const uint32_t *mapping)
+{
+	struct bitmap_build_context ctx = {
+		.writer = writer,
+		.bb = bb,
+		.old_bitmap = old_bitmap,
+		.mapping = mapping,
+		.remaining = bb->commits.nr,
+		.closed = 1,
+	};
+	pthread_t *threads;
+	size_t i;
+
+	for (i = 0; i < bb->commits.nr; i++) {
+		struct bb_commit *ent = bb_data_at(&bb->data,
+						   bb->commits.items[i]);
+		struct commit_list *p;
+
+		for (p = ent->reverse_edges; p; p = p->next)
+			bb_data_at(&bb->data, p->item)->pending++;
+	}
+
+	/*
+	 * Popping from the stack then starts, like the serial builder,
+	 * with the last commits of bb->commits.
+	 */
+	commit_stack_init(&ctx.ready);
+	for (i = 0; i < bb->commits.nr; i++) {
+		struct commit *commit = bb->commits.items[i];
+
+		if (!bb_data_at(&bb->data, commit)->pending)
+			commit_stack_push(&ctx.ready, commit);
+	}
+
+	pthread_mutex_init(&bitmap_build_mutex, NULL);
+	pthread_cond_init(&ctx.cond, NULL);
+	bitmap_build_use_lock = 1;
+	enable_obj_read_lock();
+
+	CALLOC_ARRAY(threads, writer->nr_threads);
+	for (i = 0; i < writer->nr_threads; i++) {
+		int err = pthread_create(&threads[i], NULL,
+					 build_bitmaps_thread, &ctx);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	for (i = 0; i < writer->nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	disable_obj_read_lock();
+	bitmap_build_use_lock = 0;
+	pthread_cond_destroy(&ctx.cond);
+	pthread_mutex_destroy(&bitmap_build_mutex);
+	commit_stack_clear(&ctx.ready);
+
+	trace2_data_intmax("pack-bitmap-write", writer->repo,
+			   "building_bitmaps_threads", writer->nr_threads);
+
+	return ctx.closed ? 0 : -1;
+}
+
 int bitmap_writer_build(struct bitmap_writer *writer)
 {
 	struct bitmap_builder bb;
@@ -626,40 +846,46 @@ int bitmap_writer_build(struct bitmap_writer *writer)
 		mapping = NULL;
 
 	bitmap_builder_init(&bb, writer, old_bitmap);
-	for (i = bb.commits.nr; i > 0; i--) {
-		struct commit *commit = bb.commits.items[i-1];
-		struct bb_commit *ent = bb_data_at(&bb.data, commit);
-		struct commit *child;
-		int reused = 0;
-
-		if (fill_bitmap_commit(writer, ent, commit, &queue, &tree_queue,
-				       old_bitmap, mapping) < 0) {
+	if (writer->nr_threads > 1 && bb.commits.nr > 1) {
+		if (build_bitmaps_parallel(writer, &bb, old_bitmap, mapping) < 0)
 			closed = 0;
-			break;
-		}
-
-		if (ent->selected) {
-			store_selected(writer, ent, commit);
-			nr_stored++;
-			display_progress(writer->progress, nr_stored);
-		}
+	} else {
+		for (i = bb.commits.nr; i > 0; i--) {
+			struct commit *commit = bb.commits.items[i-1];
+			struct bb_commit *ent = bb_data_at(&bb.data, commit);
+			struct commit *child;
+			int reused = 0;
+
+			if (fill_bitmap_commit(writer, ent, commit, &queue,
+					       &tree_queue, old_bitmap,
+					       mapping) < 0) {
+				closed = 0;
+				break;
+			}
 
-		while ((child = pop_commit(&ent->reverse_edges))) {
-			struct bb_commit *child_ent =
-				bb_data_at(&bb.data, child);
+			if (ent->selected) {
+				store_selected(writer, ent, commit);
+				nr_stored++;
+				display_progress(writer->progress, nr_stored);
+			}
 
-			if (child_ent->bitmap)
-				bitmap_or(child_ent->bitmap, ent->bitmap);
-			else if (reused)
-				child_ent->bitmap = bitmap_dup(ent->bitmap);
-			else {
-				child_ent->bitmap = ent->bitmap;
-				reused = 1;
+			while ((child = pop_commit(&ent->reverse_edges))) {
+				struct bb_commit *child_ent =
+					bb_data_at(&bb.data, child);
+
+				if (child_ent->bitmap)
+					bitmap_or(child_ent->bitmap, ent->bitmap);
+				else if (reused)
+					child_ent->bitmap = bitmap_dup(ent->bitmap);
+				else {
+					child_ent->bitmap = ent->bitmap;
+					reused = 1;
+				}
 			}
+			if (!reused)
+				bitmap_free(ent->bitmap);
+			ent->bitmap = NULL;
 		}
-		if (!reused)
-			bitmap_free(ent->bitmap);
-		ent->bitmap = NULL;
 	}
 	clear_prio_queue(&queue);
 	clear_prio_queue(&tree_queue);
@@ -2,6 +2,7 @@
 
 #include "git-compat-util.h"
 #include "commit.h"
+#include "commit-reach.h"
 #include "gettext.h"
 #include "hex.h"
 #include "strbuf.h"
@@ -2657,6 +2658,102 @@ void count_bitmap_commit_list(struct bitmap_index *bitmap_git,
 		*tags = count_object_type(bitmap_git, OBJ_TAG);
 }
 
+static uint32_t count_commits_and_not(struct bitmap_index *bitmap_git,
+				      struct bitmap *self, struct bitmap *other)
+{
+	uint32_t i = 0, count = 0;
+	struct ewah_or_iterator it;
+	eword_t filter;
+
+	init_type_iterator(&it, bitmap_git, OBJ_COMMIT);
+
+	while (i < self->word_alloc && ewah_or_iterator_next(&filter, &it)) {
+		eword_t word = self->words[i] & filter;
+		if (i < other->word_alloc)
+			word &= ~other->words[i];
+		count += ewah_bit_popcount64(word);
+		i++;
+	}
+
+	ewah_or_iterator_release(&it);
+
+	return count;
+}
+
+static struct bitmap *ahead_behind_bitmap(struct bitmap_index *bitmap_git,
+					  struct commit *commit)
+{
+	struct ewah_bitmap *ewah = bitmap_for_commit(bitmap_git, commit);
+
+	if (!ewah)
+		return NULL;
+	return ewah_to_bitmap(ewah);
+}
+
+int bitmap_ahead_behind(struct repository *r,
+			struct commit **commits, size_t commits_nr,
+			struct ahead_behind_count *counts, size_t counts_nr,
+			struct bitmap *done)
+{
+	struct bitmap_index *bitmap_git;
+	struct bitmap **expanded;
+	unsigned char *is_base;
+	int nr = 0;
+
+	bitmap_git = prepare_bitmap_git(r);
+	if (!bitmap_git)
+		return -1;
+
+	CALLOC_ARRAY(expanded, commits_nr);
+	CALLOC_ARRAY(is_base, commits_nr);
+	for (size_t i = 0; i < counts_nr; i++)
+		is_base[counts[i].base_index] = 1;
+
+	for (size_t i = 0; i < counts_nr; i++) {
+		struct ahead_behind_count *count = &counts[i];
+		struct bitmap *tip, *base;
+
+		/*
+		 * Bases are typically shared by many tips, so keep their
+		 * expanded bitmaps around; tips are dropped as soon as they
+		 * have been counted to bound memory with many branches.
+		 */
+		if (!expanded[count->base_index])
+			expanded[count->base_index] =
+				ahead_behind_bitmap(bitmap_git,
+						    commits[count->base_index]);
+		base = expanded[count->base_index];
+		if (!base)
+			continue;
+
+		tip = expanded[count->tip_index];
+		if (!tip) {
+			tip = ahead_behind_bitmap(bitmap_git,
+						  commits[count->tip_index]);
+			if (!tip)
+				continue;
+			if (is_base[count->tip_index])
+				expanded[count->tip_index] = tip;
+		}
+
+		count->ahead = count_commits_and_not(bitmap_git, tip, base);
+		count->behind = count_commits_and_not(bitmap_git, base, tip);
+		bitmap_set(done, i);
+		nr++;
+
+		if (tip != expanded[count->tip_index])
+			bitmap_free(tip);
+	}
+
+	for (size_t i = 0; i < commits_nr; i++)
+		bitmap_free(expanded[i]);
+	free(expanded);
+	free(is_base);
+	free_bitmap_index(bitmap_git);
+
+	return nr;
+}
+
 struct bitmap_test_data {
 	struct bitmap_index *bitmap_git;
 	struct bitmap *base;
@@ -115,6 +115,23 @@ void free_bitmap_index(struct bitmap_index *);
 int bitmap_walk_contains(struct bitmap_index *,
 			 struct bitmap *bitmap, const struct object_id *oid);
 
+struct ahead_behind_count;
+
+/*
+ * Compute the ahead/behind counts for every entry of `counts` whose tip and
+ * base commits both have a stored reachability bitmap, by counting the
+ * commits set in one bitmap but not in the other. The index of each entry
+ * filled in this way is set in `done`; the others are left untouched for the
+ * caller to compute with a commit walk.
+ *
+ * Returns the number of entries filled in, or -1 if the repository has no
+ * bitmap index.
+ */
+int bitmap_ahead_behind(struct repository *r,
+			struct commit **commits, size_t commits_nr,
+			struct ahead_behind_count *counts, size_t counts_nr,
+			struct bitmap *done);
+
 /*
  * After a traversal has been performed by prepare_bitmap_walk(), this can be
  * queried to see if a particular object was reachable from any of the
@@ -144,6 +161,7 @@ struct bitmap_writer {
 
 	struct progress *progress;
 	int show_progress;
+	int nr_threads;
 	unsigned char pack_checksum[GIT_MAX_RAWSZ];
 };
 
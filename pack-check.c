@@ -9,6 +9,7 @@
 #include "packfile.h"
 #include "object-file.h"
 #include "odb.h"
+#include "thread-utils.h"
 
 struct idx_entry {
 	off_t                offset;
@@ -34,7 +35,16 @@ int check_pack_crc(struct packed_git *p, struct pack_window **w_curs,
 
 	do {
 		unsigned long avail;
-		void *data = use_pack(p, w_curs, offset, &avail);
+		void *data;
+
+		/*
+		 * Only mapping the window needs the lock; it stays mapped
+		 * while "w_curs" uses it, so the CRC can be computed
+		 * without holding up other threads.
+		 */
+		obj_read_lock();
+		data = use_pack(p, w_curs, offset, &avail);
+		obj_read_unlock();
 		if (avail > len)
 			avail = len;
 		data_crc = crc32(data_crc, data, avail);
@@ -48,11 +58,313 @@ int check_pack_crc(struct packed_git *p, struct pack_window **w_curs,
 	return data_crc != ntohl(*index_crc);
 }
 
+/*
+ * The outcome of checking one packed object, filled in by check_entry()
+ * and turned into error messages and callbacks by report_entry().
+ */
+struct verify_result {
+	struct object_id oid;
+	off_t offset;
+	void *data;
+	enum object_type type;
+	unsigned long size;
+	unsigned crc_mismatch:1,
+		 unpack_failed:1,
+		 corrupt:1,
+		 stream:1;
+};
+
+/*
+ * Check the CRC of the i-th entry (in pack order), inflate it and
+ * verify its object name. This only touches pack data and buffers
+ * private to the caller, so it can run in several threads at once as
+ * long as the object read lock is enabled.
+ */
+static void check_entry(struct repository *r, struct packed_git *p,
+			struct pack_window **w_curs,
+			const struct idx_entry *entries, uint32_t i,
+			struct verify_result *res)
+{
+	off_t curpos;
+
+	memset(res, 0, sizeof(*res));
+	res->offset = entries[i].offset;
+
+	if (nth_packed_object_id(&res->oid, p, entries[i].nr) < 0)
+		BUG("unable to get oid of object %lu from %s",
+		    (unsigned long)entries[i].nr, p->pack_name);
+
+	if (p->index_version > 1) {
+		off_t len = entries[i+1].offset - res->offset;
+		if (check_pack_crc(p, w_curs, res->offset, len, entries[i].nr))
+			res->crc_mismatch = 1;
+	}
+
+	obj_read_lock();
+	curpos = res->offset;
+	res->type = unpack_object_header(p, w_curs, &curpos, &res->size);
+	unuse_pack(w_curs);
+
+	if (res->type == OBJ_BLOB &&
+	    repo_settings_get_big_file_threshold(r) <= res->size) {
+		/*
+		 * Let stream_object_signature() check it with
+		 * the streaming interface; no point slurping
+		 * the data in-core only to discard.
+		 */
+		res->stream = 1;
+		obj_read_unlock();
+		return;
+	}
+
+	res->data = unpack_entry(r, p, res->offset, &res->type, &res->size);
+	obj_read_unlock();
+
+	if (!res->data)
+		res->unpack_failed = 1;
+	else if (check_object_signature(r, &res->oid, res->data, res->size,
+					res->type) < 0)
+		res->corrupt = 1;
+}
+
+static int report_entry(struct repository *r, struct packed_git *p,
+			struct verify_result *res, verify_fn fn)
+{
+	int err = 0;
+
+	if (res->crc_mismatch)
+		err = error("index CRC mismatch for object %s "
+			    "from %s at offset %"PRIuMAX"",
+			    oid_to_hex(&res->oid),
+			    p->pack_name, (uintmax_t)res->offset);
+
+	if (res->stream) {
+		int ret;
+
+		obj_read_lock();
+		ret = stream_object_signature(r, &res->oid);
+		obj_read_unlock();
+		if (ret < 0)
+			res->corrupt = 1;
+	}
+
+	if (res->unpack_failed)
+		err = error("cannot unpack %s from %s at offset %"PRIuMAX"",
+			    oid_to_hex(&res->oid), p->pack_name,
+			    (uintmax_t)res->offset);
+	else if (res->corrupt)
+		err = error("packed %s from %s is corrupt",
+			    oid_to_hex(&res->oid), p->pack_name);
+	else if (fn) {
+		int eaten = 0;
+		obj_read_lock();
+		err |= fn(&res->oid, res->type, res->size, res->data, &eaten);
+		obj_read_unlock();
+		if (eaten)
+			res->data = NULL;
+	}
+	FREE_AND_NULL(res->data);
+
+	return err;
+}
+
+/*
+ * Number of objects each thread may have checked but not yet reported.
+ * The memory held by inflated objects that are waiting for their turn
+ * to be passed to the callback is bounded separately, see
+ * reserve_entry_memory().
+ */
+#define VERIFY_WINDOW_PER_THREAD 16
+
+struct verify_pool {
+	struct repository *r;
+	struct packed_git *p;
+	const struct idx_entry *entries;
+	uint32_t nr_objects;
+
+	struct verify_result *results;
+	unsigned char *ready;
+	uint32_t window;
+
+	/* bytes of inflated objects that may be in flight at once */
+	unsigned long memory_limit;
+	unsigned long memory_used;
+	unsigned long *memory; /* reserved for each slot */
+
+	/* next entry to be claimed by a worker */
+	uint32_t next;
+	/* entries below this one have been reported */
+	uint32_t reported;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t ready_cond;
+};
+
+/*
+ * Return how much memory checking the i-th entry will keep around until
+ * it is reported, i.e. the size of the inflated object, or 0 if it will
+ * be streamed.
+ */
+static unsigned long entry_memory(struct verify_pool *pool,
+				  struct pack_window **w_curs, uint32_t i)
+{
+	off_t curpos = pool->entries[i].offset;
+	enum object_type type;
+	unsigned long size;
+
+	obj_read_lock();
+	type = unpack_object_header(pool->p, w_curs, &curpos, &size);
+	unuse_pack(w_curs);
+	if (type == OBJ_OFS_DELTA || type == OBJ_REF_DELTA) {
+		struct object_info oi = OBJECT_INFO_INIT;
+
+		oi.sizep = &size;
+		if (packed_object_info(pool->p, pool->entries[i].offset, &oi) < 0)
+			size = 0;
+	}
+	obj_read_unlock();
+
+	if (type == OBJ_BLOB && size >= pool->memory_limit)
+		return 0;
+	return size;
+}
+
+/*
+ * Wait until "size" more bytes fit into the memory limit, and reserve
+ * them for the i-th entry. The entry that is to be reported next never
+ * waits: that is how an object larger than the limit gets through, and
+ * it keeps the main thread from waiting forever.
+ */
+static void reserve_entry_memory(struct verify_pool *pool, uint32_t i,
+				 unsigned long size)
+{
+	while (i != pool->reported &&
+	       pool->memory_used + size > pool->memory_limit)
+		pthread_cond_wait(&pool->work_cond, &pool->mutex);
+	pool->memory_used += size;
+	pool->memory[i % pool->window] = size;
+}
+
+static void *verify_worker(void *data)
+{
+	struct verify_pool *pool = data;
+	struct pack_window *w_curs = NULL;
+
+	pthread_mutex_lock(&pool->mutex);
+	while (pool->next < pool->nr_objects) {
+		uint32_t i = pool->next;
+		uint32_t slot = i % pool->window;
+		unsigned long size;
+
+		if (i >= pool->reported + pool->window) {
+			pthread_cond_wait(&pool->work_cond, &pool->mutex);
+			continue;
+		}
+		pool->next++;
+		pthread_mutex_unlock(&pool->mutex);
+
+		size = entry_memory(pool, &w_curs, i);
+		pthread_mutex_lock(&pool->mutex);
+		reserve_entry_memory(pool, i, size);
+		pthread_mutex_unlock(&pool->mutex);
+
+		check_entry(pool->r, pool->p, &w_curs, pool->entries, i,
+			    &pool->results[slot]);
+
+		pthread_mutex_lock(&pool->mutex);
+		pool->ready[slot] = 1;
+		pthread_cond_broadcast(&pool->ready_cond);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	obj_read_lock();
+	unuse_pack(&w_curs);
+	obj_read_unlock();
+	return NULL;
+}
+
+/*
+ * Check the objects of the pack with "nr_threads" workers. The results
+ * are still reported, and "fn" called, in pack order from the calling
+ * thread, so the output does not depend on the number of threads.
+ */
+static int verify_entries_parallel(struct repository *r, struct packed_git *p,
+				   const struct idx_entry *entries,
+				   uint32_t nr_objects, verify_fn fn,
+				   struct progress *progress,
+				   uint32_t base_count, int nr_threads)
+{
+	struct verify_pool pool = {
+		.r = r,
+		.p = p,
+		.entries = entries,
+		.nr_objects = nr_objects,
+	};
+	pthread_t *threads;
+	uint32_t i;
+	int err = 0;
+
+	if ((uint32_t)nr_threads > nr_objects)
+		nr_threads = nr_objects;
+	pool.window = nr_threads * VERIFY_WINDOW_PER_THREAD;
+	CALLOC_ARRAY(pool.results, pool.window);
+	CALLOC_ARRAY(pool.ready, pool.window);
+	CALLOC_ARRAY(pool.memory, pool.window);
+	pool.memory_limit = repo_settings_get_big_file_threshold(r);
+	pthread_mutex_init(&pool.mutex, NULL);
+	pthread_cond_init(&pool.work_cond, NULL);
+	pthread_cond_init(&pool.ready_cond, NULL);
+
+	enable_obj_read_lock();
+	ALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		int ret = pthread_create(&threads[i], NULL, verify_worker, &pool);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+
+	for (i = 0; i < nr_objects; i++) {
+		uint32_t slot = i % pool.window;
+
+		pthread_mutex_lock(&pool.mutex);
+		while (!pool.ready[slot])
+			pthread_cond_wait(&pool.ready_cond, &pool.mutex);
+		pool.ready[slot] = 0;
+		pthread_mutex_unlock(&pool.mutex);
+
+		err |= report_entry(r, p, &pool.results[slot], fn);
+		if (((base_count + i) & 1023) == 0)
+			display_progress(progress, base_count + i);
+
+		pthread_mutex_lock(&pool.mutex);
+		pool.reported = i + 1;
+		pool.memory_used -= pool.memory[slot];
+		pthread_cond_broadcast(&pool.work_cond);
+		pthread_mutex_unlock(&pool.mutex);
+	}
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	disable_obj_read_lock();
+
+	free(threads);
+	pthread_cond_destroy(&pool.ready_cond);
+	pthread_cond_destroy(&pool.work_cond);
+	pthread_mutex_destroy(&pool.mutex);
+	free(pool.memory);
+	free(pool.ready);
+	free(pool.results);
+
+	return err;
+}
+
 static int verify_packfile(struct repository *r,
 			   struct packed_git *p,
 			   struct pack_window **w_curs,
 			   verify_fn fn,
-			   struct progress *progress, uint32_t base_count)
+			   struct progress *progress, uint32_t base_count,
+			   int nr_threads)
 
 {
 	off_t index_size = p->index_size;
@@ -103,69 +415,19 @@ static int verify_packfile(struct repository *r,
 	}
 	QSORT(entries, nr_objects, compare_entries);
 
-	for (i = 0; i < nr_objects; i++) {
-		void *data;
-		struct object_id oid;
-		enum object_type type;
-		unsigned long size;
-		off_t curpos;
-		int data_valid;
-
-		if (nth_packed_object_id(&oid, p, entries[i].nr) < 0)
-			BUG("unable to get oid of object %lu from %s",
-			    (unsigned long)entries[i].nr, p->pack_name);
-
-		if (p->index_version > 1) {
-			off_t offset = entries[i].offset;
-			off_t len = entries[i+1].offset - offset;
-			unsigned int nr = entries[i].nr;
-			if (check_pack_crc(p, w_curs, offset, len, nr))
-				err = error("index CRC mismatch for object %s "
-					    "from %s at offset %"PRIuMAX"",
-					    oid_to_hex(&oid),
-					    p->pack_name, (uintmax_t)offset);
-		}
+	if (nr_threads > 1 && nr_objects > 1)
+		err |= verify_entries_parallel(r, p, entries, nr_objects, fn,
+					       progress, base_count, nr_threads);
+	else
+		for (i = 0; i < nr_objects; i++) {
+			struct verify_result res;
 
-		curpos = entries[i].offset;
-		type = unpack_object_header(p, w_curs, &curpos, &size);
-		unuse_pack(w_curs);
-
-		if (type == OBJ_BLOB &&
-		    repo_settings_get_big_file_threshold(r) <= size) {
-			/*
-			 * Let stream_object_signature() check it with
-			 * the streaming interface; no point slurping
-			 * the data in-core only to discard.
-			 */
-			data = NULL;
-			data_valid = 0;
-		} else {
-			data = unpack_entry(r, p, entries[i].offset, &type, &size);
-			data_valid = 1;
+			check_entry(r, p, w_curs, entries, i, &res);
+			err |= report_entry(r, p, &res, fn);
+			if (((base_count + i) & 1023) == 0)
+				display_progress(progress, base_count + i);
 		}
-
-		if (data_valid && !data)
-			err = error("cannot unpack %s from %s at offset %"PRIuMAX"",
-				    oid_to_hex(&oid), p->pack_name,
-				    (uintmax_t)entries[i].offset);
-		else if (data && check_object_signature(r, &oid, data, size,
-							type) < 0)
-			err = error("packed %s from %s is corrupt",
-				    oid_to_hex(&oid), p->pack_name);
-		else if (!data && stream_object_signature(r, &oid) < 0)
-			err = error("packed %s from %s is corrupt",
-				    oid_to_hex(&oid), p->pack_name);
-		else if (fn) {
-			int eaten = 0;
-			err |= fn(&oid, type, size, data, &eaten);
-			if (eaten)
-				data = NULL;
-		}
-		if (((base_count + i) & 1023) == 0)
-			display_progress(progress, base_count + i);
-		free(data);
-
-	}
+	i = nr_objects;
 	display_progress(progress, base_count + i);
 	free(entries);
 
@@ -187,7 +449,7 @@ int verify_pack_index(struct packed_git *p)
 }
 
 int verify_pack(struct repository *r, struct packed_git *p, verify_fn fn,
-		struct progress *progress, uint32_t base_count)
+		struct progress *progress, uint32_t base_count, int nr_threads)
 {
 	int err = 0;
 	struct pack_window *w_curs = NULL;
@@ -196,7 +458,8 @@ int verify_pack(struct repository *r, struct packed_git *p, verify_fn fn,
 	if (!p->index_data)
 		return -1;
 
-	err |= verify_packfile(r, p, &w_curs, fn, progress, base_count);
+	err |= verify_packfile(r, p, &w_curs, fn, progress, base_count,
+			       nr_threads);
 	unuse_pack(&w_curs);
 
 	return err;
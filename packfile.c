@@ -26,6 +26,7 @@
 #include "pack-revindex.h"
 #include "promisor-remote.h"
 #include "pack-mtimes.h"
+#include "trace2.h"
 
 char *odb_pack_name(struct repository *r, struct strbuf *buf,
 		    const unsigned char *hash, const char *ext)
@@ -777,6 +778,37 @@ unsigned char *use_pack(struct packed_git *p,
 	return win->base + offset;
 }
 
+void packfile_prefetch(struct packed_git *p, off_t offset, size_t len)
+{
+	struct pack_window *win;
+
+	if (offset < 0 || offset >= p->pack_size)
+		return;
+	if (len > p->pack_size - offset)
+		len = p->pack_size - offset;
+
+	for (win = p->windows; win; win = win->next)
+		if (in_window(p->repo, win, offset))
+			break;
+
+	if (win) {
+#if !defined(NO_MMAP) && defined(MADV_WILLNEED)
+		size_t page = getpagesize();
+		size_t start = offset - win->offset;
+		size_t end = start + len;
+
+		if (end > win->len)
+			end = win->len;
+		start -= start % page;
+		madvise(win->base + start, end - start, MADV_WILLNEED);
+#endif
+	} else if (p->pack_fd != -1) {
+#ifdef POSIX_FADV_WILLNEED
+		posix_fadvise(p->pack_fd, offset, len, POSIX_FADV_WILLNEED);
+#endif
+	}
+}
+
 void unuse_pack(struct pack_window **w_cursor)
 {
 	struct pack_window *w = *w_cursor;
@@ -854,12 +886,17 @@ struct packed_git *add_packed_git(struct repository *r, const char *path,
 	return p;
 }
 
+static void pack_lookup_table_free(struct pack_lookup_table *table);
+
 void packfile_store_add_pack(struct packfile_store *store,
 			     struct packed_git *pack)
 {
 	if (pack->pack_fd != -1)
 		pack_open_fds++;
 
+	pack_lookup_table_free(store->lookup_table);
+	store->lookup_table = NULL;
+
 	packfile_list_append(&store->packs, pack);
 	strmap_put(&store->packs_by_path, pack->pack_name, pack);
 }
@@ -1418,10 +1455,33 @@ static enum object_type packed_to_object_type(struct repository *r,
 	goto out;
 }
 
-static struct hashmap delta_base_cache;
-static size_t delta_base_cached;
+/*
+ * The delta base cache is split into shards, each with its own hashmap,
+ * LRU list and lock. When the object read lock is enabled, threads
+ * unpacking unrelated objects only contend on the shard that holds the
+ * base they are interested in, and bases can be added to the cache
+ * without holding obj_read_mutex.
+ *
+ * core.deltaBaseCacheLimit applies to all shards together. Entries are
+ * numbered as they are added, and the oldest entry of any shard is
+ * evicted first, so that without threads the cache behaves like a
+ * single LRU list.
+ */
+#define DELTA_BASE_CACHE_SHARDS 16
 
-static LIST_HEAD(delta_base_cache_lru);
+struct delta_base_cache_shard {
+	struct hashmap map;
+	struct list_head lru;
+	pthread_mutex_t mutex;
+};
+
+static struct delta_base_cache_shard delta_base_cache[DELTA_BASE_CACHE_SHARDS];
+static int delta_base_cache_use_lock;
+
+/* protected by delta_base_cache_total_mutex */
+static size_t delta_base_cached;
+static uint64_t delta_base_cache_seq;
+static pthread_mutex_t delta_base_cache_total_mutex;
 
 struct delta_base_cache_key {
 	struct packed_git *p;
@@ -1435,6 +1495,7 @@ struct delta_base_cache_entry {
 	void *data;
 	unsigned long size;
 	enum object_type type;
+	uint64_t seq;
 };
 
 static unsigned int pack_entry_hash(struct packed_git *p, off_t base_offset)
@@ -1446,22 +1507,6 @@ static unsigned int pack_entry_hash(struct packed_git *p, off_t base_offset)
 	return hash;
 }
 
-static struct delta_base_cache_entry *
-get_delta_base_cache_entry(struct packed_git *p, off_t base_offset)
-{
-	struct hashmap_entry entry, *e;
-	struct delta_base_cache_key key;
-
-	if (!delta_base_cache.cmpfn)
-		return NULL;
-
-	hashmap_entry_init(&entry, pack_entry_hash(p, base_offset));
-	key.p = p;
-	key.base_offset = base_offset;
-	e = hashmap_get(&delta_base_cache, &entry, &key);
-	return e ? container_of(e, struct delta_base_cache_entry, ent) : NULL;
-}
-
 static int delta_base_cache_key_eq(const struct delta_base_cache_key *a,
 				   const struct delta_base_cache_key *b)
 {
@@ -1485,83 +1530,281 @@ static int delta_base_cache_hash_cmp(const void *cmp_data UNUSED,
 		return !delta_base_cache_key_eq(&a->key, &b->key);
 }
 
-static int in_delta_base_cache(struct packed_git *p, off_t base_offset)
+static void delta_base_cache_shard_init(struct delta_base_cache_shard *shard)
+{
+	if (shard->map.cmpfn)
+		return;
+	hashmap_init(&shard->map, delta_base_cache_hash_cmp, NULL, 0);
+	INIT_LIST_HEAD(&shard->lru);
+}
+
+/*
+ * Pick the shard for the given key and fill in "entry" with the hash
+ * to use within that shard. The low bits of the hash select the shard,
+ * so they are shifted out of the per-shard hash to keep the shard's
+ * hashmap buckets evenly used.
+ */
+static struct delta_base_cache_shard *
+delta_base_cache_shard_for(struct packed_git *p, off_t base_offset,
+			   struct hashmap_entry *entry)
+{
+	unsigned int hash = pack_entry_hash(p, base_offset);
+
+	hashmap_entry_init(entry, hash / DELTA_BASE_CACHE_SHARDS);
+	return &delta_base_cache[hash % DELTA_BASE_CACHE_SHARDS];
+}
+
+static inline void delta_base_cache_lock(struct delta_base_cache_shard *shard)
 {
-	return !!get_delta_base_cache_entry(p, base_offset);
+	if (delta_base_cache_use_lock)
+		pthread_mutex_lock(&shard->mutex);
+}
+
+static inline void delta_base_cache_unlock(struct delta_base_cache_shard *shard)
+{
+	if (delta_base_cache_use_lock)
+		pthread_mutex_unlock(&shard->mutex);
+}
+
+void enable_delta_base_cache_lock(void)
+{
+	if (delta_base_cache_use_lock)
+		return;
+
+	for (size_t i = 0; i < DELTA_BASE_CACHE_SHARDS; i++)
+		pthread_mutex_init(&delta_base_cache[i].mutex, NULL);
+	pthread_mutex_init(&delta_base_cache_total_mutex, NULL);
+	delta_base_cache_use_lock = 1;
+}
+
+void disable_delta_base_cache_lock(void)
+{
+	if (!delta_base_cache_use_lock)
+		return;
+
+	delta_base_cache_use_lock = 0;
+	for (size_t i = 0; i < DELTA_BASE_CACHE_SHARDS; i++)
+		pthread_mutex_destroy(&delta_base_cache[i].mutex);
+	pthread_mutex_destroy(&delta_base_cache_total_mutex);
+}
+
+static inline void delta_base_cache_total_lock(void)
+{
+	if (delta_base_cache_use_lock)
+		pthread_mutex_lock(&delta_base_cache_total_mutex);
+}
+
+static inline void delta_base_cache_total_unlock(void)
+{
+	if (delta_base_cache_use_lock)
+		pthread_mutex_unlock(&delta_base_cache_total_mutex);
+}
+
+/*
+ * The caller must hold the shard's lock.
+ */
+static struct delta_base_cache_entry *
+get_delta_base_cache_entry(struct delta_base_cache_shard *shard,
+			   struct hashmap_entry *entry,
+			   struct packed_git *p, off_t base_offset)
+{
+	struct hashmap_entry *e;
+	struct delta_base_cache_key key;
+
+	if (!shard->map.cmpfn)
+		return NULL;
+
+	key.p = p;
+	key.base_offset = base_offset;
+	e = hashmap_get(&shard->map, entry, &key);
+	return e ? container_of(e, struct delta_base_cache_entry, ent) : NULL;
 }
 
 /*
  * Remove the entry from the cache, but do _not_ free the associated
  * entry data. The caller takes ownership of the "data" buffer, and
- * should copy out any fields it wants before detaching.
+ * should copy out any fields it wants before detaching. The caller must
+ * hold the shard's lock.
  */
-static void detach_delta_base_cache_entry(struct delta_base_cache_entry *ent)
+static void detach_delta_base_cache_entry(struct delta_base_cache_shard *shard,
+					  struct delta_base_cache_entry *ent)
 {
-	hashmap_remove(&delta_base_cache, &ent->ent, &ent->key);
+	hashmap_remove(&shard->map, &ent->ent, &ent->key);
 	list_del(&ent->lru);
+	delta_base_cache_total_lock();
 	delta_base_cached -= ent->size;
+	delta_base_cache_total_unlock();
 	free(ent);
 }
 
+/*
+ * Look up the given base in the cache and, if found, remove it from the
+ * cache, handing ownership of its data to the caller. Returns 1 if the
+ * base was found, 0 otherwise.
+ */
+static int take_delta_base_cache_entry(struct packed_git *p, off_t base_offset,
+				       void **data, unsigned long *size,
+				       enum object_type *type)
+{
+	struct delta_base_cache_shard *shard;
+	struct delta_base_cache_entry *ent;
+	struct hashmap_entry entry;
+
+	shard = delta_base_cache_shard_for(p, base_offset, &entry);
+	delta_base_cache_lock(shard);
+	ent = get_delta_base_cache_entry(shard, &entry, p, base_offset);
+	if (ent) {
+		*type = ent->type;
+		*data = ent->data;
+		*size = ent->size;
+		detach_delta_base_cache_entry(shard, ent);
+	}
+	delta_base_cache_unlock(shard);
+
+	return !!ent;
+}
+
 static void *cache_or_unpack_entry(struct repository *r, struct packed_git *p,
 				   off_t base_offset, unsigned long *base_size,
 				   enum object_type *type)
 {
+	struct delta_base_cache_shard *shard;
 	struct delta_base_cache_entry *ent;
+	struct hashmap_entry entry;
+	void *data = NULL;
+
+	shard = delta_base_cache_shard_for(p, base_offset, &entry);
+	delta_base_cache_lock(shard);
+	ent = get_delta_base_cache_entry(shard, &entry, p, base_offset);
+	if (ent) {
+		if (type)
+			*type = ent->type;
+		if (base_size)
+			*base_size = ent->size;
+		data = xmemdupz(ent->data, ent->size);
+	}
+	delta_base_cache_unlock(shard);
 
-	ent = get_delta_base_cache_entry(p, base_offset);
 	if (!ent)
 		return unpack_entry(r, p, base_offset, type, base_size);
-
-	if (type)
-		*type = ent->type;
-	if (base_size)
-		*base_size = ent->size;
-	return xmemdupz(ent->data, ent->size);
+	return data;
 }
 
-static inline void release_delta_base_cache(struct delta_base_cache_entry *ent)
+static inline void release_delta_base_cache(struct delta_base_cache_shard *shard,
+					    struct delta_base_cache_entry *ent)
 {
 	free(ent->data);
-	detach_delta_base_cache_entry(ent);
+	detach_delta_base_cache_entry(shard, ent);
 }
 
 void clear_delta_base_cache(void)
 {
-	struct list_head *lru, *tmp;
-	list_for_each_safe(lru, tmp, &delta_base_cache_lru) {
-		struct delta_base_cache_entry *entry =
-			list_entry(lru, struct delta_base_cache_entry, lru);
-		release_delta_base_cache(entry);
+	for (size_t i = 0; i < DELTA_BASE_CACHE_SHARDS; i++) {
+		struct delta_base_cache_shard *shard = &delta_base_cache[i];
+		struct list_head *lru, *tmp;
+
+		if (!shard->map.cmpfn)
+			continue;
+
+		delta_base_cache_lock(shard);
+		list_for_each_safe(lru, tmp, &shard->lru) {
+			struct delta_base_cache_entry *entry =
+				list_entry(lru, struct delta_base_cache_entry, lru);
+			release_delta_base_cache(shard, entry);
+		}
+		delta_base_cache_unlock(shard);
+	}
+}
+
+/*
+ * Evict the least recently added entry of all shards. Only one shard's
+ * lock is held at a time, so this may be called from any thread that
+ * holds none. Returns 0 if the cache is empty.
+ */
+static int release_oldest_delta_base_cache(void)
+{
+	struct delta_base_cache_shard *oldest = NULL;
+	uint64_t oldest_seq = 0;
+
+	for (size_t i = 0; i < DELTA_BASE_CACHE_SHARDS; i++) {
+		struct delta_base_cache_shard *shard = &delta_base_cache[i];
+
+		delta_base_cache_lock(shard);
+		if (shard->map.cmpfn && !list_empty(&shard->lru)) {
+			struct delta_base_cache_entry *f =
+				list_entry(shard->lru.next,
+					   struct delta_base_cache_entry, lru);
+			if (!oldest || f->seq < oldest_seq) {
+				oldest = shard;
+				oldest_seq = f->seq;
+			}
+		}
+		delta_base_cache_unlock(shard);
 	}
+	if (!oldest)
+		return 0;
+
+	/* another thread may have changed it meanwhile; that is fine */
+	delta_base_cache_lock(oldest);
+	if (!list_empty(&oldest->lru))
+		release_delta_base_cache(oldest,
+					 list_entry(oldest->lru.next,
+						    struct delta_base_cache_entry,
+						    lru));
+	delta_base_cache_unlock(oldest);
+	return 1;
 }
 
+static int delta_base_cache_has_room(size_t size, size_t limit)
+{
+	int ret;
+
+	delta_base_cache_total_lock();
+	ret = delta_base_cached + size <= limit;
+	delta_base_cache_total_unlock();
+	return ret;
+}
+
+/*
+ * Take ownership of "base" and add it to the cache. Unlike the other
+ * cache functions, this may be called without holding obj_read_mutex.
+ */
 static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 				 void *base, unsigned long base_size,
 				 unsigned long delta_base_cache_limit,
 				 enum object_type type)
 {
+	struct delta_base_cache_shard *shard;
 	struct delta_base_cache_entry *ent;
-	struct list_head *lru, *tmp;
+	struct hashmap_entry entry;
+
+	shard = delta_base_cache_shard_for(p, base_offset, &entry);
 
 	/*
 	 * Check required to avoid redundant entries when more than one thread
 	 * is unpacking the same object, in unpack_entry() (since its phases I
-	 * and III might run concurrently across multiple threads).
+	 * and III might run concurrently across multiple threads). It is
+	 * repeated below, because we do not hold the shard's lock while
+	 * making room.
 	 */
-	if (in_delta_base_cache(p, base_offset)) {
+	delta_base_cache_lock(shard);
+	delta_base_cache_shard_init(shard);
+	ent = get_delta_base_cache_entry(shard, &entry, p, base_offset);
+	delta_base_cache_unlock(shard);
+	if (ent) {
 		free(base);
 		return;
 	}
 
-	delta_base_cached += base_size;
+	while (!delta_base_cache_has_room(base_size, delta_base_cache_limit) &&
+	       release_oldest_delta_base_cache())
+		; /* evict until the new base fits */
 
-	list_for_each_safe(lru, tmp, &delta_base_cache_lru) {
-		struct delta_base_cache_entry *f =
-			list_entry(lru, struct delta_base_cache_entry, lru);
-		if (delta_base_cached <= delta_base_cache_limit)
-			break;
-		release_delta_base_cache(f);
+	delta_base_cache_lock(shard);
+	if (get_delta_base_cache_entry(shard, &entry, p, base_offset)) {
+		delta_base_cache_unlock(shard);
+		free(base);
+		return;
 	}
 
 	ent = xmalloc(sizeof(*ent));
@@ -1570,12 +1813,15 @@ static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 	ent->type = type;
 	ent->data = base;
 	ent->size = base_size;
-	list_add_tail(&ent->lru, &delta_base_cache_lru);
+	delta_base_cache_total_lock();
+	ent->seq = delta_base_cache_seq++;
+	delta_base_cached += base_size;
+	delta_base_cache_total_unlock();
+	list_add_tail(&ent->lru, &shard->lru);
 
-	if (!delta_base_cache.cmpfn)
-		hashmap_init(&delta_base_cache, delta_base_cache_hash_cmp, NULL, 0);
-	hashmap_entry_init(&ent->ent, pack_entry_hash(p, base_offset));
-	hashmap_add(&delta_base_cache, &ent->ent);
+	ent->ent = entry;
+	hashmap_add(&shard->map, &ent->ent);
+	delta_base_cache_unlock(shard);
 }
 
 int packed_object_info(struct packed_git *p,
@@ -1763,14 +2009,8 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 	for (;;) {
 		off_t base_offset;
 		int i;
-		struct delta_base_cache_entry *ent;
-
-		ent = get_delta_base_cache_entry(p, curpos);
-		if (ent) {
-			type = ent->type;
-			data = ent->data;
-			size = ent->size;
-			detach_delta_base_cache_entry(ent);
+
+		if (take_delta_base_cache_entry(p, curpos, &data, &size, &type)) {
 			base_from_cache = 1;
 			break;
 		}
@@ -1907,6 +2147,13 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 
 		delta_data = unpack_compressed_entry(p, &w_curs, curpos, delta_size);
 
+		/*
+		 * From here on we only operate on buffers private to this
+		 * thread, and the delta base cache has its own locking, so
+		 * let other threads read objects while we apply the delta.
+		 */
+		obj_read_unlock();
+
 		if (!delta_data) {
 			error("failed to unpack compressed delta "
 			      "at offset %"PRIuMAX" from %s",
@@ -1944,6 +2191,8 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 
 		free(delta_data);
 		free(external_base);
+
+		obj_read_lock();
 	}
 
 	if (final_type)
@@ -2107,6 +2356,126 @@ static int fill_pack_entry(const struct object_id *oid,
 	return 1;
 }
 
+/*
+ * An open-addressing hash table over all objects in the packs of a
+ * store that are not part of its multi-pack index. Slots are keyed by
+ * the first four bytes of the object ID, which are uniformly
+ * distributed already, and point at the object's position in its pack
+ * index, where the full object ID is verified. This turns a lookup that
+ * would bisect the index of every pack in turn into one probe sequence.
+ *
+ * The same object may be stored in several packs; its slots are then
+ * found in the order in which the packs were listed when the table was
+ * built.
+ */
+struct pack_lookup_slot {
+	uint32_t prefix;
+	uint32_t pack; /* index into "packs" plus one, or 0 if empty */
+	uint32_t pos;
+};
+
+struct pack_lookup_table {
+	struct packed_git **packs;
+	size_t packs_nr;
+	struct pack_lookup_slot *slots;
+	size_t mask;
+};
+
+static void pack_lookup_table_free(struct pack_lookup_table *table)
+{
+	if (!table)
+		return;
+	free(table->packs);
+	free(table->slots);
+	free(table);
+}
+
+static uint32_t pack_lookup_prefix(const unsigned char *hash)
+{
+	return get_be32(hash);
+}
+
+static struct pack_lookup_table *pack_lookup_table_build(struct packfile_store *store)
+{
+	struct pack_lookup_table *table;
+	size_t nr_objects = 0, alloc = 0, size = 16;
+
+	CALLOC_ARRAY(table, 1);
+	for (struct packfile_list_entry *e = store->packs.head; e; e = e->next) {
+		struct packed_git *p = e->pack;
+
+		if (p->multi_pack_index || open_pack_index(p))
+			continue;
+		ALLOC_GROW(table->packs, table->packs_nr + 1, alloc);
+		table->packs[table->packs_nr++] = p;
+		nr_objects = st_add(nr_objects, p->num_objects);
+	}
+
+	/* Keep the load factor at or below 3/4. */
+	while (size / 4 * 3 < nr_objects)
+		size = st_mult(size, 2);
+	CALLOC_ARRAY(table->slots, size);
+	table->mask = size - 1;
+
+	for (size_t i = 0; i < table->packs_nr; i++) {
+		struct packed_git *p = table->packs[i];
+
+		for (uint32_t pos = 0; pos < p->num_objects; pos++) {
+			struct object_id oid;
+			uint32_t prefix;
+			size_t slot;
+
+			if (nth_packed_object_id(&oid, p, pos) < 0)
+				break;
+			prefix = pack_lookup_prefix(oid.hash);
+			for (slot = prefix & table->mask;
+			     table->slots[slot].pack;
+			     slot = (slot + 1) & table->mask)
+				; /* find the next empty slot */
+			table->slots[slot].prefix = prefix;
+			table->slots[slot].pack = i + 1;
+			table->slots[slot].pos = pos;
+		}
+	}
+
+	trace2_data_intmax("packfile", store->source->odb->repo,
+			   "lookup_table/objects", nr_objects);
+	return table;
+}
+
+static int pack_lookup_table_find(struct pack_lookup_table *table,
+				  const struct object_id *oid,
+				  struct pack_entry *e)
+{
+	uint32_t prefix = pack_lookup_prefix(oid->hash);
+	size_t slot;
+
+	for (slot = prefix & table->mask;
+	     table->slots[slot].pack;
+	     slot = (slot + 1) & table->mask) {
+		const struct pack_lookup_slot *s = &table->slots[slot];
+		struct packed_git *p = table->packs[s->pack - 1];
+		struct object_id found;
+
+		if (s->prefix != prefix ||
+		    nth_packed_object_id(&found, p, s->pos) < 0 ||
+		    !oideq(&found, oid))
+			continue;
+
+		if (oidset_size(&p->bad_objects) &&
+		    oidset_contains(&p->bad_objects, oid))
+			continue;
+		if (!is_pack_valid(p))
+			continue;
+
+		e->offset = nth_packed_object_offset(p, s->pos);
+		e->p = p;
+		return 1;
+	}
+
+	return 0;
+}
+
 static int find_pack_entry(struct packfile_store *store,
 			   const struct object_id *oid,
 			   struct pack_entry *e)
@@ -2117,6 +2486,13 @@ static int find_pack_entry(struct packfile_store *store,
 	if (store->midx && fill_midx_entry(store->midx, oid, e))
 		return 1;
 
+	prepare_repo_settings(store->source->odb->repo);
+	if (store->source->odb->repo->settings.pack_lookup_table) {
+		if (!store->lookup_table)
+			store->lookup_table = pack_lookup_table_build(store);
+		return pack_lookup_table_find(store->lookup_table, oid, e);
+	}
+
 	for (l = store->packs.head; l; l = l->next) {
 		struct packed_git *p = l->pack;
 
@@ -2455,6 +2831,7 @@ void packfile_store_free(struct packfile_store *store)
 	for (struct packfile_list_entry *e = store->packs.head; e; e = e->next)
 		free(e->pack);
 	packfile_list_clear(&store->packs);
+	pack_lookup_table_free(store->lookup_table);
 
 	strmap_clear(&store->packs_by_path, 0);
 	free(store);
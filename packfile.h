@@ -12,6 +12,8 @@
 struct object_info;
 struct odb_read_stream;
 
+struct pack_lookup_table;
+
 struct packed_git {
 	struct pack_window *windows;
 	off_t pack_size;
@@ -130,6 +132,15 @@ struct packfile_store {
 	 * Setting this field to `true` thus disables these reorderings.
 	 */
 	bool skip_mru_updates;
+
+	/*
+	 * With `core.packLookupTable`, a hash table mapping object IDs to
+	 * their position in the packs of this store that are not covered
+	 * by the multi-pack index. It is built lazily on the first lookup
+	 * that would otherwise have to search the packs one by one, and
+	 * dropped whenever a pack is added to the store.
+	 */
+	struct pack_lookup_table *lookup_table;
 };
 
 /*
@@ -376,10 +387,27 @@ uint32_t get_pack_fanout(struct packed_git *p, uint32_t value);
 struct object_database;
 
 unsigned char *use_pack(struct packed_git *, struct pack_window **, off_t, unsigned long *);
+
+/*
+ * Ask the operating system to start reading the given byte range of the
+ * pack into memory in the background, so that a later use_pack() on it
+ * does not have to wait for the I/O. This is only a hint: it does
+ * nothing if the pack is not open or the platform does not support
+ * it.
+ */
+void packfile_prefetch(struct packed_git *p, off_t offset, size_t len);
 void close_pack_windows(struct packed_git *);
 void close_pack(struct packed_git *);
 void unuse_pack(struct pack_window **);
 void clear_delta_base_cache(void);
+
+/*
+ * Enable or disable the per-shard locks of the delta base cache. These are
+ * toggled together with the object read lock; see enable_obj_read_lock().
+ */
+void enable_delta_base_cache_lock(void);
+void disable_delta_base_cache_lock(void);
+
 struct packed_git *add_packed_git(struct repository *r, const char *path,
 				  size_t path_len, int local);
 
@@ -7,10 +7,12 @@
 #include "gettext.h"
 #include "hash.h"
 #include "hex.h"
+#include "odb.h"
 #include "parallel-checkout.h"
 #include "pkt-line.h"
 #include "progress.h"
 #include "read-cache-ll.h"
+#include "repository.h"
 #include "run-command.h"
 #include "sigchain.h"
 #include "odb/streaming.h"
@@ -29,6 +31,7 @@ struct parallel_checkout {
 	size_t nr, alloc;
 	struct progress *progress;
 	unsigned int *progress_cnt;
+	unsigned long big_file_threshold; /* used by worker threads */
 };
 
 static struct parallel_checkout parallel_checkout;
@@ -267,7 +270,7 @@ static int reset_fd(int fd, const char *path)
 }
 
 static int write_pc_item_to_fd(struct parallel_checkout_item *pc_item, int fd,
-			       const char *path)
+			       const char *path, int threaded)
 {
 	int ret;
 	struct stream_filter *filter;
@@ -280,9 +283,30 @@ static int write_pc_item_to_fd(struct parallel_checkout_item *pc_item, int fd,
 	ASSERT(is_eligible_for_parallel_checkout(pc_item->ce, &pc_item->ca));
 
 	filter = get_stream_filter_ca(&pc_item->ca, &pc_item->ce->oid);
+	if (filter && threaded) {
+		unsigned long blob_size;
+
+		/*
+		 * Object streaming does not take the object read lock, so
+		 * worker threads only stream the blobs that are too big to
+		 * be held in memory, one at a time, and read the others in
+		 * full.
+		 */
+		if (odb_read_object_info(the_repository->objects,
+					 &pc_item->ce->oid, &blob_size) < 0 ||
+		    blob_size <= parallel_checkout.big_file_threshold) {
+			free_stream_filter(filter);
+			filter = NULL;
+		}
+	}
 	if (filter) {
-		if (odb_stream_blob_to_fd(the_repository->objects, fd,
-					  &pc_item->ce->oid, filter, 1)) {
+		if (threaded)
+			obj_read_lock();
+		ret = odb_stream_blob_to_fd(the_repository->objects, fd,
+					    &pc_item->ce->oid, filter, 1);
+		if (threaded)
+			obj_read_unlock();
+		if (ret) {
 			/* On error, reset fd to try writing without streaming */
 			if (reset_fd(fd, path))
 				return -1;
@@ -332,8 +356,12 @@ static int close_and_clear(int *fd)
 	return ret;
 }
 
-void write_pc_item(struct parallel_checkout_item *pc_item,
-		   struct checkout *state)
+/*
+ * `cache` is the lstat cache of the calling worker thread, or NULL when
+ * called from the main thread or a checkout--worker process.
+ */
+static void write_pc_item_1(struct parallel_checkout_item *pc_item,
+			    struct checkout *state, struct cache_def *cache)
 {
 	unsigned int mode = (pc_item->ce->ce_mode & 0100) ? 0777 : 0666;
 	int fd = -1, fstat_done = 0;
@@ -351,8 +379,12 @@ void write_pc_item(struct parallel_checkout_item *pc_item,
 	 * a symlink (checked out after we enqueued this entry for parallel
 	 * checkout). Thus, we must check the leading dirs again.
 	 */
-	if (dir_sep && !has_dirs_only_path(path.buf, dir_sep - path.buf,
-					   state->base_dir_len)) {
+	if (dir_sep && !(cache ?
+			 threaded_has_dirs_only_path(cache, path.buf,
+						     dir_sep - path.buf,
+						     state->base_dir_len) :
+			 has_dirs_only_path(path.buf, dir_sep - path.buf,
+					    state->base_dir_len))) {
 		pc_item->status = PC_ITEM_COLLIDED;
 		trace2_data_string("pcheckout", NULL, "collision/dirname", path.buf);
 		goto out;
@@ -379,7 +411,7 @@ void write_pc_item(struct parallel_checkout_item *pc_item,
 		goto out;
 	}
 
-	if (write_pc_item_to_fd(pc_item, fd, path.buf)) {
+	if (write_pc_item_to_fd(pc_item, fd, path.buf, !!cache)) {
 		/* Error was already reported. */
 		pc_item->status = PC_ITEM_FAILED;
 		close_and_clear(&fd);
@@ -407,6 +439,12 @@ void write_pc_item(struct parallel_checkout_item *pc_item,
 	strbuf_release(&path);
 }
 
+void write_pc_item(struct parallel_checkout_item *pc_item,
+		   struct checkout *state)
+{
+	write_pc_item_1(pc_item, state, NULL);
+}
+
 static void send_one_item(int fd, struct parallel_checkout_item *pc_item)
 {
 	size_t len_data;
@@ -648,6 +686,107 @@ static void write_items_sequentially(struct checkout *state)
 	}
 }
 
+struct pc_threads {
+	struct checkout *state;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	size_t next_item;	/* next item to be claimed by a thread */
+	size_t nr_done;		/* number of items handled */
+	size_t nr_progress;	/* number of those counted by the progress meter */
+};
+
+static void *checkout_worker_thread(void *data)
+{
+	struct pc_threads *pct = data;
+	struct cache_def cache = CACHE_DEF_INIT;
+
+	trace2_thread_start("pcheckout");
+
+	pthread_mutex_lock(&pct->mutex);
+	while (pct->next_item < parallel_checkout.nr) {
+		struct parallel_checkout_item *pc_item =
+			&parallel_checkout.items[pct->next_item++];
+
+		pthread_mutex_unlock(&pct->mutex);
+		write_pc_item_1(pc_item, pct->state, &cache);
+		pthread_mutex_lock(&pct->mutex);
+
+		pct->nr_done++;
+		if (pc_item->status != PC_ITEM_COLLIDED)
+			pct->nr_progress++;
+		pthread_cond_signal(&pct->cond);
+	}
+	pthread_mutex_unlock(&pct->mutex);
+
+	cache_def_clear(&cache);
+	trace2_thread_exit();
+	return NULL;
+}
+
+/*
+ * Write the queued items from threads of this process rather than from
+ * checkout--worker processes. The threads share the object store and
+ * claim items one at a time, while the main thread only updates the
+ * progress meter.
+ */
+static void write_items_in_threads(struct checkout *state, int num_threads)
+{
+	struct pc_threads pct = { .state = state };
+	pthread_t *threads;
+	size_t shown = 0;
+	int i, err;
+
+	parallel_checkout.big_file_threshold =
+		repo_settings_get_big_file_threshold(the_repository);
+
+	pthread_mutex_init(&pct.mutex, NULL);
+	pthread_cond_init(&pct.cond, NULL);
+	enable_obj_read_lock();
+
+	ALLOC_ARRAY(threads, num_threads);
+	for (i = 0; i < num_threads; i++) {
+		err = pthread_create(&threads[i], NULL, checkout_worker_thread, &pct);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+
+	pthread_mutex_lock(&pct.mutex);
+	while (pct.nr_done < parallel_checkout.nr) {
+		size_t nr_progress;
+
+		pthread_cond_wait(&pct.cond, &pct.mutex);
+		nr_progress = pct.nr_progress;
+		pthread_mutex_unlock(&pct.mutex);
+
+		for (; shown < nr_progress; shown++)
+			advance_progress_meter();
+
+		pthread_mutex_lock(&pct.mutex);
+	}
+	pthread_mutex_unlock(&pct.mutex);
+
+	for (i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	disable_obj_read_lock();
+	pthread_cond_destroy(&pct.cond);
+	pthread_mutex_destroy(&pct.mutex);
+}
+
+static int use_worker_threads(void)
+{
+	const char *mode;
+
+	if (repo_config_get_string_tmp(the_repository, "checkout.workermode", &mode) ||
+	    !strcmp(mode, "process"))
+		return 0;
+	if (strcmp(mode, "threads"))
+		die(_("invalid value for '%s': '%s'"), "checkout.workerMode", mode);
+
+	return HAVE_THREADS;
+}
+
 int run_parallel_checkout(struct checkout *state, int num_workers, int threshold,
 			  struct progress *progress, unsigned int *progress_cnt)
 {
@@ -665,6 +804,8 @@ int run_parallel_checkout(struct checkout *state, int num_workers, int threshold
 
 	if (num_workers <= 1 || parallel_checkout.nr < threshold) {
 		write_items_sequentially(state);
+	} else if (use_worker_threads()) {
+		write_items_in_threads(state, num_workers);
 	} else {
 		struct pc_worker *workers = setup_workers(state, num_workers);
 		gather_results_from_workers(workers, num_workers);
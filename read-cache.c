@@ -2639,7 +2639,7 @@ static void copy_cache_entry_to_ondisk(struct ondisk_cache_entry *ondisk,
 	}
 }
 
-static int ce_write_entry(struct hashfile *f, struct cache_entry *ce,
+static int ce_write_entry(struct strbuf *out, struct cache_entry *ce,
 			  struct strbuf *previous_name, struct ondisk_cache_entry *ondisk)
 {
 	int size;
@@ -2658,9 +2658,9 @@ static int ce_write_entry(struct hashfile *f, struct cache_entry *ce,
 	if (!previous_name) {
 		int len = ce_namelen(ce);
 		copy_cache_entry_to_ondisk(ondisk, ce);
-		hashwrite(f, ondisk, size);
-		hashwrite(f, ce->name, len);
-		hashwrite(f, padding, align_padding_size(size, len));
+		strbuf_add(out, ondisk, size);
+		strbuf_add(out, ce->name, len);
+		strbuf_add(out, padding, align_padding_size(size, len));
 	} else {
 		int common, to_remove;
 		uint8_t prefix_size;
@@ -2676,10 +2676,10 @@ static int ce_write_entry(struct hashfile *f, struct cache_entry *ce,
 		prefix_size = encode_varint(to_remove, to_remove_vi);
 
 		copy_cache_entry_to_ondisk(ondisk, ce);
-		hashwrite(f, ondisk, size);
-		hashwrite(f, to_remove_vi, prefix_size);
-		hashwrite(f, ce->name + common, ce_namelen(ce) - common);
-		hashwrite(f, padding, 1);
+		strbuf_add(out, ondisk, size);
+		strbuf_add(out, to_remove_vi, prefix_size);
+		strbuf_add(out, ce->name + common, ce_namelen(ce) - common);
+		strbuf_add(out, padding, 1);
 
 		strbuf_splice(previous_name, common, to_remove,
 			      ce->name + common, ce_namelen(ce) - common);
@@ -2800,6 +2800,249 @@ enum write_extensions {
 };
 #define WRITE_ALL_EXTENSIONS ((enum write_extensions)-1)
 
+/*
+ * Number of cache entries encoded at once by a thread, and number of
+ * encoded chunks per thread that may wait to be written. Together they
+ * bound the memory taken by encoded entries that are not written yet.
+ */
+#define WRITE_ENTRIES_PER_CHUNK 1024
+#define WRITE_CHUNKS_PER_THREAD 4
+
+/*
+ * A range of cache entries that is serialized into a buffer by one of
+ * the worker threads, while the main thread hashes and writes the
+ * chunks before it. Every IEOT block starts a new chunk.
+ */
+struct write_entries_chunk {
+	int start, end;		/* range of istate->cache covered by this chunk */
+	int block;		/* IEOT block this chunk belongs to */
+	int block_start;	/* whether the chunk starts its IEOT block */
+	const char *previous_name; /* index v4: last name before this chunk */
+	int previous_namelen;
+};
+
+struct write_entries_slot {
+	struct strbuf out;
+	int nr;			/* number of entries written */
+	int ready;
+};
+
+struct write_entries_pool {
+	struct cache_entry **cache;
+	int v4;
+	struct write_entries_chunk *chunks;
+	int nr_chunks;
+	struct write_entries_slot *slots;
+	int window;
+	int next;		/* next chunk to be claimed by a worker */
+	int written;		/* chunks below this one have been written */
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t ready_cond;
+};
+
+static void write_entries_chunk(struct write_entries_pool *pool,
+				struct write_entries_chunk *c,
+				struct write_entries_slot *slot)
+{
+	struct ondisk_cache_entry ondisk;
+	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name = NULL;
+	int i;
+
+	if (pool->v4) {
+		strbuf_add(&previous_name_buf, c->previous_name,
+			   c->previous_namelen);
+		/*
+		 * Like the single-threaded writer does at an IEOT boundary,
+		 * keep the length of the previous name but make sure nothing
+		 * is shared with it, so the block can be decoded on its own.
+		 */
+		if (c->block_start && previous_name_buf.len)
+			previous_name_buf.buf[0] = 0;
+		previous_name = &previous_name_buf;
+	}
+
+	for (i = c->start; i < c->end; i++) {
+		struct cache_entry *ce = pool->cache[i];
+
+		if (ce->ce_flags & CE_REMOVE)
+			continue;
+		ce_write_entry(&slot->out, ce, previous_name, &ondisk);
+		slot->nr++;
+	}
+
+	strbuf_release(&previous_name_buf);
+}
+
+static void *write_entries_thread(void *_data)
+{
+	struct write_entries_pool *pool = _data;
+
+	pthread_mutex_lock(&pool->mutex);
+	while (pool->next < pool->nr_chunks) {
+		int i = pool->next;
+		struct write_entries_slot *slot = &pool->slots[i % pool->window];
+
+		if (i >= pool->written + pool->window) {
+			pthread_cond_wait(&pool->work_cond, &pool->mutex);
+			continue;
+		}
+		pool->next++;
+		pthread_mutex_unlock(&pool->mutex);
+
+		write_entries_chunk(pool, &pool->chunks[i], slot);
+
+		pthread_mutex_lock(&pool->mutex);
+		slot->ready = 1;
+		pthread_cond_broadcast(&pool->ready_cond);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+/*
+ * Split the IEOT blocks into chunks of at most "per_chunk" entries, and
+ * look up the name each chunk continues from in index v4. The entry
+ * before a chunk may be rewritten by the thread of the previous chunk
+ * (see CE_STRIP_NAME), so this has to be done before starting any
+ * thread.
+ */
+static struct write_entries_chunk *split_write_chunks(struct index_state *istate,
+						      int v4, int *block_start,
+						      int nr_blocks, int per_chunk,
+						      int *nr_chunks)
+{
+	struct write_entries_chunk *chunks = NULL;
+	int alloc = 0, nr = 0;
+
+	for (int b = 0; b < nr_blocks; b++) {
+		int end = b + 1 < nr_blocks ? block_start[b + 1] : istate->cache_nr;
+
+		for (int i = block_start[b]; i < end || i == block_start[b];
+		     i += per_chunk) {
+			struct write_entries_chunk *c;
+
+			ALLOC_GROW(chunks, nr + 1, alloc);
+			c = &chunks[nr++];
+			memset(c, 0, sizeof(*c));
+			c->start = i;
+			c->end = end - i > per_chunk ? i + per_chunk : end;
+			c->block = b;
+			c->block_start = i == block_start[b];
+
+			if (v4) {
+				int j = c->start - 1;
+
+				/*
+				 * After a stripped name, the writer continues
+				 * from an empty name.
+				 */
+				while (j >= 0 && (istate->cache[j]->ce_flags & CE_REMOVE))
+					j--;
+				c->previous_name = "";
+				if (j >= 0 && !(istate->cache[j]->ce_flags & CE_STRIP_NAME)) {
+					c->previous_name = istate->cache[j]->name;
+					c->previous_namelen = ce_namelen(istate->cache[j]);
+				}
+			}
+		}
+	}
+
+	*nr_chunks = nr;
+	return chunks;
+}
+
+/*
+ * Serialize the cache entries on one thread per IEOT block, and hash and
+ * write them in order as they complete. The trailing checksum has to
+ * cover the file sequentially, but hashing earlier chunks overlaps with
+ * encoding later ones. Only a bounded window of encoded chunks is kept
+ * in memory at any time.
+ */
+static void write_entries_threaded(struct index_state *istate,
+				   struct hashfile *f, int v4,
+				   int *block_start, int nr_blocks,
+				   struct index_entry_offset_table *ieot)
+{
+	struct write_entries_pool pool = {
+		.cache = istate->cache,
+		.v4 = v4,
+	};
+	int per_chunk = git_env_ulong("GIT_TEST_INDEX_WRITE_CHUNK",
+				      WRITE_ENTRIES_PER_CHUNK);
+	pthread_t *threads;
+	int i, err, block_nr = 0;
+	off_t block_offset = 0;
+
+	if (per_chunk < 1)
+		per_chunk = 1;
+	pool.chunks = split_write_chunks(istate, v4, block_start, nr_blocks,
+					 per_chunk, &pool.nr_chunks);
+	pool.window = nr_blocks * WRITE_CHUNKS_PER_THREAD;
+	CALLOC_ARRAY(pool.slots, pool.window);
+	for (i = 0; i < pool.window; i++)
+		strbuf_init(&pool.slots[i].out, 0);
+	pthread_mutex_init(&pool.mutex, NULL);
+	pthread_cond_init(&pool.work_cond, NULL);
+	pthread_cond_init(&pool.ready_cond, NULL);
+
+	ALLOC_ARRAY(threads, nr_blocks);
+	for (i = 0; i < nr_blocks; i++) {
+		err = pthread_create(&threads[i], NULL, write_entries_thread, &pool);
+		if (err)
+			die(_("unable to create write_entries thread: %s"), strerror(err));
+	}
+
+	for (i = 0; i < pool.nr_chunks; i++) {
+		struct write_entries_chunk *c = &pool.chunks[i];
+		struct write_entries_slot *slot = &pool.slots[i % pool.window];
+
+		pthread_mutex_lock(&pool.mutex);
+		while (!slot->ready)
+			pthread_cond_wait(&pool.ready_cond, &pool.mutex);
+		pthread_mutex_unlock(&pool.mutex);
+
+		if (c->block_start) {
+			block_nr = 0;
+			block_offset = hashfile_total(f);
+		}
+		block_nr += slot->nr;
+		hashwrite(f, slot->out.buf, slot->out.len);
+
+		if (i + 1 == pool.nr_chunks || pool.chunks[i + 1].block_start) {
+			if (block_nr || c->block + 1 < nr_blocks) {
+				ieot->entries[ieot->nr].nr = block_nr;
+				ieot->entries[ieot->nr].offset = block_offset;
+				ieot->nr++;
+			}
+		}
+
+		pthread_mutex_lock(&pool.mutex);
+		strbuf_reset(&slot->out);
+		slot->nr = 0;
+		slot->ready = 0;
+		pool.written = i + 1;
+		pthread_cond_broadcast(&pool.work_cond);
+		pthread_mutex_unlock(&pool.mutex);
+	}
+
+	for (i = 0; i < nr_blocks; i++) {
+		err = pthread_join(threads[i], NULL);
+		if (err)
+			die(_("unable to join write_entries thread: %s"), strerror(err));
+	}
+
+	free(threads);
+	pthread_cond_destroy(&pool.ready_cond);
+	pthread_cond_destroy(&pool.work_cond);
+	pthread_mutex_destroy(&pool.mutex);
+	for (i = 0; i < pool.window; i++)
+		strbuf_release(&pool.slots[i].out);
+	free(pool.slots);
+	free(pool.chunks);
+}
+
 /*
  * On success, `tempfile` is closed. If it is the temporary file
  * of a `struct lock_file`, we will therefore effectively perform
@@ -2825,9 +3068,10 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	int csum_fsync_flag;
 	int ieot_entries = 1;
 	struct index_entry_offset_table *ieot = NULL;
+	int *block_start = NULL, nr_blocks = 0;
 	struct repository *r = istate->repo;
 	struct strbuf sb = STRBUF_INIT;
-	int nr, nr_threads, ret;
+	int nr_threads, ret;
 
 	f = hashfd(the_repository->hash_algo, tempfile->fd, tempfile->filename.buf);
 
@@ -2891,14 +3135,15 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 			ieot = xcalloc(1, sizeof(struct index_entry_offset_table)
 				+ (ieot_blocks * sizeof(struct index_entry_offset)));
 			ieot_entries = DIV_ROUND_UP(entries, ieot_blocks);
+			ALLOC_ARRAY(block_start, ieot_blocks);
+			block_start[nr_blocks++] = 0;
 		}
 	}
 
-	offset = hashfile_total(f);
-
-	nr = 0;
-	previous_name = (hdr_version == 4) ? &previous_name_buf : NULL;
-
+	/*
+	 * Check and fix up the entries before serializing any of them, as
+	 * smudging racily clean entries needs to look at the worktree.
+	 */
 	for (i = 0; i < entries; i++) {
 		struct cache_entry *ce = cache[i];
 		if (ce->ce_flags & CE_REMOVE)
@@ -2918,40 +3163,40 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 
 			drop_cache_tree = 1;
 		}
-		if (ieot && i && (i % ieot_entries == 0)) {
-			ieot->entries[ieot->nr].nr = nr;
-			ieot->entries[ieot->nr].offset = offset;
-			ieot->nr++;
-			/*
-			 * If we have a V4 index, set the first byte to an invalid
-			 * character to ensure there is nothing common with the previous
-			 * entry
-			 */
-			if (previous_name)
-				previous_name->buf[0] = 0;
-			nr = 0;
-
-			offset = hashfile_total(f);
-		}
-		if (ce_write_entry(f, ce, previous_name, (struct ondisk_cache_entry *)&ondisk) < 0)
-			err = -1;
-
 		if (err)
 			break;
-		nr++;
+		if (ieot && i && (i % ieot_entries == 0))
+			block_start[nr_blocks++] = i;
 	}
-	if (ieot && nr) {
-		ieot->entries[ieot->nr].nr = nr;
-		ieot->entries[ieot->nr].offset = offset;
-		ieot->nr++;
-	}
-	strbuf_release(&previous_name_buf);
 
 	if (err) {
 		ret = err;
 		goto out;
 	}
 
+	previous_name = (hdr_version == 4) ? &previous_name_buf : NULL;
+
+	if (ieot) {
+		write_entries_threaded(istate, f, !!previous_name,
+				       block_start, nr_blocks, ieot);
+		trace2_data_intmax("index", the_repository, "write/blocks",
+				   nr_blocks);
+	} else {
+		struct strbuf entry = STRBUF_INIT;
+
+		for (i = 0; i < entries; i++) {
+			struct cache_entry *ce = cache[i];
+			if (ce->ce_flags & CE_REMOVE)
+				continue;
+			strbuf_reset(&entry);
+			ce_write_entry(&entry, ce, previous_name,
+				       (struct ondisk_cache_entry *)&ondisk);
+			hashwrite(f, entry.buf, entry.len);
+		}
+		strbuf_release(&entry);
+	}
+	strbuf_release(&previous_name_buf);
+
 	offset = hashfile_total(f);
 
 	/*
@@ -3110,6 +3355,7 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	strbuf_release(&sb);
 	free(eoie_c);
 	free(ieot);
+	free(block_start);
 	return ret;
 }
 
@@ -64,6 +64,39 @@ static void reftable_backend_release(struct reftable_backend *be)
 	reftable_iterator_destroy(&be->it);
 }
 
+/*
+ * Auto-compact the stack after a new table has been appended to it. This
+ * is done by us instead of by the reftable library as part of committing
+ * the addition so that the time spent compacting shows up in trace2 and
+ * so that "reftable.autoCompaction" can disable it.
+ *
+ * It is possible that a concurrent writer is already trying to compact
+ * parts of the stack, which would lead to a `REFTABLE_LOCK_ERROR` because
+ * parts of the stack are locked already. Similarly, the stack may have
+ * been rewritten by a concurrent writer, which causes
+ * `REFTABLE_OUTDATED_ERROR`. Both of these errors are benign, so we
+ * simply ignore them.
+ */
+static int reftable_backend_auto_compact(struct reftable_backend *be,
+					 struct repository *repo,
+					 int enabled)
+{
+	int ret = 0;
+
+	if (enabled) {
+		trace2_timer_start(TRACE2_TIMER_ID_REFTABLE_AUTO_COMPACT);
+		ret = reftable_stack_auto_compact(be->stack);
+		trace2_timer_stop(TRACE2_TIMER_ID_REFTABLE_AUTO_COMPACT);
+		if (ret == REFTABLE_LOCK_ERROR || ret == REFTABLE_OUTDATED_ERROR)
+			ret = 0;
+	}
+
+	trace2_data_intmax("reftable", repo, "stack-depth",
+			   reftable_stack_tables_len(be->stack));
+
+	return ret;
+}
+
 static int reftable_backend_read_ref(struct reftable_backend *be,
 				     const char *refname,
 				     struct object_id *oid,
@@ -145,6 +178,7 @@ struct reftable_ref_store {
 
 	unsigned int store_flags;
 	enum log_refs_config log_all_ref_updates;
+	int auto_compact;
 	int err;
 };
 
@@ -361,6 +395,8 @@ static int reftable_be_config(const char *var, const char *value,
 		if (lock_timeout < 0 && lock_timeout != -1)
 			die("reftable lock timeout does not support negative values other than -1");
 		opts->lock_timeout_ms = lock_timeout;
+	} else if (!strcmp(var, "reftable.autocompaction")) {
+		opts->disable_auto_compact = !git_config_bool(var, value);
 	}
 
 	return 0;
@@ -406,6 +442,13 @@ static struct ref_store *reftable_be_init(struct repository *repo,
 
 	repo_config(the_repository, reftable_be_config, &refs->write_options);
 
+	/*
+	 * We perform auto-compaction ourselves after each write, see
+	 * reftable_backend_auto_compact().
+	 */
+	refs->auto_compact = !refs->write_options.disable_auto_compact;
+	refs->write_options.disable_auto_compact = 1;
+
 	/*
 	 * It is somewhat unfortunate that we have to mirror the default block
 	 * size of the reftable library here. But given that the write options
@@ -1684,7 +1727,7 @@ static int write_transaction_table(struct reftable_writer *writer, void *cb_data
 	return ret;
 }
 
-static int reftable_be_transaction_finish(struct ref_store *ref_store UNUSED,
+static int reftable_be_transaction_finish(struct ref_store *ref_store,
 					  struct ref_transaction *transaction,
 					  struct strbuf *err)
 {
@@ -1702,6 +1745,12 @@ static int reftable_be_transaction_finish(struct ref_store *ref_store UNUSED,
 		ret = reftable_addition_commit(tx_data->args[i].addition);
 		if (ret < 0)
 			goto done;
+
+		ret = reftable_backend_auto_compact(tx_data->args[i].be,
+						    ref_store->repo,
+						    tx_data->args[i].refs->auto_compact);
+		if (ret < 0)
+			goto done;
 	}
 
 done:
@@ -2028,6 +2077,11 @@ static int reftable_be_rename_ref(struct ref_store *ref_store,
 		goto done;
 	ret = reftable_stack_add(arg.be->stack, &write_copy_table, &arg,
 				 REFTABLE_STACK_NEW_ADDITION_RELOAD);
+	if (ret < 0)
+		goto done;
+
+	ret = reftable_backend_auto_compact(arg.be, ref_store->repo,
+					    refs->auto_compact);
 
 done:
 	assert(ret != REFTABLE_API_ERROR);
@@ -2058,6 +2112,11 @@ static int reftable_be_copy_ref(struct ref_store *ref_store,
 		goto done;
 	ret = reftable_stack_add(arg.be->stack, &write_copy_table, &arg,
 				 REFTABLE_STACK_NEW_ADDITION_RELOAD);
+	if (ret < 0)
+		goto done;
+
+	ret = reftable_backend_auto_compact(arg.be, ref_store->repo,
+					    refs->auto_compact);
 
 done:
 	assert(ret != REFTABLE_API_ERROR);
@@ -2423,6 +2482,11 @@ static int reftable_be_create_reflog(struct ref_store *ref_store,
 
 	ret = reftable_stack_add(be->stack, &write_reflog_existence_table, &arg,
 				 REFTABLE_STACK_NEW_ADDITION_RELOAD);
+	if (ret < 0)
+		goto done;
+
+	ret = reftable_backend_auto_compact(be, ref_store->repo,
+					    refs->auto_compact);
 
 done:
 	return ret;
@@ -2495,6 +2559,9 @@ static int reftable_be_delete_reflog(struct ref_store *ref_store,
 
 	ret = reftable_stack_add(be->stack, &write_reflog_delete_table, &arg,
 				 REFTABLE_STACK_NEW_ADDITION_RELOAD);
+	if (!ret)
+		ret = reftable_backend_auto_compact(be, ref_store->repo,
+						    refs->auto_compact);
 
 	assert(ret != REFTABLE_API_ERROR);
 	return ret;
@@ -2714,8 +2781,14 @@ static int reftable_be_reflog_expire(struct ref_store *ref_store,
 	 * Future improvement: we could skip writing records that were
 	 * not changed.
 	 */
-	if (!(flags & EXPIRE_REFLOGS_DRY_RUN))
+	if (!(flags & EXPIRE_REFLOGS_DRY_RUN)) {
 		ret = reftable_addition_commit(add);
+		if (ret < 0)
+			goto done;
+
+		ret = reftable_backend_auto_compact(be, ref_store->repo,
+						    refs->auto_compact);
+	}
 
 done:
 	if (add)
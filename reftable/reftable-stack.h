@@ -166,4 +166,7 @@ reftable_stack_compaction_stats(struct reftable_stack *st);
 /* Return the hash of the stack. */
 enum reftable_hash reftable_stack_hash_id(struct reftable_stack *st);
 
+/* Return the number of tables in the stack. */
+size_t reftable_stack_tables_len(struct reftable_stack *st);
+
 #endif
@@ -1854,3 +1854,8 @@ enum reftable_hash reftable_stack_hash_id(struct reftable_stack *st)
 {
 	return reftable_merged_table_hash_id(st->merged);
 }
+
+size_t reftable_stack_tables_len(struct reftable_stack *st)
+{
+	return st->merged->tables_len;
+}
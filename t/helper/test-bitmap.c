@@ -4,6 +4,7 @@
 #include "git-compat-util.h"
 #include "pack-bitmap.h"
 #include "setup.h"
+#include "trace.h"
 
 static int bitmap_list_commits(void)
 {
@@ -35,8 +36,117 @@ static int bitmap_dump_pseudo_merge_objects(uint32_t n)
 	return test_bitmap_pseudo_merge_objects(the_repository, n);
 }
 
+/*
+ * Synthetic input for the word kernels: stretches of empty words, full
+ * words and random literals, roughly like the reachability bitmaps of a
+ * packfile where history is clustered.
+ */
+static struct bitmap *bench_bitmap(uint64_t *seed, size_t nr)
+{
+	struct bitmap *bitmap = bitmap_word_alloc(nr);
+	size_t i = 0;
+
+	while (i < nr) {
+		size_t len;
+		int kind;
+
+		*seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		kind = (*seed >> 33) % 3;
+		len = 1 + (*seed >> 40) % 256;
+		if (len > nr - i)
+			len = nr - i;
+
+		while (len--) {
+			*seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+			if (kind == 0)
+				bitmap->words[i++] = 0;
+			else if (kind == 1)
+				bitmap->words[i++] = ~(eword_t)0;
+			else
+				bitmap->words[i++] = *seed ^ (*seed >> 29);
+		}
+	}
+
+	return bitmap;
+}
+
+static void bench_report(const char *op, size_t words, int rounds,
+			 uint64_t start, size_t result)
+{
+	double secs = (getnanotime() - start) / 1000000000.0;
+
+	printf("%-16s %12.0f words/sec (result %"PRIuMAX")\n", op,
+	       secs > 0 ? (double)words * rounds / secs : 0.0,
+	       (uintmax_t)result);
+}
+
+static int bitmap_bench(size_t words, int rounds)
+{
+	uint64_t seed = 1, start;
+	struct bitmap *a = bench_bitmap(&seed, words);
+	struct bitmap *b = bench_bitmap(&seed, words);
+	struct ewah_bitmap *ewah = bitmap_to_ewah(b);
+	size_t result = 0;
+
+	start = getnanotime();
+	for (int i = 0; i < rounds; i++) {
+		struct bitmap *tmp = ewah_to_bitmap(ewah);
+		result = tmp->word_alloc;
+		bitmap_free(tmp);
+	}
+	bench_report("ewah-to-bitmap", words, rounds, start, result);
+
+	start = getnanotime();
+	for (int i = 0; i < rounds; i++) {
+		struct bitmap *tmp = bitmap_dup(a);
+		bitmap_or_ewah(tmp, ewah);
+		result = tmp->word_alloc;
+		bitmap_free(tmp);
+	}
+	bench_report("or-ewah", words, rounds, start, result);
+
+	start = getnanotime();
+	for (int i = 0; i < rounds; i++) {
+		struct bitmap *tmp = bitmap_dup(a);
+		bitmap_and_not(tmp, b);
+		result = tmp->word_alloc;
+		bitmap_free(tmp);
+	}
+	bench_report("and-not", words, rounds, start, result);
+
+	start = getnanotime();
+	for (int i = 0; i < rounds; i++)
+		result = bitmap_popcount(a);
+	bench_report("popcount", words, rounds, start, result);
+
+	start = getnanotime();
+	for (int i = 0; i < rounds; i++)
+		result = ewah_bitmap_popcount(ewah);
+	bench_report("ewah-popcount", words, rounds, start, result);
+
+	start = getnanotime();
+	for (int i = 0; i < rounds; i++) {
+		struct ewah_iterator it;
+		eword_t word;
+
+		result = 0;
+		ewah_iterator_init(&it, ewah);
+		while (ewah_iterator_next(&word, &it))
+			result ^= word;
+	}
+	bench_report("ewah-iterate", words, rounds, start, result);
+
+	bitmap_free(a);
+	bitmap_free(b);
+	ewah_free(ewah);
+	return 0;
+}
+
 int cmd__bitmap(int argc, const char **argv)
 {
+	if (argc == 4 && !strcmp(argv[1], "bench"))
+		return bitmap_bench(strtoul(argv[2], NULL, 10), atoi(argv[3]));
+
 	setup_git_directory();
 
 	if (argc == 2 && !strcmp(argv[1], "list-commits"))
@@ -57,7 +167,8 @@ int cmd__bitmap(int argc, const char **argv)
 	      "\ttest-tool bitmap dump-hashes\n"
 	      "\ttest-tool bitmap dump-pseudo-merges\n"
 	      "\ttest-tool bitmap dump-pseudo-merge-commits <n>\n"
-	      "\ttest-tool bitmap dump-pseudo-merge-objects <n>");
+	      "\ttest-tool bitmap dump-pseudo-merge-objects <n>\n"
+	      "\ttest-tool bitmap bench <words> <rounds>");
 
 	return -1;
 }
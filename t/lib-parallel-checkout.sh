@@ -36,6 +36,30 @@ test_checkout_workers () {
 	rm "$trace_file"
 } 8>&2 2>&4
 
+# Run "${@:2}" and check that $1 checkout worker threads were started
+test_checkout_worker_threads () {
+	if test $# -lt 2
+	then
+		BUG "too few arguments to test_checkout_worker_threads"
+	fi &&
+
+	local expected_threads="$1" &&
+	shift &&
+
+	local trace_file=trace-test-checkout-worker-threads &&
+	rm -f "$trace_file" &&
+	(
+		GIT_TRACE2_EVENT="$(pwd)/$trace_file" &&
+		export GIT_TRACE2_EVENT &&
+		"$@" 2>&8
+	) &&
+
+	local threads="$(grep "\"event\":\"thread_start\".*:pcheckout\"" "$trace_file" | wc -l)" &&
+	test $threads -eq $expected_threads &&
+	! grep "child_start.*checkout--worker" "$trace_file" &&
+	rm "$trace_file"
+} 8>&2 2>&4
+
 # Verify that both the working tree and the index were created correctly
 verify_checkout () {
 	if test $# -ne 1
@@ -46,4 +46,25 @@ test_perf "read-tree status br_ballast ($nr_files)" '
 	git status
 '
 
+test_expect_success "setup untracked files" '
+	for i in $(test_seq 50)
+	do
+		mkdir -p untracked/$i/a/b &&
+		for j in $(test_seq 20)
+		do
+			: >untracked/$i/f$j &&
+			: >untracked/$i/a/f$j &&
+			: >untracked/$i/a/b/f$j || return 1
+		done || return 1
+	done
+'
+
+for threads in 1 2 4 8
+do
+	test_perf "status -uall (threads: $threads)" "
+		git -c core.untrackedCache=false \
+			-c core.untrackedThreads=$threads status -uall
+	"
+done
+
 test_done
@@ -57,10 +57,13 @@ test_perf "read-tree br_ballast_plus_1 ($nr_files)" '
 	done
 '
 
-test_perf "switch between br_base br_ballast ($nr_files)" '
-	git checkout -q br_base &&
-	git checkout -q br_ballast
-'
+for threads in 1 4
+do
+	test_perf "switch between br_base br_ballast (tree threads: $threads) ($nr_files)" "
+		git -c checkout.treeThreads=$threads checkout -q br_base &&
+		git -c checkout.treeThreads=$threads checkout -q br_ballast
+	"
+done
 
 test_perf "switch between br_ballast br_ballast_plus_1 ($nr_files)" '
 	git checkout -q br_ballast_plus_1 &&
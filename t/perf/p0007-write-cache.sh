@@ -26,4 +26,11 @@ test_perf "write_locked_index $count times ($nr_files files)" "
 	test-tool write-cache $count
 "
 
+for threads in 2 4 8
+do
+	test_perf "write_locked_index $count times ($nr_files files, threads: $threads)" "
+		GIT_TEST_INDEX_THREADS=$threads test-tool write-cache $count
+	"
+done
+
 test_done
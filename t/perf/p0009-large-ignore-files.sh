@@ -0,0 +1,44 @@
+#!/bin/sh
+
+test_description='Tests performance of large .gitignore files'
+
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+test_expect_success 'setup 10000 ignore patterns and 10000 untracked files' '
+	for i in $(test_seq 2500)
+	do
+		echo "generated-$i.out" &&
+		echo "*.ext$i" &&
+		echo "/build/target-$i/" &&
+		echo "!keep-$i.out" || return 1
+	done >.gitignore &&
+	echo "*~" >>.gitignore &&
+	echo "cache-*/" >>.gitignore &&
+	git add .gitignore &&
+	git commit -q -m ignores &&
+	for i in $(test_seq 100)
+	do
+		mkdir -p dir$i/sub &&
+		for j in $(test_seq 50)
+		do
+			: >dir$i/file$j.c &&
+			: >dir$i/sub/generated-$j.out || return 1
+		done || return 1
+	done
+'
+
+test_perf 'status -uall with large .gitignore' '
+	git -c core.untrackedCache=false status -uall >/dev/null
+'
+
+test_perf 'status --ignored with large .gitignore' '
+	git -c core.untrackedCache=false status --ignored >/dev/null
+'
+
+test_perf 'add --dry-run with large .gitignore' '
+	git add --dry-run . >/dev/null
+'
+
+test_done
@@ -23,4 +23,15 @@ test_perf 'list blobs' '
 		--unordered --filter=object:type=blob
 '
 
+test_expect_success 'setup list of objects' '
+	git rev-list --objects --all >objects
+'
+
+for threads in 1 4
+do
+	test_perf "cat-file --batch from stdin (threads = $threads)" "
+		git cat-file --batch --buffer --batch-threads=$threads <objects >/dev/null
+	"
+done
+
 test_done
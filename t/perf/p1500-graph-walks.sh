@@ -78,4 +78,16 @@ test_perf 'is-base check: git for-each-ref (disjoint-base)' '
 	git for-each-ref --format="%(is-base:refs/heads/disjoint-base)" --stdin <refs
 '
 
+test_expect_success 'setup reachability bitmaps' '
+	git repack -adb
+'
+
+test_perf 'ahead-behind counts: git for-each-ref (bitmaps)' '
+	git for-each-ref --format="%(ahead-behind:HEAD)" --stdin <refs
+'
+
+test_perf 'ahead-behind counts: git branch (bitmaps)' '
+	xargs git branch -l --format="%(ahead-behind:HEAD)" <branches
+'
+
 test_done
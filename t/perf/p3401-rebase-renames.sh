@@ -0,0 +1,52 @@
+#!/bin/sh
+
+test_description='Tests rebase performance with many inexact renames'
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+test_expect_success 'setup a big directory rename with edits' '
+	mkdir old &&
+	for i in $(test_seq 2000)
+	do
+		test_seq $i $((i + 200)) >old/file$i || return 1
+	done &&
+	git add old &&
+	test_tick &&
+	git commit -m base &&
+	git branch base &&
+
+	git checkout -b upstream &&
+	git mv old new &&
+	for i in $(test_seq 2000)
+	do
+		echo edit$i >>new/file$i &&
+		git mv new/file$i new/renamed$i || return 1
+	done &&
+	git add new &&
+	test_tick &&
+	git commit -m "rename and edit everything" &&
+
+	# Touch every file on the topic, so that all of them are relevant
+	# sources for the rename detection of the rebase.
+	git checkout -b topic base &&
+	for i in $(test_seq 2000)
+	do
+		{
+			echo topic$i &&
+			cat old/file$i
+		} >tmp &&
+		mv tmp old/file$i || return 1
+	done &&
+	git commit -q -a -m "topic"
+'
+
+for threads in 1 4
+do
+	test_perf "rebase over many renames (threads: $threads)" "
+		git checkout -q -f -B to-rebase topic &&
+		git -c diff.renameThreads=$threads rebase -q upstream
+	"
+done
+
+test_done
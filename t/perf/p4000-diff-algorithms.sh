@@ -26,4 +26,20 @@ test_perf 'log -p -3000 --patience' '
 	git log -p -3000 --patience >/dev/null
 '
 
+test_expect_success 'setup large generated files' '
+	test_seq 200000 |
+	sed -e "s/.*/{\"id\": &, \"value\": \"&&&&&&&&&&&&&&&&&&&&&&&&\"}/" >large.a &&
+	sed -e "/00, /s/value/VALUE/" large.a >large.b &&
+	large_a=$(git hash-object -w large.a) &&
+	large_b=$(git hash-object -w large.b) &&
+	test_export large_a large_b
+'
+
+for opts in "" "--histogram" "--patience" "-w"
+do
+	test_perf "diff large generated files $opts" "
+		git diff $opts \$large_a \$large_b >/dev/null
+	"
+done
+
 test_done
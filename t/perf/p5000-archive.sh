@@ -0,0 +1,30 @@
+#!/bin/sh
+
+test_description='Test git archive compression performance'
+
+. ./perf-lib.sh
+
+test_perf_large_repo
+
+for threads in 1 2 4 8
+do
+	test_perf "archive --format=tar (read threads: $threads)" "
+		git -c archive.readThreads=$threads archive HEAD >/dev/null
+	"
+done
+
+for threads in 1 2 4 8
+do
+	test_perf "archive --format=tar.gz (threads: $threads)" "
+		git -c tar.tar.gz.threads=$threads archive --format=tar.gz HEAD >/dev/null
+	"
+done
+
+for threads in 1 2 4 8
+do
+	test_perf "archive --format=zip (threads: $threads)" "
+		git -c zip.threads=$threads archive --format=zip HEAD >/dev/null
+	"
+done
+
+test_done
@@ -94,6 +94,19 @@ do
 		git rev-list --abbrev-commit HEAD >/dev/null
 	'
 
+	test_expect_success "list objects ($nr_packs)" '
+		git rev-list --objects --no-object-names --all >objects
+	'
+
+	for table in false true
+	do
+		test_perf "object lookups ($nr_packs, lookup table: $table)" "
+			git -c core.packLookupTable=$table cat-file \
+				--batch-check='%(objectsize)' --buffer \
+				<objects >/dev/null
+		"
+	done
+
 	# This simulates the interesting part of the repack, which is the
 	# actual pack generation, without smudging the on-disk setup
 	# between trials.
@@ -0,0 +1,41 @@
+#!/bin/sh
+
+test_description='Tests commit-graph write performance'
+
+. ./perf-lib.sh
+
+test_perf_large_repo
+
+test_expect_success 'setup' '
+	git repack -ad &&
+	rm -f .git/objects/info/commit-graph &&
+	rm -rf .git/objects/info/commit-graphs
+'
+
+# Count down from the number of CPUs, halving each time, so that the final
+# test uses as many threads as there are CPUs.
+test_expect_success 'set up thread-counting tests' '
+	t=$(test-tool online-cpus) &&
+	threads= &&
+	while test $t -gt 0
+	do
+		threads="$t $threads" &&
+		t=$((t / 2)) || return 1
+	done
+'
+
+for t in $threads
+do
+	test_perf "write --reachable ($t threads)" \
+		--setup "rm -f .git/objects/info/commit-graph" "
+		git -c commitGraph.threads=$t commit-graph write --reachable
+	"
+
+	test_perf "write --reachable --changed-paths ($t threads)" \
+		--setup "rm -f .git/objects/info/commit-graph" "
+		git -c commitGraph.threads=$t commit-graph write \
+			--reachable --changed-paths
+	"
+done
+
+test_done
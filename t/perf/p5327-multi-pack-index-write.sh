@@ -0,0 +1,58 @@
+#!/bin/sh
+
+test_description='Tests multi-pack-index write performance with many packs'
+. ./perf-lib.sh
+
+test_perf_large_repo
+
+# Split the history into packs of roughly equal size by walking the
+# first-parent chain, so that the number of objects in the MIDX stays
+# the same while the number of packs grows.
+repack_into_n () {
+	rm -rf staging &&
+	mkdir staging &&
+
+	git rev-list --first-parent --reverse HEAD >revs &&
+	total=$(wc -l <revs) &&
+	step=$(( (total + $1 - 1) / $1 )) &&
+	awk -v step=$step "NR % step == 0 || NR == $total" revs >tips &&
+
+	last= &&
+	while read rev
+	do
+		{
+			echo "$rev" &&
+			if test -n "$last"
+			then
+				echo "^$last"
+			fi
+		} |
+		git pack-objects --delta-base-offset --revs staging/pack ||
+		return 1
+		last=$rev
+	done <tips &&
+
+	rm -f .git/objects/pack/* &&
+	mv staging/* .git/objects/pack/
+}
+
+test_expect_success 'set up thread counts' '
+	threads="1 $(test-tool online-cpus)"
+'
+
+for nr_packs in 1 100 1000 2000
+do
+	test_expect_success "create $nr_packs-pack scenario" '
+		repack_into_n $nr_packs
+	'
+
+	for t in $threads
+	do
+		test_perf "write midx ($nr_packs packs, $t threads)" \
+			--setup "rm -f .git/objects/pack/multi-pack-index*" "
+			git -c multiPackIndex.threads=$t multi-pack-index write
+		"
+	done
+done
+
+test_done
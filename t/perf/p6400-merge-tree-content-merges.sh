@@ -0,0 +1,41 @@
+#!/bin/sh
+
+test_description='merge-tree with many content merges'
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+test_expect_success 'setup 2000 files changed on both sides' '
+	test_seq 200 >template &&
+	for i in $(test_seq 2000)
+	do
+		cp template file$i || return 1
+	done &&
+	git add . &&
+	git commit -q -m base &&
+	git branch side &&
+	for i in $(test_seq 2000)
+	do
+		sed -e "s/^10\$/ten/" file$i >tmp &&
+		mv tmp file$i || return 1
+	done &&
+	git commit -q -a -m ours &&
+	git tag ours &&
+	git checkout -q side &&
+	for i in $(test_seq 2000)
+	do
+		sed -e "s/^190\$/one-ninety/" file$i >tmp &&
+		mv tmp file$i || return 1
+	done &&
+	git commit -q -a -m theirs &&
+	git tag theirs
+'
+
+for threads in 1 4
+do
+	test_perf "merge-tree --write-tree (threads: $threads)" "
+		git -c merge.threads=$threads merge-tree --write-tree ours theirs
+	"
+done
+
+test_done
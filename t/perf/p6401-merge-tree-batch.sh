@@ -0,0 +1,52 @@
+#!/bin/sh
+
+test_description='merge-tree --stdin with many merges sharing a side'
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+test_expect_success 'setup one renaming side and 20 topics' '
+	mkdir dir &&
+	for i in $(test_seq 1000)
+	do
+		test_seq $i $((i + 100)) >dir/file$i || return 1
+	done &&
+	git add dir &&
+	git commit -q -m base &&
+	git tag base &&
+	git mv dir moved &&
+	for i in $(test_seq 1000)
+	do
+		echo tweak >>moved/file$i || return 1
+	done &&
+	git commit -q -a -m "rename and tweak everything" &&
+	git tag upstream &&
+	for t in $(test_seq 20)
+	do
+		git checkout -q -b topic$t base &&
+		for i in $(test_seq $t 20 1000)
+		do
+			sed -e "1s/.*/topic$t/" dir/file$i >tmp &&
+			mv tmp dir/file$i || return 1
+		done &&
+		git commit -q -a -m "topic $t" || return 1
+	done &&
+	for t in $(test_seq 20)
+	do
+		echo "base -- upstream topic$t" || return 1
+	done >batch
+'
+
+test_perf 'merge-tree, one process per merge' '
+	while read base sep branch1 branch2
+	do
+		git merge-tree --write-tree --merge-base=$base \
+			$branch1 $branch2 >/dev/null
+	done <batch
+'
+
+test_perf 'merge-tree --stdin' '
+	git merge-tree --stdin <batch >/dev/null
+'
+
+test_done
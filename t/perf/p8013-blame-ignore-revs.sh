@@ -0,0 +1,28 @@
+#!/bin/sh
+
+test_description='blame performance across a reformatting commit'
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+test_expect_success 'setup reformatted file' '
+	test_seq 5000 |
+	sed -e "s/.*/int function_&(int a, int b) { return a * & + b - value(a, b); }/" >file.c &&
+	git add file.c &&
+	git commit -q -m original &&
+	sed -e "s/(int a, int b) { return/(int a,\n\t\tint b)\n{\n\treturn/" \
+	    -e "s/; }\$/;\n}/" file.c >file.new &&
+	mv file.new file.c &&
+	git commit -q -a -m reformat &&
+	git rev-parse HEAD >ignore-revs
+'
+
+test_perf 'blame' '
+	git blame file.c >/dev/null
+'
+
+test_perf 'blame --ignore-revs-file' '
+	git blame --ignore-revs-file=ignore-revs file.c >/dev/null
+'
+
+test_done
@@ -955,6 +955,73 @@ test_expect_success SYMLINKS 'symlinks not respected in-tree' '
 	test_grep "unable to access.*gitignore" err
 '
 
+test_expect_success 'long ignore files match like short ones' '
+	git init long-ignore &&
+	(
+		cd long-ignore &&
+		cat >patterns <<-\EOF &&
+		*.o
+		!keep.o
+		build/
+		/root-only
+		doc/*.html
+		foo
+		!foo/
+		sub/literal
+		/sub/literal/
+		**/deep
+		*.tmp/
+		name.txt
+		*.[ch]~
+		!*.c~
+		*.log
+		!important.log
+		EOF
+		mkdir -p build foo dir/foo doc/sub x/sub/literal a/b/deep \
+			x.tmp sub/literal &&
+		: >build/x &&
+		: >dir/root-only &&
+		cat >paths <<-\EOF &&
+		a.o
+		keep.o
+		dir/keep.o
+		build
+		build/x
+		root-only
+		dir/root-only
+		doc/a.html
+		doc/sub/a.html
+		foo
+		dir/foo
+		file/foo
+		sub/literal
+		x/sub/literal
+		a/b/deep
+		x.tmp
+		y.tmp
+		name.txt
+		dir/Name.TXT
+		a.c~
+		b.h~
+		x.log
+		important.log
+		dir/important.log
+		plain
+		EOF
+		cp patterns .gitignore &&
+		for ignorecase in false true
+		do
+			git -c core.ignorecase=$ignorecase \
+				check-ignore -v -n --stdin <paths >expect &&
+			test_seq 40 | sed "s/^/no-such-name-/" >>.gitignore &&
+			git -c core.ignorecase=$ignorecase \
+				check-ignore -v -n --stdin <paths >actual &&
+			test_cmp expect actual &&
+			cp patterns .gitignore || return 1
+		done
+	)
+'
+
 test_expect_success EXPENSIVE 'large exclude file ignored in tree' '
 	test_when_finished "rm .gitignore" &&
 	dd if=/dev/zero of=.gitignore bs=101M count=1 &&
@@ -355,6 +355,59 @@ test_expect_success 'ref transaction: env var disables compaction' '
 	test_line_count -lt $expected repo/.git/reftable/tables.list
 '
 
+test_expect_success 'ref transaction: config disables compaction' '
+	test_when_finished "rm -rf repo" &&
+
+	git init repo &&
+	test_commit -C repo A &&
+	git -C repo config reftable.autoCompaction false &&
+
+	start=$(wc -l <repo/.git/reftable/tables.list) &&
+	iterations=5 &&
+	expected=$((start + iterations)) &&
+
+	for i in $(test_seq $iterations)
+	do
+		git -C repo update-ref branch-$i HEAD || return 1
+	done &&
+	test_line_count = $expected repo/.git/reftable/tables.list &&
+
+	git -C repo refs optimize --auto &&
+	test_line_count -lt $expected repo/.git/reftable/tables.list
+'
+
+test_expect_success 'ref transaction: config can re-enable compaction' '
+	test_when_finished "rm -rf repo" &&
+
+	git init repo &&
+	test_commit -C repo A &&
+	git -C repo config reftable.autoCompaction false &&
+
+	start=$(wc -l <repo/.git/reftable/tables.list) &&
+	iterations=5 &&
+	expected=$((start + iterations)) &&
+
+	for i in $(test_seq $iterations)
+	do
+		git -C repo update-ref branch-$i HEAD || return 1
+	done &&
+	test_line_count = $expected repo/.git/reftable/tables.list &&
+
+	git -C repo -c reftable.autoCompaction=true update-ref branch-new HEAD &&
+	test_line_count -lt $expected repo/.git/reftable/tables.list
+'
+
+test_expect_success 'ref transaction: auto-compaction is traced' '
+	test_when_finished "rm -rf repo trace2.txt" &&
+
+	git init repo &&
+	test_commit -C repo A &&
+	GIT_TRACE2_EVENT="$(pwd)/trace2.txt" \
+		git -C repo update-ref refs/heads/branch HEAD &&
+	grep "\"category\":\"reftable\",\"name\":\"auto_compaction\"" trace2.txt &&
+	grep "\"key\":\"stack-depth\",\"value\":\"1\"" trace2.txt
+'
+
 test_expect_success 'ref transaction: alternating table sizes are compacted' '
 	test_when_finished "rm -rf repo" &&
 
@@ -416,4 +416,91 @@ test_expect_success '-m references the correct modified tree' '
 	test_cmp expect actual
 '
 
+test_expect_success PTHREADS 'read trees ahead of the traversal on several threads' '
+	git init threads &&
+	(
+		cd threads &&
+		for d in a b c d
+		do
+			for s in x y z
+			do
+				mkdir -p $d/$s/sub &&
+				echo $d$s >$d/$s/file &&
+				echo $s >$d/$s/sub/file || return 1
+			done
+		done &&
+		git add . &&
+		git commit -m one &&
+		echo changed >>a/x/sub/file &&
+		echo changed >>c/z/file &&
+		git rm -r b/y &&
+		mkdir -p e/new &&
+		echo new >e/new/file &&
+		git add . &&
+		git commit -m two &&
+		git branch two &&
+		git checkout -b side HEAD^ &&
+		echo side >>d/x/file &&
+		git commit -a -m side &&
+
+		git checkout -f two &&
+		git -c checkout.treeThreads=1 read-tree -m HEAD^ HEAD side &&
+		git ls-files -s >../expect-3way &&
+		git reset --hard &&
+		GIT_TRACE2_EVENT="$(pwd)/../trace" GIT_TRACE2_EVENT_NESTING=5 \
+			git -c checkout.treeThreads=4 read-tree -m HEAD^ HEAD side &&
+		git ls-files -s >../actual-3way &&
+		test_trace2_data unpack_trees prefetch/threads 4 <../trace &&
+		git reset --hard &&
+
+		git -c checkout.treeThreads=4 checkout side &&
+		git ls-files -s >../actual-switch &&
+		git ls-tree -r --format="%(objectmode) %(objectname) 0%x09%(path)" side >../expect-switch &&
+		git status --porcelain >../actual-status
+	) &&
+	test_cmp expect-3way actual-3way &&
+	test_cmp expect-switch actual-switch &&
+	test_must_be_empty actual-status
+'
+
+test_expect_success PTHREADS 'read trees ahead while a directory becomes a file' '
+	git init dir-to-file &&
+	(
+		cd dir-to-file &&
+		for d in a b c d
+		do
+			mkdir -p $d/x/sub $d/y/sub &&
+			echo $d >$d/x/file &&
+			echo $d >$d/x/sub/file &&
+			echo $d >$d/y/sub/file || return 1
+		done &&
+		git add . &&
+		git commit -m dir &&
+		git rm -r -q d &&
+		echo file >d &&
+		for d in a b c
+		do
+			echo changed >>$d/x/sub/file &&
+			echo changed >>$d/y/sub/file || return 1
+		done &&
+		git add . &&
+		git commit -m file &&
+		git branch file &&
+		git checkout HEAD^ &&
+
+		GIT_TRACE2_EVENT="$(pwd)/../trace-dir-to-file" \
+		GIT_TRACE2_EVENT_NESTING=5 \
+			git -c checkout.treeThreads=4 -c core.untrackedThreads=4 \
+			checkout file &&
+		test_trace2_data unpack_trees prefetch/threads 4 \
+			<../trace-dir-to-file &&
+		test_trace2_data dir threads 4 <../trace-dir-to-file &&
+		git ls-files -s >../actual-dir-to-file &&
+		git ls-tree -r --format="%(objectmode) %(objectname) 0%x09%(path)" file >../expect-dir-to-file &&
+		git status --porcelain >../status-dir-to-file
+	) &&
+	test_cmp expect-dir-to-file actual-dir-to-file &&
+	test_must_be_empty status-dir-to-file
+'
+
 test_done
@@ -1456,4 +1456,44 @@ test_objects_filter "object:type=commit"
 test_objects_filter "object:type=tag"
 test_objects_filter "object:type=tree"
 
+test_expect_success 'setup input for --batch-threads' '
+	git -C repo rev-list --objects --all >threads-input &&
+	cat >>threads-input <<-EOF
+	HEAD:large.1000 with some rest
+	HEAD:does-not-exist
+	$(test_oid deadbeef) missing
+	HEAD~1^{tree}
+	EOF
+'
+
+for mode in batch batch-check
+do
+	test_expect_success "--$mode --batch-threads matches serial output" '
+		git -C repo cat-file --$mode="%(objectname) %(objecttype) %(objectsize) %(rest)" \
+			<threads-input >expect &&
+		git -C repo cat-file --$mode="%(objectname) %(objecttype) %(objectsize) %(rest)" \
+			--batch-threads=4 <threads-input >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "--$mode --batch-threads with objects filter" '
+		git -C repo cat-file --$mode --filter=blob:limit=1k \
+			<threads-input >expect &&
+		git -C repo cat-file --$mode --filter=blob:limit=1k \
+			--batch-threads=3 <threads-input >actual &&
+		test_cmp expect actual
+	'
+done
+
+test_expect_success '--batch-threads is incompatible with --batch-all-objects' '
+	test_must_fail git -C repo cat-file --batch-check --batch-all-objects \
+		--batch-threads=2 2>err &&
+	test_grep "cannot be used together" err
+'
+
+test_expect_success '--batch-threads requires a batch mode' '
+	test_must_fail git cat-file --batch-threads=2 commit HEAD 2>err &&
+	test_grep "requires a batch mode" err
+'
+
 test_done
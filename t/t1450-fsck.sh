@@ -852,6 +852,35 @@ test_expect_success 'fsck errors in packed objects' '
 	! grep corrupt out
 '
 
+test_expect_success 'fsck --threads reports the same errors' '
+	test_when_finished "rm -rf threads" &&
+	git init threads &&
+	(
+		cd threads &&
+		test_commit_bulk 50 &&
+		git cat-file commit HEAD >basis &&
+		sed "s/</one/" basis >one &&
+		sed "s/</two/" basis >two &&
+		one=$(git hash-object --literally -t commit -w one) &&
+		two=$(git hash-object --literally -t commit -w two) &&
+		git update-ref refs/heads/one $one &&
+		git update-ref refs/heads/two $two &&
+		git repack -ad &&
+
+		test_must_fail git fsck --threads=1 >expect 2>&1 &&
+		test_grep "error in commit $one.* - bad name" expect &&
+		test_grep "error in commit $two.* - bad name" expect &&
+		test_must_fail git fsck --threads=4 >actual 2>&1 &&
+		test_cmp expect actual &&
+		test_must_fail git -c core.bigFileThreshold=100 \
+			fsck --threads=4 >actual 2>&1 &&
+		test_cmp expect actual &&
+
+		test_must_fail git fsck --threads=-1 2>err &&
+		test_grep "invalid number of threads" err
+	)
+'
+
 test_expect_success 'fsck fails on corrupt packfile' '
 	hsh=$(git commit-tree -m mycommit HEAD^{tree}) &&
 	pack=$(echo $hsh | git pack-objects .git/objects/pack/pack) &&
@@ -95,6 +95,40 @@ test_expect_success 'index.skipHash config option' '
 	git -C sub fsck
 '
 
+test_expect_success 'index entries written by multiple threads' '
+	test_when_finished "rm -rf threads" &&
+	git init threads &&
+	(
+		cd threads &&
+		mkdir -p dir/sub &&
+		for i in $(test_seq 40)
+		do
+			echo $i >dir/sub/file-$i &&
+			echo $i >file-$i || return 1
+		done &&
+		git add . &&
+		for version in 2 4
+		do
+			git update-index --index-version $version &&
+			git ls-files --stage >expect &&
+			GIT_TRACE2_EVENT="$(pwd)/trace-$version" \
+				GIT_TEST_INDEX_THREADS=3 test-tool write-cache &&
+			test_trace2_data index write/blocks 3 <trace-$version &&
+			cp .git/index index-one-chunk &&
+			GIT_TEST_INDEX_WRITE_CHUNK=7 GIT_TEST_INDEX_THREADS=3 \
+				test-tool write-cache &&
+			test_cmp index-one-chunk .git/index &&
+			git -c index.threads=1 ls-files --stage >actual &&
+			test_cmp expect actual &&
+			git -c index.threads=3 ls-files --stage >actual &&
+			test_cmp expect actual &&
+			git update-index --show-index-version >actual &&
+			echo $version >expect &&
+			test_cmp expect actual || return 1
+		done
+	)
+'
+
 test_index_version () {
 	INDEX_VERSION_CONFIG=$1 &&
 	FEATURE_MANY_FILES=$2 &&
@@ -151,6 +151,35 @@ do
 	'
 done
 
+test_expect_success PTHREADS 'parallel checkout with worker threads' '
+	repo=various_threads &&
+	cp -R -P various $repo &&
+	git -C $repo submodule foreach "git update-index --refresh" &&
+
+	set_checkout_config 2 0 &&
+	test_config_global checkout.workerMode threads &&
+	test_checkout_worker_threads 2 \
+		git -C $repo checkout --recurse-submodules B2 &&
+	verify_checkout $repo
+'
+
+test_expect_success PTHREADS 'parallel checkout on clone with worker threads' '
+	test_config_global protocol.file.allow always &&
+	repo=various_threads_clone &&
+	set_checkout_config 2 0 &&
+	test_config_global checkout.workerMode threads &&
+	test_checkout_worker_threads 2 \
+		git clone --recurse-submodules --branch B2 various $repo &&
+	verify_checkout $repo
+'
+
+test_expect_success 'invalid checkout.workerMode' '
+	set_checkout_config 2 0 &&
+	test_config_global checkout.workerMode bogus &&
+	test_must_fail git clone various various_bogus 2>err &&
+	test_grep "invalid value for .checkout.workerMode.: .bogus." err
+'
+
 # Just to be paranoid, actually compare the working trees' contents directly.
 test_expect_success 'compare the working trees' '
 	rm -rf various_*/.git &&
@@ -163,7 +192,12 @@ test_expect_success 'compare the working trees' '
 	git diff --no-index various_sequential various_parallel &&
 	git diff --no-index various_sequential various_parallel_clone &&
 	git diff --no-index various_sequential various_sequential-fallback &&
-	git diff --no-index various_sequential various_sequential-fallback_clone
+	git diff --no-index various_sequential various_sequential-fallback_clone &&
+	if test_have_prereq PTHREADS
+	then
+		git diff --no-index various_sequential various_threads &&
+		git diff --no-index various_sequential various_threads_clone
+	fi
 '
 
 # Currently, each submodule is checked out in a separated child process, but
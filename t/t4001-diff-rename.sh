@@ -309,4 +309,42 @@ test_expect_success 'last line matters too' '
 	test_cmp expected actual.munged
 '
 
+test_expect_success 'diff.renameThreads does not change the result' '
+	test_when_finished "rm -rf threads" &&
+	git init threads &&
+	(
+		cd threads &&
+		mkdir old &&
+		for i in $(test_seq 20)
+		do
+			test_seq $i $((i + 40)) >old/file$i || return 1
+		done &&
+		printf "binary\0file\n" >old/binary &&
+		git add old &&
+		git commit -m old &&
+		git mv old new &&
+		for i in $(test_seq 20)
+		do
+			echo edit >>new/file$i &&
+			git mv new/file$i new/renamed$i || return 1
+		done &&
+		git add new &&
+		git commit -m new &&
+
+		git -c diff.renameThreads=1 diff-tree -r -M -C -C \
+			--name-status HEAD^ HEAD >expect &&
+		test_line_count = 21 expect &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -c diff.renameThreads=4 diff-tree -r -M -C -C \
+			--name-status HEAD^ HEAD >actual &&
+		test_cmp expect actual &&
+		grep "inexact renames/threads" trace &&
+
+		git -c diff.renameThreads=-1 diff-tree -r -M -C -C \
+			--name-status HEAD^ HEAD >actual 2>err &&
+		test_cmp expect actual &&
+		test_grep "invalid number of threads" err
+	)
+'
+
 test_done
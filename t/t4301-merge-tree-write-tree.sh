@@ -142,6 +142,18 @@ test_expect_success 'Content merge and a few conflicts' '
 	test_cmp expect actual
 '
 
+test_expect_success 'merge.threads does not change the result' '
+	test_expect_code 1 git merge-tree --write-tree side1 side4 >expect &&
+	test_expect_code 1 env GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+		git -c merge.threads=4 merge-tree --write-tree side1 side4 >actual &&
+	test_cmp expect actual &&
+	grep "content_merges/count:2" trace.perf &&
+	test_expect_code 1 git -c merge.threads=-1 \
+		merge-tree --write-tree side1 side4 >actual 2>err &&
+	test_cmp expect actual &&
+	test_grep "invalid number of threads" err
+'
+
 test_expect_success 'Auto resolve conflicts by "ours" strategy option' '
 	git checkout side1^0 &&
 
@@ -982,6 +994,91 @@ test_expect_success 'check the input format when --stdin is passed' '
 	test_cmp expect actual
 '
 
+test_expect_success '--stdin reuses renames across merges sharing a side' '
+	cat >input <<-EOF &&
+	side3 side1
+	side3 side2
+	side3 side4
+	side1 side2
+	side1 side3
+	EOF
+
+	GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+		git merge-tree --stdin <input >actual &&
+
+	>expect &&
+	while read branch1 branch2
+	do
+		if git merge-tree --write-tree -z $branch1 $branch2 >out
+		then
+			printf "1\0"
+		else
+			printf "0\0"
+		fi >>expect &&
+		cat out >>expect &&
+		printf "\0" >>expect || return 1
+	done <input &&
+	test_cmp expect actual &&
+
+	grep "renames/reused_side" trace.perf &&
+	grep "batch/merges:5" trace.perf
+'
+
+test_expect_success '--stdin with a directory rename on the shared side' '
+	test_when_finished "rm -rf dir-rename" &&
+	git init dir-rename &&
+	(
+		cd dir-rename &&
+		mkdir a &&
+		test_write_lines 1 2 3 4 5 >a/f1 &&
+		test_write_lines 6 7 8 9 10 >a/f2 &&
+		test_write_lines 11 12 13 14 15 >a/f3 &&
+		git add a &&
+		git commit -m base &&
+		git branch topicE &&
+		git branch topicF &&
+
+		git checkout -B main &&
+		git mv a b &&
+		git commit -m "rename a/ to b/" &&
+
+		git checkout topicE &&
+		git mv a/f1 a/g1 &&
+		git commit -m "rename a/f1 to a/g1" &&
+
+		git checkout topicF &&
+		test_write_lines 16 17 18 19 20 >a/g1 &&
+		git add a/g1 &&
+		git commit -m "add a/g1" &&
+
+		for config in "" "-c merge.directoryRenames=true"
+		do
+			for input in "main topicE" "main topicF" \
+				     "main topicE" "main topicE"
+			do
+				echo "$input" || return 1
+			done >input &&
+
+			git $config merge-tree --stdin <input >actual &&
+
+			>expect &&
+			while read branch1 branch2
+			do
+				if git $config merge-tree --write-tree -z \
+					$branch1 $branch2 >out
+				then
+					printf "1\0"
+				else
+					printf "0\0"
+				fi >>expect &&
+				cat out >>expect &&
+				printf "\0" >>expect || return 1
+			done <input &&
+			test_cmp expect actual || return 1
+		done
+	)
+'
+
 test_expect_success '--merge-base with tree OIDs' '
 	git merge-tree --merge-base=side1^ side1 side3 >with-commits &&
 	git merge-tree --merge-base=side1^^{tree} side1^{tree} side3^{tree} >with-trees &&
@@ -243,6 +243,18 @@ test_expect_success 'git archive on large files' '
 	test_cmp_bin b.tar b3.tar
 '
 
+test_expect_success 'archive.readThreads does not change the archive' '
+	test_config archive.readThreads 3 &&
+	git archive HEAD >b3.tar &&
+	test_cmp_bin b.tar b3.tar &&
+	git -c archive.readThreads=1 archive HEAD^{tree} >tree1.tar &&
+	git archive HEAD^{tree} >tree3.tar &&
+	test_cmp_bin tree1.tar tree3.tar &&
+	test_config core.bigfilethreshold 1 &&
+	git archive HEAD >b3.tar &&
+	test_cmp_bin b.tar b3.tar
+'
+
 test_expect_success 'git archive in a bare repo' '
 	git --git-dir bare.git archive HEAD >b3.tar
 '
@@ -397,6 +409,27 @@ test_expect_success GZIP 'extract tgz file' '
 	test_cmp_bin b.tar j.tar
 '
 
+test_expect_success 'tar.<format>.threads=1 keeps the single-threaded output' '
+	test_config tar.tgz.threads 1 &&
+	git archive --format=tgz HEAD >j4.tgz &&
+	test_cmp_bin j.tgz j4.tgz
+'
+
+test_expect_success GZIP 'tar.<format>.threads compresses in parallel' '
+	test_config tar.tgz.threads 2 &&
+	git archive --format=tgz HEAD >threads2.tgz &&
+	gzip -d -c <threads2.tgz >threads2.tar &&
+	test_cmp_bin b.tar threads2.tar
+'
+
+test_expect_success 'parallel gzip output does not depend on the thread count' '
+	test_config tar.tgz.threads 2 &&
+	git archive --format=tgz HEAD >threads2.tgz &&
+	test_config tar.tgz.threads 5 &&
+	git archive --format=tgz HEAD >threads5.tgz &&
+	test_cmp_bin threads2.tgz threads5.tgz
+'
+
 test_expect_success 'remote tar.gz is allowed by default' '
 	git archive --remote=. --format=tar.gz HEAD >remote.tar.gz &&
 	test_cmp_bin j.tgz remote.tar.gz
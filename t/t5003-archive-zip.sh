@@ -181,6 +181,12 @@ test_expect_success 'git archive with --output, inferring format (remote)' '
 	test_cmp_bin d.zip d4.zip
 '
 
+test_expect_success 'zip.threads does not change the archive' '
+	test_config zip.threads 3 &&
+	git archive --format=zip HEAD >d5.zip &&
+	test_cmp_bin d.zip d5.zip
+'
+
 test_expect_success \
     'git archive --format=zip with prefix' \
     'git archive --format=zip --prefix=prefix/ HEAD >e.zip'
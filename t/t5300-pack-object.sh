@@ -742,4 +742,49 @@ test_expect_success '--path-walk thin pack' '
 	git -C server index-pack --fix-thin --stdin <out.pack
 '
 
+test_expect_success 'pack.prefetchWindow does not change the pack' '
+	git init prefetch &&
+	(
+		cd prefetch &&
+		test_commit_bulk 20 &&
+		git repack -adf &&
+		git rev-list --objects --all >objs &&
+		git -c pack.prefetchWindow=0 pack-objects --stdout \
+			<objs >expect.pack &&
+		git -c pack.prefetchWindow=8 pack-objects --stdout \
+			<objs >actual.pack &&
+		test_cmp expect.pack actual.pack &&
+		test_must_fail git -c pack.prefetchWindow=-1 \
+			pack-objects --stdout <objs 2>err &&
+		test_grep "invalid pack.prefetchWindow" err
+	)
+'
+
+test_expect_success 'core.packLookupTable finds objects in many packs' '
+	git init lookup-table &&
+	(
+		cd lookup-table &&
+		for i in 1 2 3 4 5
+		do
+			test_commit $i &&
+			git repack -d || return 1
+		done &&
+		# the same objects once more in an extra pack
+		git rev-list --objects --all |
+			git pack-objects .git/objects/pack/pack &&
+
+		git rev-list --objects --no-object-names --all >in &&
+		echo $ZERO_OID >>in &&
+		git -c core.packLookupTable=false cat-file \
+			--batch-check="%(objectname) %(objecttype) %(objectsize)" \
+			<in >expect &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -c core.packLookupTable=true cat-file \
+			--batch-check="%(objectname) %(objecttype) %(objectsize)" \
+			<in >actual &&
+		test_cmp expect actual &&
+		grep "\"key\":\"lookup_table/objects\",\"value\":\"30\"" trace
+	)
+'
+
 test_done
@@ -586,6 +586,21 @@ test_expect_success 'left-right count not confused by bitmap-index' '
 	test_cmp expect actual
 '
 
+test_expect_success 'pack.writeBitmapThreads does not change the bitmap' '
+	for threads in 1 2 5
+	do
+		rm -f .git/objects/pack/*.bitmap &&
+		git -c pack.writeBitmapThreads=$threads repack -adb &&
+		cp .git/objects/pack/pack-*.bitmap bitmap.$threads || return 1
+	done &&
+	test_cmp_bin bitmap.1 bitmap.2 &&
+	test_cmp_bin bitmap.1 bitmap.5 &&
+
+	# and likewise when reusing the bitmaps we just wrote
+	git -c pack.writeBitmapThreads=5 repack -adb &&
+	test_cmp_bin bitmap.1 .git/objects/pack/pack-*.bitmap
+'
+
 test_bitmap_cases "pack.writeBitmapLookupTable"
 
 test_expect_success 'verify writing bitmap lookup table when enabled' '
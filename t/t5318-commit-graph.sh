@@ -270,6 +270,46 @@ test_expect_success 'build graph using --reachable' '
 graph_git_behavior 'append graph, commit 8 vs merge 1' full commits/8 merge/1
 graph_git_behavior 'append graph, commit 8 vs merge 2' full commits/8 merge/2
 
+test_expect_success 'commitGraph.threads does not change the graph' '
+	git -C full -c commitGraph.threads=1 commit-graph write --reachable &&
+	cp full/$objdir/info/commit-graph commit-graph-one-thread &&
+	git -C full -c commitGraph.threads=4 commit-graph write --reachable &&
+	test_cmp commit-graph-one-thread full/$objdir/info/commit-graph &&
+	git -C full rev-parse merge/3 >in &&
+	git -C full -c commitGraph.threads=1 \
+		commit-graph write --stdin-commits <in &&
+	cp full/$objdir/info/commit-graph commit-graph-one-thread &&
+	git -C full -c commitGraph.threads=4 \
+		commit-graph write --stdin-commits <in &&
+	test_cmp commit-graph-one-thread full/$objdir/info/commit-graph
+'
+
+test_expect_success 'commitGraph.threads does not change the Bloom filters' '
+	for args in "" "--max-new-filters=3"
+	do
+		rm -f full/$objdir/info/commit-graph &&
+		git -C full -c commitGraph.threads=1 \
+			commit-graph write --reachable --changed-paths $args &&
+		cp full/$objdir/info/commit-graph commit-graph-one-thread &&
+		rm -f full/$objdir/info/commit-graph &&
+		git -C full -c commitGraph.threads=4 \
+			commit-graph write --reachable --changed-paths $args &&
+		test_cmp commit-graph-one-thread full/$objdir/info/commit-graph ||
+		return 1
+	done &&
+	rm -f full/$objdir/info/commit-graph &&
+	GIT_TEST_BLOOM_SETTINGS_MAX_CHANGED_PATHS=2 git -C full \
+		-c commitGraph.threads=1 \
+		commit-graph write --reachable --changed-paths &&
+	cp full/$objdir/info/commit-graph commit-graph-one-thread &&
+	rm -f full/$objdir/info/commit-graph &&
+	GIT_TEST_BLOOM_SETTINGS_MAX_CHANGED_PATHS=2 git -C full \
+		-c commitGraph.threads=4 \
+		commit-graph write --reachable --changed-paths &&
+	test_cmp commit-graph-one-thread full/$objdir/info/commit-graph &&
+	git -C full commit-graph write --reachable --no-changed-paths
+'
+
 test_expect_success 'setup bare repo' '
 	git clone --bare --no-local full bare
 '
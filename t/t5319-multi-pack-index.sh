@@ -209,6 +209,20 @@ test_expect_success 'write midx with twelve packs' '
 
 compare_results_with_midx "twelve packs"
 
+test_expect_success 'multiPackIndex.threads does not change the midx' '
+	test_when_finished "rm -f midx.*" &&
+	for threads in 1 2 5
+	do
+		rm -f $objdir/pack/multi-pack-index &&
+		git -c multiPackIndex.threads=$threads \
+			multi-pack-index --object-dir=$objdir write &&
+		cp $objdir/pack/multi-pack-index midx.$threads || return 1
+	done &&
+	test_cmp_bin midx.1 midx.2 &&
+	test_cmp_bin midx.1 midx.5 &&
+	midx_read_expect 12 74 4 $objdir
+'
+
 test_expect_success 'multi-pack-index *.rev cleanup with --object-dir' '
 	git init repo &&
 	git clone -s repo alternate &&
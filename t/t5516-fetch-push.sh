@@ -1338,6 +1338,33 @@ do
 	'
 done
 
+test_expect_success 'reachable SHA1 check uses commit-graph in-process' '
+	mk_empty testrepo &&
+	(
+		cd testrepo &&
+		git config uploadpack.allowreachablesha1inwant true &&
+		git commit --allow-empty -m foo &&
+		git commit --allow-empty -m bar &&
+		git commit --allow-empty -m xyz &&
+		git tag -m tag annotated HEAD^ &&
+		git reset --hard HEAD^^ &&
+		git commit-graph write --reachable
+	) &&
+	SHA1_1=$(git --git-dir=testrepo/.git rev-parse annotated^{commit}) &&
+	SHA1_2=$(git --git-dir=testrepo/.git rev-parse HEAD@{1}) &&
+	mk_empty shallow &&
+	(
+		cd shallow &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.txt" GIT_TEST_PROTOCOL_VERSION=0 \
+			git fetch ../testrepo/.git $SHA1_1 &&
+		git cat-file commit $SHA1_1 &&
+		test_grep ! "\"argv\":\\[\"git\",\"rev-list\",\"--stdin\"" trace.txt &&
+		test_must_fail env GIT_TEST_PROTOCOL_VERSION=0 \
+			git fetch ../testrepo/.git $SHA1_2 2>err &&
+		test_grep "not our ref.*$SHA1_2\$" err
+	)
+'
+
 test_expect_success 'fetch follows tags by default' '
 	mk_test testrepo heads/main &&
 	test_when_finished "rm -rf src" &&
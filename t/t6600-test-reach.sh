@@ -529,6 +529,45 @@ test_expect_success 'for-each-ref ahead-behind:none' '
 		--format="%(refname) %(ahead-behind:commit-8-4)" --stdin
 '
 
+test_expect_success 'for-each-ref ahead-behind with reachability bitmaps' '
+	test_when_finished rm -rf bitmaps.git &&
+	format="%(refname) %(ahead-behind:commit-9-6) %(ahead-behind:commit-6-9)" &&
+	git for-each-ref --format="$format" refs/heads >expect &&
+
+	git clone --no-local --bare . bitmaps.git &&
+	git -C bitmaps.git repack -adb &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" \
+		git -C bitmaps.git for-each-ref --format="$format" refs/heads >actual &&
+	test_cmp expect actual &&
+	refs_nr=$(git for-each-ref refs/heads | wc -l) &&
+	test_trace2_data ahead_behind bitmap_counts $((2 * $refs_nr)) <trace.txt
+'
+
+test_expect_success 'for-each-ref ahead-behind falls back for unbitmapped tips' '
+	test_when_finished rm -rf bitmaps.git &&
+	git clone --no-local --bare . bitmaps.git &&
+	git -C bitmaps.git repack -adb &&
+	commit=$(git -C bitmaps.git commit-tree -p commit-7-8 -p commit-8-5 \
+		-m extra commit-7-8^{tree}) &&
+	git -C bitmaps.git update-ref refs/heads/extra $commit &&
+
+	cat >input <<-\EOF &&
+	refs/heads/commit-1-1
+	refs/heads/commit-9-9
+	refs/heads/extra
+	EOF
+	format="%(refname) %(ahead-behind:commit-9-6)" &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" \
+		git -C bitmaps.git for-each-ref --format="$format" \
+		--stdin <input >actual &&
+	test_trace2_data ahead_behind bitmap_counts 2 <trace.txt &&
+
+	rm bitmaps.git/objects/pack/*.bitmap &&
+	git -C bitmaps.git for-each-ref --format="$format" \
+		--stdin <input >expect &&
+	test_cmp expect actual
+'
+
 test_expect_success 'for-each-ref merged:linear' '
 	cat >input <<-\EOF &&
 	refs/heads/commit-1-1
@@ -313,4 +313,47 @@ test_expect_success 'status ignores submodule in excluded directory' '
 	test_cmp expected actual
 '
 
+test_expect_success PTHREADS 'status walks the working tree on several threads' '
+	git init threads &&
+	(
+		cd threads &&
+		echo "*.o" >.gitignore &&
+		for d in a b c d e
+		do
+			mkdir -p $d/sub/deep $d/empty $d/build &&
+			: >$d/file &&
+			: >$d/file.o &&
+			: >$d/sub/file &&
+			: >$d/sub/deep/file.o &&
+			: >$d/build/out || return 1
+		done &&
+		echo "!*.o" >b/sub/.gitignore &&
+		echo "build/" >c/.gitignore &&
+		git add a/file c/.gitignore &&
+		git init d/sub/nested &&
+		test_commit -C d/sub/nested initial &&
+		git commit -m initial &&
+
+		for args in "-uall --ignored" "-unormal --ignored" \
+			    "-uall --ignored=matching" "-unormal"
+		do
+			git -c core.untrackedThreads=1 status --porcelain $args \
+				>../expect &&
+			GIT_TRACE2_EVENT="$(pwd)/../trace" \
+				git -c core.untrackedThreads=4 status --porcelain \
+				$args >../actual &&
+			test_trace2_data dir threads 4 <../trace &&
+			test_cmp ../expect ../actual &&
+			rm ../trace || return 1
+		done &&
+
+		git -c core.untrackedThreads=1 clean -n -d -x >../expect &&
+		git -c core.untrackedThreads=4 clean -n -d -x >../actual &&
+		test_cmp ../expect ../actual &&
+
+		git -c core.untrackedThreads=-1 status --porcelain >../actual 2>../err &&
+		test_grep "invalid number of threads" ../err
+	)
+'
+
 test_done
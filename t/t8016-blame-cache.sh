@@ -0,0 +1,97 @@
+#!/bin/sh
+
+test_description='git blame with blame.cache'
+
+. ./test-lib.sh
+
+cache_files () {
+	find .git/objects/info/blame-cache -type f 2>/dev/null | wc -l
+}
+
+test_expect_success setup '
+	test_write_lines a b c d e f g h >file &&
+	git add file &&
+	test_tick &&
+	git commit -m one &&
+	for i in 2 3 4 5 6
+	do
+		sed -e "s/^$(echo a b c d e | cut -d" " -f$((i - 1)))\$/& $i/" file >file.new &&
+		mv file.new file &&
+		echo "line $i" >>file &&
+		test_tick &&
+		git commit -a -m "commit $i" || return 1
+	done &&
+	git mv file renamed &&
+	echo last >>renamed &&
+	test_tick &&
+	git commit -a -m rename
+'
+
+test_expect_success 'blame is not cached by default' '
+	git blame HEAD~2 -- file >/dev/null &&
+	test $(cache_files) = 0
+'
+
+test_expect_success 'blame of a commit is stored' '
+	git blame --porcelain HEAD~2 -- file >expect &&
+	git -c blame.cache=true blame --porcelain HEAD~2 -- file >actual &&
+	test_cmp expect actual &&
+	test $(cache_files) = 1
+'
+
+test_expect_success 'stored result is reused' '
+	git -c blame.cache=true blame --porcelain HEAD~2 -- file >actual &&
+	test_cmp expect actual &&
+	git -c blame.cache=true blame --show-stats HEAD~2 -- file >stats &&
+	grep "^num commits: 0\$" stats
+'
+
+test_expect_success 'descendant blame stops at the cached commit' '
+	git blame --show-stats HEAD renamed >stats &&
+	grep "^num commits: 6\$" stats &&
+	git -c blame.cache=true blame --show-stats HEAD renamed >stats &&
+	grep "^num commits: 2\$" stats
+'
+
+test_expect_success 'descendant blame output is unchanged' '
+	for opts in --porcelain --line-porcelain -s -L3,8
+	do
+		git blame $opts HEAD renamed >expect &&
+		git -c blame.cache=true blame $opts HEAD renamed >actual &&
+		test_cmp expect actual || return 1
+	done &&
+	git blame renamed >expect &&
+	git -c blame.cache=true blame renamed >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'partial and working tree blames are not stored' '
+	rm -rf .git/objects/info/blame-cache &&
+	git -c blame.cache=true blame -L2,3 HEAD renamed >/dev/null &&
+	git -c blame.cache=true blame renamed >/dev/null &&
+	test $(cache_files) = 0
+'
+
+test_expect_success 'options that change the walk bypass the cache' '
+	git -c blame.cache=true blame HEAD renamed >/dev/null &&
+	test $(cache_files) = 1 &&
+	git blame --show-stats -M HEAD renamed >expect &&
+	git -c blame.cache=true blame --show-stats -M HEAD renamed >actual &&
+	test_cmp expect actual &&
+	git blame HEAD~3..HEAD renamed >expect &&
+	git -c blame.cache=true blame HEAD~3..HEAD renamed >actual &&
+	test_cmp expect actual &&
+	test $(cache_files) = 1
+'
+
+test_expect_success 'corrupt cache files are ignored' '
+	git blame --porcelain HEAD renamed >expect &&
+	for f in $(find .git/objects/info/blame-cache -type f)
+	do
+		echo garbage >"$f" || return 1
+	done &&
+	git -c blame.cache=true blame --porcelain HEAD renamed >actual &&
+	test_cmp expect actual
+'
+
+test_done
@@ -0,0 +1,101 @@
+#include "unit-test.h"
+#include "ewah/ewok.h"
+
+/*
+ * Fill a bitmap with a mix of empty words, full words and random literal
+ * words, so that its compressed form contains runs of both kinds as well
+ * as literal stretches of varying length.
+ */
+static struct bitmap *random_bitmap(uint64_t *seed, size_t nr)
+{
+	struct bitmap *bitmap = bitmap_word_alloc(nr);
+	size_t i = 0;
+
+	while (i < nr) {
+		size_t len;
+		int kind;
+
+		*seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		kind = (*seed >> 33) % 3;
+		len = 1 + (*seed >> 40) % 80;
+		if (len > nr - i)
+			len = nr - i;
+
+		while (len--) {
+			*seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+			if (kind == 0)
+				bitmap->words[i++] = 0;
+			else if (kind == 1)
+				bitmap->words[i++] = ~(eword_t)0;
+			else
+				bitmap->words[i++] = *seed ^ (*seed >> 29);
+		}
+	}
+
+	return bitmap;
+}
+
+static size_t naive_popcount(struct bitmap *bitmap)
+{
+	size_t count = 0;
+
+	for (size_t i = 0; i < bitmap->word_alloc * BITS_IN_EWORD; i++)
+		count += bitmap_get(bitmap, i);
+	return count;
+}
+
+void test_ewah__to_bitmap_roundtrip(void)
+{
+	uint64_t seed = 1;
+
+	for (size_t nr = 1; nr < 2000; nr += 97) {
+		struct bitmap *bitmap = random_bitmap(&seed, nr);
+		struct ewah_bitmap *ewah = bitmap_to_ewah(bitmap);
+		struct bitmap *copy = ewah_to_bitmap(ewah);
+
+		cl_assert(bitmap_equals(bitmap, copy));
+		cl_assert(bitmap_equals_ewah(bitmap, ewah));
+
+		bitmap_free(bitmap);
+		bitmap_free(copy);
+		ewah_free(ewah);
+	}
+}
+
+void test_ewah__or_ewah(void)
+{
+	uint64_t seed = 2;
+
+	for (size_t nr = 1; nr < 2000; nr += 89) {
+		struct bitmap *a = random_bitmap(&seed, nr);
+		struct bitmap *b = random_bitmap(&seed, nr + nr / 3);
+		struct ewah_bitmap *ewah = bitmap_to_ewah(b);
+		struct bitmap *expect = bitmap_dup(a);
+
+		bitmap_or(expect, b);
+		bitmap_or_ewah(a, ewah);
+		cl_assert(bitmap_equals(expect, a));
+
+		bitmap_free(a);
+		bitmap_free(b);
+		bitmap_free(expect);
+		ewah_free(ewah);
+	}
+}
+
+void test_ewah__popcount(void)
+{
+	uint64_t seed = 3;
+
+	for (size_t nr = 1; nr < 2000; nr += 101) {
+		struct bitmap *bitmap = random_bitmap(&seed, nr);
+		struct ewah_bitmap *ewah = bitmap_to_ewah(bitmap);
+		size_t expect = naive_popcount(bitmap);
+
+		cl_assert_equal_i(expect, bitmap_popcount(bitmap));
+		cl_assert_equal_i(expect, ewah_bitmap_popcount(ewah));
+
+		bitmap_free(bitmap);
+		ewah_free(ewah);
+	}
+}
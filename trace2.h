@@ -511,6 +511,8 @@ enum trace2_timer_id {
 	TRACE2_TIMER_ID_TEST1 = 0, /* emits summary event only */
 	TRACE2_TIMER_ID_TEST2,     /* emits summary and thread events */
 
+	TRACE2_TIMER_ID_REFTABLE_AUTO_COMPACT, /* time spent auto-compacting */
+
 	/* Add additional timer definitions before here. */
 	TRACE2_NUMBER_OF_TIMERS
 };
@@ -30,6 +30,11 @@ static struct tr2_timer_metadata tr2_timer_metadata[TRACE2_NUMBER_OF_TIMERS] = {
 		.name = "test2",
 		.want_per_thread_events = 1,
 	},
+	[TRACE2_TIMER_ID_REFTABLE_AUTO_COMPACT] = {
+		.category = "reftable",
+		.name = "auto_compaction",
+		.want_per_thread_events = 0,
+	},
 
 	/* Add additional metadata before here. */
 };
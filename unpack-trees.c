@@ -27,10 +27,12 @@
 #include "trace2.h"
 #include "fsmonitor.h"
 #include "odb.h"
+#include "oidmap.h"
 #include "promisor-remote.h"
 #include "entry.h"
 #include "parallel-checkout.h"
 #include "setup.h"
+#include "thread-utils.h"
 
 /*
  * Error messages expected by scripts out of plumbing commands such as
@@ -863,6 +865,384 @@ static int traverse_by_cache_tree(int pos, int nr_entries, int nr_names,
 	return 0;
 }
 
+/*
+ * With checkout.treeThreads, worker threads walk the trees being unpacked
+ * ahead of traverse_trees() and read the subtrees that differ between
+ * them, which the traversal then takes instead of reading them itself.
+ * Subtrees that are the same in all trees are left alone, as the
+ * traversal usually skips them using the cache tree.
+ */
+#define TREE_PREFETCH_BYTES (64 * 1024 * 1024)
+
+enum prefetched_tree_state {
+	PREFETCH_READING,
+	PREFETCH_READY,
+	PREFETCH_TAKEN,		/* or read by the traversal itself */
+};
+
+struct prefetched_tree {
+	struct oidmap_entry entry;
+	enum prefetched_tree_state state;
+	void *buf;
+	unsigned long size;
+};
+
+/* The peer subtrees at one path, with a null oid for missing ones */
+struct tree_prefetch_item {
+	struct object_id oid[MAX_UNPACK_TREES];
+};
+
+struct tree_prefetch {
+	int n;
+	struct oidmap trees;
+	struct tree_prefetch_item *stack;
+	size_t stack_nr, stack_alloc;
+	size_t bytes;		/* read but not taken yet */
+	int nr_busy;
+	int quit;
+	unsigned nr_taken, nr_missed;
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t ready_cond;
+	pthread_t *threads;
+	int nr_threads;
+};
+
+static int next_subtree(struct tree_desc *t, struct name_entry *entry)
+{
+	while (tree_entry_gently(t, entry))
+		if (S_ISDIR(entry->mode))
+			return 1;
+	return 0;
+}
+
+/*
+ * Queue the subtrees of 't' (one tree_desc per tree being unpacked) that
+ * are not the same in all of them.  They are pushed in reverse, so that
+ * the workers take them in the order in which the traversal needs them.
+ */
+static void queue_differing_subtrees(struct tree_prefetch *tp,
+				     struct tree_desc *t)
+{
+	struct name_entry entry[MAX_UNPACK_TREES];
+	int have[MAX_UNPACK_TREES] = { 0 };
+	struct tree_prefetch_item *items = NULL;
+	size_t nr = 0, alloc = 0;
+	int i;
+
+	for (;;) {
+		const struct name_entry *first = NULL;
+		struct tree_prefetch_item *item;
+		int differ = 0;
+
+		for (i = 0; i < tp->n; i++) {
+			if (!have[i])
+				have[i] = next_subtree(&t[i], &entry[i]);
+			if (have[i] &&
+			    (!first ||
+			     base_name_compare(entry[i].path, entry[i].pathlen, S_IFDIR,
+					       first->path, first->pathlen, S_IFDIR) < 0))
+				first = &entry[i];
+		}
+		if (!first)
+			break;
+
+		ALLOC_GROW(items, nr + 1, alloc);
+		item = &items[nr];
+		for (i = 0; i < tp->n; i++) {
+			if (have[i] &&
+			    !base_name_compare(entry[i].path, entry[i].pathlen, S_IFDIR,
+					       first->path, first->pathlen, S_IFDIR)) {
+				oidcpy(&item->oid[i], &entry[i].oid);
+				have[i] = 0;
+			} else {
+				oidclr(&item->oid[i], the_repository->hash_algo);
+			}
+			if (i && !oideq(&item->oid[i], &item->oid[0]))
+				differ = 1;
+		}
+		if (differ)
+			nr++;
+	}
+
+	if (nr) {
+		pthread_mutex_lock(&tp->mutex);
+		ALLOC_GROW(tp->stack, tp->stack_nr + nr, tp->stack_alloc);
+		while (nr)
+			tp->stack[tp->stack_nr++] = items[--nr];
+		pthread_cond_broadcast(&tp->work_cond);
+		pthread_mutex_unlock(&tp->mutex);
+	}
+	free(items);
+}
+
+/*
+ * Read a tree to queue its subtrees.  Returns NULL if another worker is
+ * already at it.  Unless the traversal got to it first, '*keep' is set
+ * and the buffer is to be handed to the traversal with publish_tree().
+ */
+static void *read_prefetched_tree(struct tree_prefetch *tp,
+				  const struct object_id *oid,
+				  unsigned long *size, int *keep)
+{
+	struct prefetched_tree *pt;
+	struct object_info oi = OBJECT_INFO_INIT;
+	enum object_type type;
+	void *buf = NULL;
+
+	pthread_mutex_lock(&tp->mutex);
+	pt = oidmap_get(&tp->trees, oid);
+	if (pt && pt->state != PREFETCH_TAKEN) {
+		pthread_mutex_unlock(&tp->mutex);
+		return NULL;
+	}
+	if (!pt) {
+		CALLOC_ARRAY(pt, 1);
+		oidcpy(&pt->entry.oid, oid);
+		pt->state = PREFETCH_READING;
+		oidmap_put(&tp->trees, pt);
+	}
+	*keep = pt->state == PREFETCH_READING;
+	pthread_mutex_unlock(&tp->mutex);
+
+	/* missing or broken trees are left for the traversal to report */
+	oi.typep = &type;
+	oi.sizep = size;
+	oi.contentp = &buf;
+	if (odb_read_object_info_extended(the_repository->objects, oid, &oi,
+					  OBJECT_INFO_LOOKUP_REPLACE |
+					  OBJECT_INFO_FOR_PREFETCH) < 0 ||
+	    type != OBJ_TREE) {
+		FREE_AND_NULL(buf);
+		*size = 0;
+	}
+	return buf;
+}
+
+static void publish_tree(struct tree_prefetch *tp, const struct object_id *oid,
+			 void *buf, unsigned long size)
+{
+	struct prefetched_tree *pt;
+
+	pthread_mutex_lock(&tp->mutex);
+	pt = oidmap_get(&tp->trees, oid);
+	pt->buf = buf;
+	pt->size = size;
+	pt->state = PREFETCH_READY;
+	tp->bytes += size;
+	pthread_cond_broadcast(&tp->ready_cond);
+	pthread_mutex_unlock(&tp->mutex);
+}
+
+static void prefetch_trees(struct tree_prefetch *tp,
+			   const struct tree_prefetch_item *item)
+{
+	struct tree_desc t[MAX_UNPACK_TREES];
+	void *buf[MAX_UNPACK_TREES] = { NULL };
+	unsigned long size[MAX_UNPACK_TREES] = { 0 };
+	int keep[MAX_UNPACK_TREES] = { 0 };
+	int i, j;
+
+	for (i = 0; i < tp->n; i++) {
+		for (j = 0; j < i; j++)
+			if (oideq(&item->oid[i], &item->oid[j]))
+				break;
+		if (j < i) {
+			t[i] = t[j];
+			continue;
+		}
+		if (!is_null_oid(&item->oid[i]))
+			buf[i] = read_prefetched_tree(tp, &item->oid[i],
+						      &size[i], &keep[i]);
+		if (!buf[i] ||
+		    init_tree_desc_gently(&t[i], &item->oid[i], buf[i], size[i], 0))
+			init_tree_desc(&t[i], NULL, NULL, 0);
+	}
+
+	queue_differing_subtrees(tp, t);
+
+	for (i = 0; i < tp->n; i++) {
+		if (keep[i])
+			publish_tree(tp, &item->oid[i], buf[i], size[i]);
+		else
+			free(buf[i]);
+	}
+}
+
+static void *tree_prefetch_worker(void *data)
+{
+	struct tree_prefetch *tp = data;
+
+	pthread_mutex_lock(&tp->mutex);
+	for (;;) {
+		struct tree_prefetch_item item;
+
+		if (tp->quit || (!tp->stack_nr && !tp->nr_busy))
+			break;
+		if (!tp->stack_nr || tp->bytes >= TREE_PREFETCH_BYTES) {
+			pthread_cond_wait(&tp->work_cond, &tp->mutex);
+			continue;
+		}
+		item = tp->stack[--tp->stack_nr];
+		tp->nr_busy++;
+		pthread_mutex_unlock(&tp->mutex);
+
+		prefetch_trees(tp, &item);
+
+		pthread_mutex_lock(&tp->mutex);
+		if (!--tp->nr_busy && !tp->stack_nr)
+			pthread_cond_broadcast(&tp->work_cond);
+	}
+	pthread_mutex_unlock(&tp->mutex);
+	return NULL;
+}
+
+static int unpack_tree_threads(void)
+{
+	int nr_threads = 1;
+
+	repo_config_get_int(the_repository, "checkout.treethreads", &nr_threads);
+	if (nr_threads < 0) {
+		warning(_("invalid number of threads specified (%d) for %s"),
+			nr_threads, "checkout.treeThreads");
+		nr_threads = 1;
+	}
+	if (!HAVE_THREADS)
+		nr_threads = 1;
+	else if (!nr_threads)
+		nr_threads = online_cpus();
+	return nr_threads;
+}
+
+static struct tree_prefetch *start_tree_prefetch(struct unpack_trees_options *o,
+						 int n, struct tree_desc *t)
+{
+	struct tree_prefetch *tp;
+	struct tree_desc root[MAX_UNPACK_TREES];
+	int i, nr_threads;
+
+	/*
+	 * A one-way traversal has nothing to compare, and with a pathspec
+	 * or a sparse index much of what differs is never read.
+	 */
+	if (n < 2 || (o->pathspec && o->pathspec->nr) ||
+	    o->src_index->sparse_index)
+		return NULL;
+	nr_threads = unpack_tree_threads();
+	if (nr_threads < 2)
+		return NULL;
+
+	CALLOC_ARRAY(tp, 1);
+	tp->n = n;
+	oidmap_init(&tp->trees, 0);
+	pthread_mutex_init(&tp->mutex, NULL);
+	pthread_cond_init(&tp->work_cond, NULL);
+	pthread_cond_init(&tp->ready_cond, NULL);
+
+	/* the caller has read the root trees */
+	COPY_ARRAY(root, t, n);
+	queue_differing_subtrees(tp, root);
+
+	enable_obj_read_lock();
+	tp->nr_threads = nr_threads;
+	ALLOC_ARRAY(tp->threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&tp->threads[i], NULL,
+					 tree_prefetch_worker, tp);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	trace2_data_intmax("unpack_trees", the_repository,
+			   "prefetch/threads", nr_threads);
+	return tp;
+}
+
+static void stop_tree_prefetch(struct tree_prefetch *tp)
+{
+	struct oidmap_iter iter;
+	struct prefetched_tree *pt;
+	int i;
+
+	if (!tp)
+		return;
+
+	pthread_mutex_lock(&tp->mutex);
+	tp->quit = 1;
+	pthread_cond_broadcast(&tp->work_cond);
+	pthread_mutex_unlock(&tp->mutex);
+	for (i = 0; i < tp->nr_threads; i++)
+		pthread_join(tp->threads[i], NULL);
+	disable_obj_read_lock();
+
+	trace2_data_intmax("unpack_trees", the_repository,
+			   "prefetch/taken", tp->nr_taken);
+	trace2_data_intmax("unpack_trees", the_repository,
+			   "prefetch/missed", tp->nr_missed);
+
+	oidmap_iter_init(&tp->trees, &iter);
+	while ((pt = oidmap_iter_next(&iter)))
+		free(pt->buf);
+	oidmap_clear(&tp->trees, 1);
+	free(tp->stack);
+	free(tp->threads);
+	pthread_cond_destroy(&tp->ready_cond);
+	pthread_cond_destroy(&tp->work_cond);
+	pthread_mutex_destroy(&tp->mutex);
+	free(tp);
+}
+
+/* Take a tree read by the workers, or NULL to read it as usual. */
+static void *take_prefetched_tree(struct tree_prefetch *tp,
+				  const struct object_id *oid,
+				  unsigned long *size)
+{
+	struct prefetched_tree *pt;
+	void *buf = NULL;
+
+	pthread_mutex_lock(&tp->mutex);
+	pt = oidmap_get(&tp->trees, oid);
+	if (!pt) {
+		/* no need for the workers to keep it, then */
+		CALLOC_ARRAY(pt, 1);
+		oidcpy(&pt->entry.oid, oid);
+		pt->state = PREFETCH_TAKEN;
+		oidmap_put(&tp->trees, pt);
+	}
+	while (pt->state == PREFETCH_READING)
+		pthread_cond_wait(&tp->ready_cond, &tp->mutex);
+	if (pt->state == PREFETCH_READY) {
+		buf = pt->buf;
+		*size = pt->size;
+		tp->bytes -= pt->size;
+		pt->buf = NULL;
+		pt->state = PREFETCH_TAKEN;
+		pthread_cond_broadcast(&tp->work_cond);
+	}
+	if (buf)
+		tp->nr_taken++;
+	else
+		tp->nr_missed++;
+	pthread_mutex_unlock(&tp->mutex);
+	return buf;
+}
+
+static void *fill_unpack_tree_descriptor(struct unpack_trees_options *o,
+					 struct tree_desc *desc,
+					 const struct object_id *oid)
+{
+	void *buf;
+	unsigned long size;
+
+	if (!oid || !o->internal.tree_prefetch)
+		return fill_tree_descriptor(the_repository, desc, oid);
+
+	buf = take_prefetched_tree(o->internal.tree_prefetch, oid, &size);
+	if (!buf)
+		return fill_tree_descriptor(the_repository, desc, oid);
+	init_tree_desc(desc, oid, buf, size);
+	return buf;
+}
+
 static int traverse_trees_recursive(int n, unsigned long dirmask,
 				    unsigned long df_conflicts,
 				    struct name_entry *names,
@@ -937,7 +1317,7 @@ static int traverse_trees_recursive(int n, unsigned long dirmask,
 			const struct object_id *oid = NULL;
 			if (dirmask & 1)
 				oid = &names[i].oid;
-			buf[nr_buf++] = fill_tree_descriptor(the_repository, t + i, oid);
+			buf[nr_buf++] = fill_unpack_tree_descriptor(o, t + i, oid);
 		}
 	}
 
@@ -2007,7 +2387,10 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 
 		trace_performance_enter();
 		trace2_region_enter("unpack_trees", "traverse_trees", the_repository);
+		o->internal.tree_prefetch = start_tree_prefetch(o, len, t);
 		ret = traverse_trees(o->src_index, len, t, &info);
+		stop_tree_prefetch(o->internal.tree_prefetch);
+		o->internal.tree_prefetch = NULL;
 		trace2_region_leave("unpack_trees", "traverse_trees", the_repository);
 		trace_performance_leave("traverse_trees");
 		if (ret < 0)
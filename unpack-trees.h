@@ -12,6 +12,7 @@
 struct cache_entry;
 struct unpack_trees_options;
 struct pattern_list;
+struct tree_prefetch;
 
 typedef int (*merge_fn_t)(const struct cache_entry * const *src,
 		struct unpack_trees_options *options);
@@ -107,6 +108,9 @@ struct unpack_trees_options {
 
 		struct pattern_list *pl;
 		struct dir_struct *dir;
+
+		/* trees read ahead of the traversal, see checkout.treeThreads */
+		struct tree_prefetch *tree_prefetch;
 	} internal;
 };
 
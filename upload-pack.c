@@ -29,6 +29,7 @@
 #include "commit-graph.h"
 #include "commit-reach.h"
 #include "shallow.h"
+#include "tag.h"
 #include "write-or-die.h"
 #include "json-writer.h"
 #include "strmap.h"
@@ -704,6 +705,79 @@ static int do_reachable_revlist(struct child_process *cmd,
 	return -1;
 }
 
+/*
+ * Walking from our refs is only bounded when we have generation numbers;
+ * without them, "rev-list" is better at giving up early.
+ */
+static int use_in_process_reachability(void)
+{
+	return generation_numbers_enabled(the_repository);
+}
+
+/*
+ * In-process equivalent of do_reachable_revlist(): find out which of the
+ * objects in "src" can be reached from our refs without spawning
+ * "rev-list". Objects that are our refs themselves are trivially
+ * reachable. Like "rev-list", we peel tags and ignore objects that do not
+ * peel to a commit.
+ *
+ * If "reachable" is non-NULL, the reachable objects of "src" are added to
+ * it. Returns the number of objects in "src" that are not reachable.
+ */
+static int reachable_in_process(struct object_array *src,
+				struct object_array *reachable,
+				enum allow_uor allow_uor)
+{
+	struct commit_stack ours = COMMIT_STACK_INIT;
+	struct commit_stack theirs = COMMIT_STACK_INIT;
+	struct commit_list *found;
+	int unreachable = 0;
+
+	for (int i = get_max_object_index(the_repository); 0 < i; ) {
+		struct object *o = get_indexed_object(the_repository, --i);
+		if (!o || !is_our_ref(o, allow_uor))
+			continue;
+		o = deref_tag(the_repository, o, NULL, 0);
+		if (o && o->type == OBJ_COMMIT)
+			commit_stack_push(&ours, (struct commit *)o);
+	}
+
+	for (size_t i = 0; i < src->nr; i++) {
+		struct object *o = src->objects[i].item;
+
+		if (is_our_ref(o, allow_uor)) {
+			if (reachable)
+				add_object_array(o, NULL, reachable);
+			continue;
+		}
+
+		o = deref_tag(the_repository, o, NULL, 0);
+		if (!o)
+			unreachable++;
+		else if (o->type == OBJ_COMMIT)
+			commit_stack_push(&theirs, (struct commit *)o);
+	}
+
+	found = get_reachable_subset(ours.items, ours.nr,
+				     theirs.items, theirs.nr, TMP_MARK);
+
+	for (size_t i = 0; i < theirs.nr; i++) {
+		struct commit *c = theirs.items[i];
+
+		if (!(c->object.flags & TMP_MARK))
+			unreachable++;
+		else if (reachable)
+			add_object_array(&c->object, NULL, reachable);
+	}
+	for (struct commit_list *l = found; l; l = l->next)
+		l->item->object.flags &= ~TMP_MARK;
+
+	free_commit_list(found);
+	commit_stack_clear(&ours);
+	commit_stack_clear(&theirs);
+	return unreachable;
+}
+
 static int get_reachable_list(struct upload_pack_data *data,
 			      struct object_array *reachable)
 {
@@ -714,6 +788,12 @@ static int get_reachable_list(struct upload_pack_data *data,
 	const unsigned hexsz = the_hash_algo->hexsz;
 	int ret;
 
+	if (use_in_process_reachability()) {
+		reachable_in_process(&data->shallows, reachable,
+				     data->allow_uor);
+		return 0;
+	}
+
 	if (do_reachable_revlist(&cmd, &data->shallows, reachable,
 				 data->allow_uor) < 0) {
 		ret = -1;
@@ -760,6 +840,9 @@ static int has_unreachable(struct object_array *src, enum allow_uor allow_uor)
 	char buf[1];
 	int i;
 
+	if (use_in_process_reachability())
+		return !!reachable_in_process(src, NULL, allow_uor);
+
 	if (do_reachable_revlist(&cmd, src, NULL, allow_uor) < 0)
 		goto error;
 
@@ -170,6 +170,28 @@ static int ends_with_optional_cr(const char *l, long s, long i)
 	return 0;
 }
 
+/*
+ * Return the length of the common prefix of the first "n" bytes of "a"
+ * and "b", comparing a word at a time while they are the same.
+ */
+static long common_prefix(const char *a, const char *b, long n)
+{
+	long i = 0;
+
+	while (i + (long)sizeof(uint64_t) <= n) {
+		uint64_t wa, wb;
+
+		memcpy(&wa, a + i, sizeof(wa));
+		memcpy(&wb, b + i, sizeof(wb));
+		if (wa != wb)
+			break;
+		i += sizeof(uint64_t);
+	}
+	while (i < n && a[i] == b[i])
+		i++;
+	return i;
+}
+
 int xdl_recmatch(const char *l1, long s1, const char *l2, long s2, long flags)
 {
 	int i1, i2;
@@ -215,16 +237,10 @@ int xdl_recmatch(const char *l1, long s1, const char *l2, long s2, long flags)
 				return 0;
 		}
 	} else if (flags & XDF_IGNORE_WHITESPACE_AT_EOL) {
-		while (i1 < s1 && i2 < s2 && l1[i1] == l2[i2]) {
-			i1++;
-			i2++;
-		}
+		i1 = i2 = common_prefix(l1, l2, s1 < s2 ? s1 : s2);
 	} else if (flags & XDF_IGNORE_CR_AT_EOL) {
 		/* Find the first difference and see how the line ends */
-		while (i1 < s1 && i2 < s2 && l1[i1] == l2[i2]) {
-			i1++;
-			i2++;
-		}
+		i1 = i2 = common_prefix(l1, l2, s1 < s2 ? s1 : s2);
 		return (ends_with_optional_cr(l1, s1, i1) &&
 			ends_with_optional_cr(l2, s2, i2));
 	}
@@ -304,12 +320,69 @@ uint64_t xdl_hash_record_with_whitespace(uint8_t const **data,
 #define REASSOC_FENCE(x, y)
 #endif
 
+#if GIT_BYTE_ORDER == GIT_LITTLE_ENDIAN
+/*
+ * Helpers to feed the hash below eight characters at a time ("SWAR",
+ * SIMD within a register): a single 64-bit load tells us whether the
+ * line ends within the next eight characters, and if it does not, we
+ * evaluate HA = HA * 33^8 + (C0 * 33^7 + ... + C7) with the dependency
+ * chain over HA being just one multiplication and one addition.
+ */
+static const uint64_t pow33[9] = {
+	1ULL, 33ULL, 1089ULL, 35937ULL, 1185921ULL, 39135393ULL,
+	1291467969ULL, 42618442977ULL, 1406408618241ULL,
+};
+
+#define WORD_ONES  0x0101010101010101ULL
+#define WORD_HIGHS 0x8080808080808080ULL
+
+/*
+ * Non-zero if any byte of W is a newline; the lowest set bit is in the
+ * first such byte.
+ */
+static inline uint64_t word_has_newline(uint64_t w)
+{
+	w ^= WORD_ONES * '\n';
+	return (w - WORD_ONES) & ~w & WORD_HIGHS;
+}
+
+static inline unsigned lowest_set_byte(uint64_t mask)
+{
+#ifdef __GNUC__
+	return __builtin_ctzll(mask) / 8;
+#else
+	unsigned n = 0;
+	while (!(mask & 0xff)) {
+		mask >>= 8;
+		n++;
+	}
+	return n;
+#endif
+}
+
+/*
+ * C0 * 33^7 + C1 * 33^6 + ... + C7 for the bytes of W in memory order.
+ * Adjacent characters are combined pairwise within the word: first
+ * into 16-bit lanes (C0 * 33 + C1, ...), then into 32-bit lanes and
+ * finally into the whole word. No lane can overflow into its neighbour
+ * (255 * 34 * 1090 < 2^32), so this takes just three multiplications.
+ */
+static inline uint64_t word_poly(uint64_t w)
+{
+	w = (w & 0x00ff00ff00ff00ffULL) * 33 +
+	    ((w >> 8) & 0x00ff00ff00ff00ffULL);
+	w = (w & 0x0000ffff0000ffffULL) * pow33[2] +
+	    ((w >> 16) & 0x0000ffff0000ffffULL);
+	return (w & 0xffffffffULL) * pow33[4] + (w >> 32);
+}
+#endif
+
 uint64_t xdl_hash_record_verbatim(uint8_t const **data, uint8_t const *top) {
 	uint64_t ha = 5381, c0, c1;
 	uint8_t const *ptr = *data;
 #if 0
 	/*
-	 * The baseline form of the optimized loop below. This is the djb2
+	 * The baseline form of the optimized loops below. This is the djb2
 	 * hash (the above function uses a variant with XOR instead of ADD).
 	 */
 	for (; ptr < top && *ptr != '\n'; ptr++) {
@@ -318,6 +391,40 @@ uint64_t xdl_hash_record_verbatim(uint8_t const **data, uint8_t const *top) {
 	}
 	*data = ptr < top ? ptr + 1: ptr;
 #else
+#if GIT_BYTE_ORDER == GIT_LITTLE_ENDIAN
+	/*
+	 * Process eight characters per iteration. The word that holds the
+	 * newline is folded in without looking at its characters one by
+	 * one, so that there is a single unpredictable branch per line.
+	 */
+	while (top - ptr >= 8) {
+		uint64_t w, nl, c;
+
+		memcpy(&w, ptr, sizeof(w));
+		nl = word_has_newline(w);
+
+		if (nl) {
+			/*
+			 * Fold in the N characters before the newline by
+			 * shifting them to the end of the word; the zeros
+			 * that move in at the front do not change the sum.
+			 */
+			unsigned n = lowest_set_byte(nl);
+			*data = ptr + n + 1;
+			if (!n)
+				return ha;
+			c = word_poly(w << (8 * (8 - n)));
+			ha *= pow33[n];
+			REASSOC_FENCE(c, ha);
+			return ha + c;
+		}
+		c = word_poly(w);
+		ha *= pow33[8];
+		REASSOC_FENCE(c, ha);
+		ha += c;
+		ptr += 8;
+	}
+#endif
 	/* Process two characters per iteration. */
 	if (top - ptr >= 2) do {
 		if ((c0 = ptr[0]) == '\n') {